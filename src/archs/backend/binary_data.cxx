@@ -30,8 +30,22 @@
  */
 
 #include "binary_data.hxx"
+#include "byte_kernels.hxx"
+#include "content_hash.hxx"
+#include "suffix_array.hxx"
+#include "utils.hxx"
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <limits>
 #include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <boost/format.hpp>
 #include <sys/types.h>
 #include <bzlib.h>
@@ -45,116 +59,13 @@ using namespace Archive::Backend;
 
 namespace {
 
-void split(off_t *I,off_t *V,off_t start,off_t len,off_t h)
-{
-	off_t i,j,k,x,tmp,jj,kk;
-
-	if(len<16) {
-		for(k=start;k<start+len;k+=j) {
-			j=1;x=V[I[k]+h];
-			for(i=1;k+i<start+len;i++) {
-				if(V[I[k+i]+h]<x) {
-					x=V[I[k+i]+h];
-					j=0;
-				};
-				if(V[I[k+i]+h]==x) {
-					tmp=I[k+j];I[k+j]=I[k+i];I[k+i]=tmp;
-					j++;
-				};
-			};
-			for(i=0;i<j;i++) V[I[k+i]]=k+j-1;
-			if(j==1) I[k]=-1;
-		};
-		return;
-	};
-
-	x=V[I[start+len/2]+h];
-	jj=0;kk=0;
-	for(i=start;i<start+len;i++) {
-		if(V[I[i]+h]<x) jj++;
-		if(V[I[i]+h]==x) kk++;
-	};
-	jj+=start;kk+=jj;
-
-	i=start;j=0;k=0;
-	while(i<jj) {
-		if(V[I[i]+h]<x) {
-			i++;
-		} else if(V[I[i]+h]==x) {
-			tmp=I[i];I[i]=I[jj+j];I[jj+j]=tmp;
-			j++;
-		} else {
-			tmp=I[i];I[i]=I[kk+k];I[kk+k]=tmp;
-			k++;
-		};
-	};
-
-	while(jj+j<kk) {
-		if(V[I[jj+j]+h]==x) {
-			j++;
-		} else {
-			tmp=I[jj+j];I[jj+j]=I[kk+k];I[kk+k]=tmp;
-			k++;
-		};
-	};
-
-	if(jj>start) split(I,V,start,jj-start,h);
-
-	for(i=0;i<kk-jj;i++) V[I[jj+i]]=kk-1;
-	if(jj==kk-1) I[jj]=-1;
-
-	if(start+len>kk) split(I,V,kk,start+len-kk,h);
-}
-
-void qsufsort(off_t *I,off_t *V,const u_char *old,off_t oldsize)
-{
-	off_t buckets[256];
-	off_t i,h,len;
-
-	for(i=0;i<256;i++) buckets[i]=0;
-	for(i=0;i<oldsize;i++) buckets[old[i]]++;
-	for(i=1;i<256;i++) buckets[i]+=buckets[i-1];
-	for(i=255;i>0;i--) buckets[i]=buckets[i-1];
-	buckets[0]=0;
-
-	for(i=0;i<oldsize;i++) I[++buckets[old[i]]]=i;
-	I[0]=oldsize;
-	for(i=0;i<oldsize;i++) V[i]=buckets[old[i]];
-	V[oldsize]=0;
-	for(i=1;i<256;i++) if(buckets[i]==buckets[i-1]+1) I[buckets[i]]=-1;
-	I[0]=-1;
-
-	for(h=1;I[0]!=-(oldsize+1);h+=h) {
-		len=0;
-		for(i=0;i<oldsize+1;) {
-			if(I[i]<0) {
-				len-=I[i];
-				i-=I[i];
-			} else {
-				if(len) I[i-len]=-len;
-				len=V[I[i]]+1-i;
-				split(I,V,i,len,h);
-				i+=len;
-				len=0;
-			};
-		};
-		if(len) I[i-len]=-len;
-	};
-
-	for(i=0;i<oldsize+1;i++) I[V[i]]=i;
-}
-
 off_t matchlen(const u_char *olds,off_t oldsize,const u_char *news,off_t newsize)
 {
-	off_t i;
-
-	for(i=0;(i<oldsize)&&(i<newsize);i++)
-		if(olds[i]!=news[i]) break;
-
-	return i;
+	return ByteKernels::MatchLength(olds,news,min(oldsize,newsize));
 }
 
-off_t search(off_t *I,const u_char *olds,off_t oldsize,
+template<typename Index>
+off_t search(const Index *I,const u_char *olds,off_t oldsize,
 		const u_char *news,off_t newsize,off_t st,off_t en,off_t *pos)
 {
 	off_t x,y;
@@ -198,7 +109,7 @@ void offtout(off_t x,u_char *buf)
 	if(x<0) buf[7]|=0x80;
 }
 
-off_t offtin(u_char *buf)
+off_t offtin(const u_char *buf)
 {
 	off_t y;
 
@@ -225,13 +136,32 @@ inline int CheckAndThrow(int op, int accept1, int accept2, const char* file, int
 #define CHECK_BZ(op, accept) if (op != accept) throw runtime_error((boost::format("bzip: %1% in %2% at %3%") % op % __FILE__ % __LINE__).str());
 #define CHECKV_BZ(op, accept1, accept2) CheckAndThrow(op, accept1, accept2, __FILE__, __LINE__)
 
-} // anonymous namespace
+/* Differences of a region of the new file, ctrl holds the raw triples */
+struct Delta
+{
+	vector<off_t> ctrl;
+	vector<u_char> db;
+	vector<u_char> eb;
+};
+
+/* Thrown once the time budget of a diff is spent */
+struct Expired { };
 
-vector<unsigned char> BinaryData::CreatePatch(const vector<unsigned char>& oldData, const vector<unsigned char>& newData)
+/* Deadline of a diff, checked regularly while sorting and scanning */
+struct Budget
+{
+	bool limited;
+	chrono::steady_clock::time_point deadline;
+
+	void Check() const
+	{
+		if (limited && chrono::steady_clock::now() > deadline) throw Expired();
+	}
+};
+
+template<typename Index>
+void diff(const Index *I,const u_char *olds,off_t oldsize,const u_char *news,off_t newsize,Delta& delta,const Budget& budget)
 {
-	const u_char *olds;
-    const u_char *news;
-	off_t oldsize,newsize;
 	off_t scan,pos,len;
 	off_t lastscan,lastpos,lastoffset;
 	off_t oldscore,scsc;
@@ -239,65 +169,29 @@ vector<unsigned char> BinaryData::CreatePatch(const vector<unsigned char>& oldDa
 	off_t overlap,Ss,lens;
 	off_t i;
 	off_t dblen,eblen;
-	u_char buf[8];
-	u_char header[32];
-    
-    olds = &oldData[0];
-    oldsize = oldData.size();
-    news = &newData[0];
-    newsize = newData.size();
+	off_t steps=0;
 
-    vector<unsigned char> patch(sizeof(header));
-    vector<off_t> I(oldsize + 1);
-    vector<off_t> V(oldsize + 1);
-
-    vector<unsigned char> db(newsize + 1);
-    vector<unsigned char> eb(newsize + 1);
-	
-    qsufsort(&I[0],&V[0],olds,oldsize);
-
-    dblen=0;
+	delta.db.resize(newsize);
+	delta.eb.resize(newsize);
+	dblen=0;
 	eblen=0;
 
-	/* Create the patch */
-    
-    bz_stream ctrl;
-    memset(&ctrl, 0, sizeof(bz_stream));
-    u_char output[512];
-    
-	/* Header is
-		0	8	 "BSDIFF40"
-		8	8	length of bzip2ed ctrl block
-		16	8	length of bzip2ed diff block
-		24	8	length of new file */
-	/* File is
-		0	32	Header
-		32	??	Bzip2ed ctrl block
-		??	??	Bzip2ed diff block
-		??	??	Bzip2ed extra block */
-    
-    memcpy(header,"BSDIFF40",8);
-	offtout(0, header + 8);
-	offtout(0, header + 16);
-	offtout(newsize, header + 24);
-    
-	/* Compute the differences, writing ctrl as we go */
-    CHECK_BZ(BZ2_bzCompressInit(&ctrl, 9, 0, 30), BZ_OK);
-    ctrl.next_out = (char*)output;
-    ctrl.avail_out = 512;
-	scan=0;len=0;
+	scan=0;len=0;pos=0;
 	lastscan=0;lastpos=0;lastoffset=0;
 	while(scan<newsize) {
 		oldscore=0;
 
 		for(scsc=scan+=len;scan<newsize;scan++) {
-			len=search(&I[0],olds,oldsize,news+scan,newsize-scan,
+			if((++steps&0xfff)==0) budget.Check();
+			len=search(I,olds,oldsize,news+scan,newsize-scan,
 					0,oldsize,&pos);
 
-			for(;scsc<scan+len;scsc++)
-			if((scsc+lastoffset<oldsize) &&
-				(olds[scsc+lastoffset] == news[scsc]))
-				oldscore++;
+			if(scsc<scan+len) {
+				off_t limit=min(scan+len,oldsize-lastoffset);
+				if(limit>scsc)
+					oldscore+=ByteKernels::CountEqual(olds+scsc+lastoffset,news+scsc,limit-scsc);
+				scsc=scan+len;
+			};
 
 			if(((len==oldscore) && (len!=0)) || 
 				(len>oldscore+8)) break;
@@ -339,184 +233,934 @@ vector<unsigned char> BinaryData::CreatePatch(const vector<unsigned char>& oldDa
 				lenb-=lens;
 			};
 
-			for(i=0;i<lenf;i++)
-				db[dblen+i]=news[lastscan+i]-olds[lastpos+i];
+			ByteKernels::Subtract(delta.db.data()+dblen,news+lastscan,olds+lastpos,lenf);
 			for(i=0;i<(scan-lenb)-(lastscan+lenf);i++)
-				eb[eblen+i]=news[lastscan+lenf+i];
+				delta.eb[eblen+i]=news[lastscan+lenf+i];
 
 			dblen+=lenf;
 			eblen+=(scan-lenb)-(lastscan+lenf);
 
-			offtout(lenf,buf);
-            ctrl.next_in = (char*)buf;
-            ctrl.avail_in = 8;
-            CHECK_BZ(BZ2_bzCompress(&ctrl, BZ_RUN), BZ_RUN_OK);
-
-			offtout((scan-lenb)-(lastscan+lenf),buf);
-            ctrl.next_in = (char*)buf;
-            ctrl.avail_in = 8;
-            CHECK_BZ(BZ2_bzCompress(&ctrl, BZ_RUN), BZ_RUN_OK);
-
-			offtout((pos-lenb)-(lastpos+lenf),buf);
-            ctrl.next_in = (char*)buf;
-            ctrl.avail_in = 8;
-            CHECK_BZ(BZ2_bzCompress(&ctrl, BZ_RUN), BZ_RUN_OK);
+			delta.ctrl.push_back(lenf);
+			delta.ctrl.push_back((scan-lenb)-(lastscan+lenf));
+			delta.ctrl.push_back((pos-lenb)-(lastpos+lenf));
 
 			lastscan=scan-lenb;
 			lastpos=pos-lenb;
 			lastoffset=pos-scan;
-            
-            if (ctrl.avail_out) {
-                for (unsigned index = 0; index < 512 - ctrl.avail_out; ++index) patch.push_back(output[index]);
-                ctrl.next_out = (char*)output;
-                ctrl.avail_out = 512;
-            }
 		};
 	};
-    
-    while (CHECKV_BZ(BZ2_bzCompress(&ctrl, BZ_FINISH), BZ_FINISH_OK, BZ_STREAM_END) != BZ_STREAM_END) {
-        ctrl.next_out = (char*)output;
-        ctrl.avail_out = 512;
-    }
-	for (unsigned index = 0; index < 512 - ctrl.avail_out; ++index) patch.push_back(output[index]);
 
-	offtout(ctrl.total_out_lo32, header + 8);
-	CHECK_BZ(BZ2_bzCompressEnd(&ctrl), BZ_OK);
+	delta.db.resize(dblen);
+	delta.eb.resize(eblen);
+}
 
-	/* Write compressed diff data */
-    CHECK_BZ(BZ2_bzCompressInit(&ctrl, 9, 0, 30), BZ_OK);
-    ctrl.next_out = (char*)output;
-    ctrl.avail_out = 512;
-    
-    ctrl.next_in = (char*)&db[0];
-    ctrl.avail_in = dblen;
-	
-    CHECK_BZ(BZ2_bzCompress(&ctrl, BZ_RUN), BZ_RUN_OK);
-    while (CHECKV_BZ(BZ2_bzCompress(&ctrl, BZ_FINISH), BZ_FINISH_OK, BZ_STREAM_END) != BZ_STREAM_END) {
-        ctrl.next_out = (char*)output;
-        ctrl.avail_out = 512;
+/* Minimal size of a region of the new file scanned on its own */
+const off_t RegionSize = 4 << 20;
+
+Utils::WorkerPool& DeltaWorkers()
+{
+    // half of the cores, uploads into other buckets keep the rest
+    static Utils::WorkerPool Result(max(thread::hardware_concurrency(), 2u) / 2);
+    return Result;
+}
+
+/*
+ * Large files are split into regions diffed concurrently against the whole
+ * old file. Each region starts at old position 0, so the last seek of the
+ * preceding region is corrected to return there.
+ */
+template<typename Index>
+vector<Delta> diffRegions(const vector<Index>& I,const u_char *olds,off_t oldsize,const u_char *news,off_t newsize,const Budget& budget)
+{
+    auto& Workers = DeltaWorkers();
+    auto Count = min(static_cast<off_t>(Workers.Size() + 1), max(newsize / RegionSize, off_t(1)));
+
+    vector<Delta> Regions(Count);
+    vector<future<void>> Pending;
+    for (off_t Region = 1; Region < Count; ++Region) {
+        auto Start = newsize * Region / Count;
+        auto Size = newsize * (Region + 1) / Count - Start;
+        Pending.push_back(Workers.Submit([&I, &Regions, &budget, olds, oldsize, news, Start, Size, Region]() {
+            diff(&I[0], olds, oldsize, news + Start, Size, Regions[Region], budget);
+        }));
     }
-	for (unsigned index = 0; index < 512 - ctrl.avail_out; ++index) patch.push_back(output[index]);
-
-	offtout(ctrl.total_out_lo32, header + 16);
-	CHECK_BZ(BZ2_bzCompressEnd(&ctrl), BZ_OK);
-
-	/* Write compressed extra data */
-    if (eblen > 0) {
-        CHECK_BZ(BZ2_bzCompressInit(&ctrl, 9, 0, 30), BZ_OK);
-        ctrl.next_out = (char*)output;
-        ctrl.avail_out = 512;
-        
-        ctrl.next_in = (char*)&eb[0];
-        ctrl.avail_in = eblen;
-        
-        CHECK_BZ(BZ2_bzCompress(&ctrl, BZ_RUN), BZ_RUN_OK);
-        while (CHECKV_BZ(BZ2_bzCompress(&ctrl, BZ_FINISH), BZ_FINISH_OK, BZ_STREAM_END) != BZ_STREAM_END) {
-            ctrl.next_out = (char*)output;
-            ctrl.avail_out = 512;
-        }
-        for (unsigned index = 0; index < 512 - ctrl.avail_out; ++index) patch.push_back(output[index]);
-        
-        CHECK_BZ(BZ2_bzCompressEnd(&ctrl), BZ_OK);
+
+    exception_ptr Failure;
+    try {
+        diff(&I[0], olds, oldsize, news, newsize / Count, Regions[0], budget);
+    }
+    catch (...) {
+        Failure = current_exception();
+    }
+    for (auto& Task : Pending) Task.wait();
+    if (Failure) rethrow_exception(Failure);
+    for (auto& Task : Pending) Task.get();
+
+    for (off_t Region = 0; Region + 1 < Count; ++Region) {
+        auto& ctrl = Regions[Region].ctrl;
+        off_t oldpos = 0;
+        for (size_t i = 0; i < ctrl.size(); i += 3) oldpos += ctrl[i] + ctrl[i + 2];
+        ctrl.back() -= oldpos;
     }
-    
-    memcpy(&patch[0], header, 32);
 
-	return patch;
+    return Regions;
 }
 
-vector<unsigned char> BinaryData::ApplyPatch(const vector<unsigned char>& data, const vector<unsigned char>& patch)
+/* Output is produced in pieces of at most this size */
+const off_t PieceSize = 64 << 10;
+
+/* Writes straight into a vector, its capacity is reused */
+struct VectorOutput
 {
-	signed oldsize,newsize;
-	signed bzctrllen,bzdatalen;
-	u_char header[32],buf[8];
+	vector<u_char>& target;
+
+	u_char* Reserve(off_t size)
+	{
+		auto used = target.size();
+		target.resize(used + size);
+		return &target[used];
+	}
+
+	void Commit(off_t) { }
+};
+
+/* Hands every piece to a sink, memory stays bounded by one piece */
+struct SinkOutput
+{
+	const BinaryData::Sink& sink;
+	vector<u_char> buffer;
+
+	u_char* Reserve(off_t size)
+	{
+		buffer.resize(size);
+		return buffer.data();
+	}
+
+	void Commit(off_t size) { sink(buffer.data(), size); }
+};
+
+/* Releases a decompression stream */
+struct Decompressor
+{
+	bz_stream stream;
+
+	Decompressor(const u_char* data, size_t size)
+	{
+		memset(&stream, 0, sizeof(bz_stream));
+		CHECK_BZ(BZ2_bzDecompressInit(&stream, 0, 0), BZ_OK);
+		stream.next_in = size ? (char*)data : nullptr;
+		stream.avail_in = size;
+	}
+
+	~Decompressor() { BZ2_bzDecompressEnd(&stream); }
+
+	void Read(u_char* target, off_t size)
+	{
+		stream.next_out = (char*)target;
+		stream.avail_out = size;
+		CHECKV_BZ(BZ2_bzDecompress(&stream), BZ_OK, BZ_STREAM_END);
+		if (stream.avail_out != 0) throw runtime_error("invalid patch");
+	}
+
+	vector<u_char> ReadAll()
+	{
+		vector<u_char> result;
+		for (int status = BZ_OK; status != BZ_STREAM_END; ) {
+			auto used = result.size();
+			result.resize(used + PieceSize);
+			stream.next_out = (char*)&result[used];
+			stream.avail_out = PieceSize;
+			status = BZ2_bzDecompress(&stream);
+			CHECKV_BZ(status, BZ_OK, BZ_STREAM_END);
+			result.resize(result.size() - stream.avail_out);
+			if (status == BZ_OK && stream.avail_in == 0 && stream.avail_out != 0) throw runtime_error("invalid patch");
+		}
+		return result;
+	}
+};
+
+/* Adds old data to a diff string */
+void addOld(u_char* news, off_t size, const u_char* olds, off_t oldsize, off_t oldpos)
+{
+	/* bytes outside of the old file are left as they are */
+	off_t first = max(-oldpos, off_t(0));
+	off_t last = min(size, oldsize - oldpos);
+	if (first < last) ByteKernels::Add(news + first, olds + oldpos + first, last - first);
+}
+
+template<typename Output>
+void applyLegacyPatch(const vector<u_char>& data, const vector<u_char>& patch, Output& output)
+{
+	off_t oldsize,newsize;
+	off_t bzctrllen,bzdatalen,bzextralen;
+	u_char buf[8];
 	const u_char *olds;
-    u_char *news;
 	off_t oldpos,newpos;
 	off_t ctrl[3];
-	off_t i;
-    
-    if (patch.size() <= sizeof(header)) throw runtime_error("invalid patch");
-    olds = &data[0];
-    oldsize = data.size();
-    
-    memcpy(header, &patch[0], sizeof(header));
+	off_t i,done,piece;
+
+	const size_t headersize = 32;
+	if (patch.size() <= headersize) throw runtime_error("invalid patch");
+	auto header = &patch[0];
 	if (memcmp(header, "BSDIFF40", 8) != 0) throw runtime_error("invalid patch");
-	
-    bzctrllen=offtin(header+8);
-	bzdatalen=offtin(header+16);
-	newsize=offtin(header+24);
-	if((bzctrllen<0) || (bzdatalen<0) || (newsize<0)) throw runtime_error("invalid patch");
-    
-    vector<unsigned char> result(newsize);
-    
-    bz_stream ctrlz;
-    bz_stream dataz;
-    bz_stream extra;
-    
-    memset(&ctrlz, 0, sizeof(bz_stream));
-    memset(&dataz, 0, sizeof(bz_stream));
-    memset(&extra, 0, sizeof(bz_stream));
-    
-    CHECK_BZ(BZ2_bzDecompressInit(&ctrlz, 0, 0), BZ_OK);
-    CHECK_BZ(BZ2_bzDecompressInit(&dataz, 0, 0), BZ_OK);
-    CHECK_BZ(BZ2_bzDecompressInit(&extra, 0, 0), BZ_OK);
-    
-	news=(u_char*)&result[0];
-    
-    ctrlz.avail_in = bzctrllen;
-    ctrlz.next_in = (char*)&patch[32];
-    
-    dataz.avail_in = bzdatalen;
-    dataz.next_in = (char*)&patch[32 + bzctrllen];
-    
-    extra.avail_in = patch.size() - (32 + bzctrllen + bzdatalen);
-    extra.next_in = extra.avail_in ? (char*)&patch[32 + bzctrllen + bzdatalen] : nullptr;
+
+	olds = data.data();
+	oldsize = data.size();
+	bzctrllen = offtin(header + 8);
+	bzdatalen = offtin(header + 16);
+	newsize = offtin(header + 24);
+	if ((bzctrllen < 0) || (bzdatalen < 0) || (newsize < 0)) throw runtime_error("invalid patch");
+	if (bzctrllen + bzdatalen > static_cast<off_t>(patch.size() - headersize)) throw runtime_error("invalid patch");
+	bzextralen = patch.size() - headersize - bzctrllen - bzdatalen;
+
+	Decompressor ctrlz(header + headersize, bzctrllen);
+	Decompressor dataz(header + headersize + bzctrllen, bzdatalen);
+	Decompressor extra(header + headersize + bzctrllen + bzdatalen, bzextralen);
 
 	oldpos=0;newpos=0;
 	while(newpos<newsize) {
 		/* Read control data */
 		for(i=0;i<=2;i++) {
-            ctrlz.next_out = (char*)buf;
-            ctrlz.avail_out = 8;
-			CHECKV_BZ(BZ2_bzDecompress(&ctrlz), BZ_OK, BZ_STREAM_END);
+			ctrlz.Read(buf, 8);
 			ctrl[i]=offtin(buf);
 		};
 
 		/* Sanity-check */
-		if(newpos+ctrl[0]>newsize) throw runtime_error("invalid patch");
-
-		/* Read diff string */
-        dataz.next_out = (char*)news + newpos;
-        dataz.avail_out = ctrl[0];
-		CHECKV_BZ(BZ2_bzDecompress(&dataz), BZ_OK, BZ_STREAM_END);
-
-		/* Add old data to diff string */
-		for(i=0;i<ctrl[0];i++)
-			if((oldpos+i>=0) && (oldpos+i<oldsize))
-				news[newpos+i]+=olds[oldpos+i];
+		if((ctrl[0]<0) || (ctrl[1]<0) || (newpos+ctrl[0]>newsize)) throw runtime_error("invalid patch");
+
+		/* Read diff string and add old data */
+		for(done=0;done<ctrl[0];done+=piece) {
+			piece=min(ctrl[0]-done,PieceSize);
+			auto news=output.Reserve(piece);
+			dataz.Read(news, piece);
+			addOld(news, piece, olds, oldsize, oldpos+done);
+			output.Commit(piece);
+		}
 
 		/* Adjust pointers */
 		newpos+=ctrl[0];
 		oldpos+=ctrl[0];
 
 		/* Sanity-check */
-		if(newpos+ctrl[1]>newsize) throw runtime_error("invalid patch");
+		if((newpos+ctrl[1]>newsize) || (ctrl[1]>0 && bzextralen==0)) throw runtime_error("invalid patch");
 
 		/* Read extra string */
-        if (extra.avail_in) {
-            extra.next_out = (char*)news + newpos;
-            extra.avail_out = ctrl[1];
-            CHECKV_BZ(BZ2_bzDecompress(&extra), BZ_OK, BZ_STREAM_END);
-        }
+		for(done=0;done<ctrl[1];done+=piece) {
+			piece=min(ctrl[1]-done,PieceSize);
+			extra.Read(output.Reserve(piece), piece);
+			output.Commit(piece);
+		}
+
 		/* Adjust pointers */
 		newpos+=ctrl[1];
 		oldpos+=ctrl[2];
-    }
-    
-    BZ2_bzDecompressEnd(&extra);
-    BZ2_bzDecompressEnd(&dataz);
-    BZ2_bzDecompressEnd(&ctrlz);
+	}
+}
+
+/* Triples as stored in the ctrl block */
+vector<off_t> readCtrl(const vector<u_char>& ctrl)
+{
+	if (ctrl.size() % 24 != 0) throw runtime_error("invalid patch");
+
+	vector<off_t> result(ctrl.size() / 8);
+	for (size_t i = 0; i < result.size(); i++) result[i] = offtin(&ctrl[i * 8]);
+	return result;
+}
+
+/* Sums of the add and copy lengths, checked against the size of the new file */
+void checkCtrl(const vector<off_t>& ctrl, off_t& addlen, off_t& copylen, off_t newsize)
+{
+	addlen = 0;
+	copylen = 0;
+	for (size_t i = 0; i < ctrl.size(); i += 3) {
+		if ((ctrl[i] < 0) || (ctrl[i + 1] < 0)) throw runtime_error("invalid patch");
+		addlen += ctrl[i];
+		copylen += ctrl[i + 1];
+	}
+	if (addlen + copylen != newsize) throw runtime_error("invalid patch");
+}
+
+/*
+ * Content defined chunking after FastCDC, a gear hash rolls over the
+ * data and cuts where the masked bits are zero. The stricter mask below
+ * the average size and the looser one above it narrow the spread of the
+ * chunk sizes. Boundaries only depend on nearby bytes, so an edit moves
+ * at most the chunks around it.
+ */
+const off_t ChunkMin = 2 << 10;
+const off_t ChunkAverage = 8 << 10;
+const off_t ChunkMax = 64 << 10;
+const uint64_t MaskSmall = 0x0003590703530000ull;
+const uint64_t MaskLarge = 0x0000d90003530000ull;
+
+const uint64_t* gearTable()
+{
+	static const auto table = []() {
+		/* any fixed random values do, these come from splitmix64 */
+		array<uint64_t, 256> values;
+		uint64_t state = 0;
+		for (auto& value : values) {
+			auto z = (state += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			value = z ^ (z >> 31);
+		}
+		return values;
+	}();
+	return table.data();
+}
+
+off_t chunkLength(const u_char* data, off_t size)
+{
+	if (size <= ChunkMin) return size;
+
+	auto gear = gearTable();
+	auto normal = min(size, ChunkAverage);
+	auto limit = min(size, ChunkMax);
+	uint64_t hash = 0;
+	off_t i = ChunkMin;
+
+	for (; i < normal; i++) {
+		hash = (hash << 1) + gear[data[i]];
+		if ((hash & MaskSmall) == 0) return i;
+	}
+	for (; i < limit; i++) {
+		hash = (hash << 1) + gear[data[i]];
+		if ((hash & MaskLarge) == 0) return i;
+	}
+	return limit;
+}
+
+uint64_t chunkHash(const u_char* data, off_t size)
+{
+	ContentHash hash;
+	hash.Update(data, size);
+	return hash.Digest();
+}
+
+/*
+ * A chunk patch is a list of triples (literal length, copy offset, copy
+ * length), each one appends literal bytes and then a copy of the old
+ * file. Matches of whole chunks are extended bytewise in both
+ * directions, so only the edited bytes end up as literals.
+ */
+Delta chunkDiff(const u_char* olds, off_t oldsize, const u_char* news, off_t newsize)
+{
+	Delta delta;
+	unordered_map<uint64_t, pair<off_t, off_t>> index;
+	index.reserve(oldsize / ChunkAverage + 1);
+	for (off_t pos = 0, len; pos < oldsize; pos += len) {
+		len = chunkLength(olds + pos, oldsize - pos);
+		index.emplace(chunkHash(olds + pos, len), make_pair(pos, len));
+	}
+
+	off_t pos = 0, literal = 0;
+	while (pos < newsize) {
+		auto len = chunkLength(news + pos, newsize - pos);
+		auto found = index.find(chunkHash(news + pos, len));
+		if ((found == index.end()) || (found->second.second != len) || (memcmp(olds + found->second.first, news + pos, len) != 0)) {
+			pos += len;
+			continue;
+		}
+
+		auto start = pos;
+		auto offset = found->second.first;
+		while ((start > literal) && (offset > 0) && (olds[offset - 1] == news[start - 1])) {
+			start--;
+			offset--;
+		}
+
+		auto length = pos + len - start;
+		while ((start + length < newsize) && (offset + length < oldsize) && (olds[offset + length] == news[start + length])) length++;
+
+		auto& ctrl = delta.ctrl;
+		if ((start == literal) && (ctrl.empty() == false) && (ctrl[ctrl.size() - 2] + ctrl.back() == offset)) ctrl.back() += length;
+		else {
+			ctrl.push_back(start - literal);
+			ctrl.push_back(offset);
+			ctrl.push_back(length);
+			delta.eb.insert(delta.eb.end(), news + literal, news + start);
+		}
+
+		pos = start + length;
+		literal = pos;
+	}
+
+	if (literal < newsize) {
+		delta.ctrl.push_back(newsize - literal);
+		delta.ctrl.push_back(0);
+		delta.ctrl.push_back(0);
+		delta.eb.insert(delta.eb.end(), news + literal, news + newsize);
+	}
+
+	return delta;
+}
+
+/* Header is
+	0	8	"CDCDIFF1"
+	8	8	length of compressed ctrl block
+	16	8	length of compressed literal block
+	24	8	length of new file
+	32	8	codec, see Codec::Method
+	40	8	length of ctrl block
+	48	8	length of literal block
+	56	8	reserved
+   the blocks start at 64 */
+const size_t ChunkHeaderSize = 64;
+
+vector<u_char> encodeChunkPatch(const Delta& delta, off_t newsize, const Codec& codec)
+{
+	u_char buf[8];
+	u_char header[ChunkHeaderSize];
+
+	vector<u_char> ctrl;
+	ctrl.reserve(delta.ctrl.size() * 8);
+	for (auto value : delta.ctrl) {
+		offtout(value, buf);
+		ctrl.insert(ctrl.end(), buf, buf + 8);
+	}
+
+	auto ctrlBlock = codec.Compress(ctrl.data(), ctrl.size());
+	auto literalBlock = codec.Compress(delta.eb.data(), delta.eb.size());
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, "CDCDIFF1", 8);
+	offtout(ctrlBlock.size(), header + 8);
+	offtout(literalBlock.size(), header + 16);
+	offtout(newsize, header + 24);
+	header[32] = codec.Type();
+	offtout(ctrl.size(), header + 40);
+	offtout(delta.eb.size(), header + 48);
+
+	vector<u_char> patch(header, header + ChunkHeaderSize);
+	patch.reserve(ChunkHeaderSize + ctrlBlock.size() + literalBlock.size());
+	patch.insert(patch.end(), ctrlBlock.begin(), ctrlBlock.end());
+	patch.insert(patch.end(), literalBlock.begin(), literalBlock.end());
+	return patch;
+}
+
+/* Triples and literals of a chunk patch, checked against the sizes */
+Delta decodeChunkPatch(const vector<u_char>& patch, off_t oldsize, off_t& newsize)
+{
+	Delta delta;
+	if (patch.size() < ChunkHeaderSize) throw runtime_error("invalid patch");
+
+	auto header = &patch[0];
+	auto ctrlzlen = offtin(header + 8);
+	auto literalzlen = offtin(header + 16);
+	newsize = offtin(header + 24);
+	auto method = static_cast<Codec::Method>(header[32]);
+	auto ctrllen = offtin(header + 40);
+	auto literallen = offtin(header + 48);
+	if ((ctrlzlen < 0) || (literalzlen < 0) || (newsize < 0) || (ctrllen < 0) || (literallen < 0) || (literallen > newsize) || (ctrllen % 24 != 0)) throw runtime_error("invalid patch");
+	if (ctrlzlen + literalzlen != static_cast<off_t>(patch.size() - ChunkHeaderSize)) throw runtime_error("invalid patch");
+
+	vector<u_char> ctrl(ctrllen);
+	delta.eb.resize(literallen);
+	Codec::Decompress(method, header + ChunkHeaderSize, ctrlzlen, ctrl.data(), ctrllen);
+	Codec::Decompress(method, header + ChunkHeaderSize + ctrlzlen, literalzlen, delta.eb.data(), literallen);
+	delta.ctrl = readCtrl(ctrl);
+
+	off_t literals = 0, total = 0;
+	for (size_t i = 0; i < delta.ctrl.size(); i += 3) {
+		auto literal = delta.ctrl[i], offset = delta.ctrl[i + 1], length = delta.ctrl[i + 2];
+		if ((literal < 0) || (offset < 0) || (length < 0) || ((length > 0) && (offset + length > oldsize))) throw runtime_error("invalid patch");
+		literals += literal;
+		total += literal + length;
+	}
+	if ((literals != literallen) || (total != newsize)) throw runtime_error("invalid patch");
+	return delta;
+}
+
+template<typename Output>
+void applyChunkPatch(const vector<u_char>& data, const vector<u_char>& patch, Output& output)
+{
+	off_t newsize,extrapos,done,piece;
+	auto delta = decodeChunkPatch(patch, data.size(), newsize);
+
+	extrapos = 0;
+	for (size_t i = 0; i < delta.ctrl.size(); i += 3) {
+		auto literal = delta.ctrl[i], offset = delta.ctrl[i + 1], length = delta.ctrl[i + 2];
+		for (done = 0; done < literal; done += piece) {
+			piece = min(literal - done, PieceSize);
+			memcpy(output.Reserve(piece), &delta.eb[extrapos + done], piece);
+			output.Commit(piece);
+		}
+		for (done = 0; done < length; done += piece) {
+			piece = min(length - done, PieceSize);
+			memcpy(output.Reserve(piece), &data[offset + done], piece);
+			output.Commit(piece);
+		}
+		extrapos += literal;
+	}
+}
+
+/* Collects the triples of a composed patch, adjacent runs are merged */
+struct Composer
+{
+	Delta delta;
+	off_t oldpos = 0;
+	off_t add = 0;
+	off_t copy = 0;
+
+	void Flush(off_t seek)
+	{
+		if (add == 0 && copy == 0 && seek == 0) return;
+		delta.ctrl.push_back(add);
+		delta.ctrl.push_back(copy);
+		delta.ctrl.push_back(seek);
+		oldpos += seek;
+		add = 0;
+		copy = 0;
+	}
+
+	/* Diff bytes against the old file starting at pos */
+	u_char* Add(off_t pos, off_t size)
+	{
+		if (copy > 0 || pos != oldpos) Flush(pos - oldpos);
+		add += size;
+		oldpos = pos + size;
+
+		auto used = delta.db.size();
+		delta.db.resize(used + size);
+		return &delta.db[used];
+	}
+
+	/* Literal bytes */
+	u_char* Copy(off_t size)
+	{
+		copy += size;
+
+		auto used = delta.eb.size();
+		delta.eb.resize(used + size);
+		return &delta.eb[used];
+	}
+};
+
+/* A chunk patch as bsdiff triples, copies turn into zero diff bytes */
+Delta chunkToDelta(const vector<u_char>& patch, off_t& newsize)
+{
+	auto chunks = decodeChunkPatch(patch, numeric_limits<off_t>::max(), newsize);
+
+	Composer composer;
+	off_t extrapos = 0;
+	for (size_t i = 0; i < chunks.ctrl.size(); i += 3) {
+		auto literal = chunks.ctrl[i], offset = chunks.ctrl[i + 1], length = chunks.ctrl[i + 2];
+		if (literal > 0) memcpy(composer.Copy(literal), &chunks.eb[extrapos], literal);
+		if (length > 0) composer.Add(offset, length);
+		extrapos += literal;
+	}
+
+	composer.Flush(0);
+	return std::move(composer.delta);
+}
+
+/*
+ * Decompresses all blocks of a patch. Patches with another codec than
+ * bzip2 carry a longer header naming the codec and the sizes of the
+ * uncompressed blocks.
+ */
+Delta decodePatch(const vector<u_char>& patch, off_t& newsize)
+{
+	Delta delta;
+	off_t ctrlzlen,datazlen,addlen,copylen;
+
+	if (patch.size() < 32) throw runtime_error("invalid patch");
+	auto header = &patch[0];
+	if (memcmp(header, "CDCDIFF1", 8) == 0) return chunkToDelta(patch, newsize);
+
+	ctrlzlen = offtin(header + 8);
+	datazlen = offtin(header + 16);
+	newsize = offtin(header + 24);
+	if ((ctrlzlen < 0) || (datazlen < 0) || (newsize < 0)) throw runtime_error("invalid patch");
+
+	if (memcmp(header, "BSDIFF41", 8) == 0) {
+		const size_t headersize = 64;
+		if (patch.size() < headersize) throw runtime_error("invalid patch");
+
+		auto ctrllen = offtin(header + 40);
+		auto datalen = offtin(header + 48);
+		auto extralen = offtin(header + 56);
+		auto method = static_cast<Codec::Method>(header[32]);
+		if ((ctrllen < 0) || (datalen < 0) || (extralen < 0)) throw runtime_error("invalid patch");
+		if ((ctrlzlen + datazlen > static_cast<off_t>(patch.size() - headersize)) || (ctrllen % 24 != 0) || (datalen > newsize) || (extralen > newsize)) throw runtime_error("invalid patch");
+
+		vector<u_char> ctrl(ctrllen);
+		delta.db.resize(datalen);
+		delta.eb.resize(extralen);
+		auto blocks = header + headersize;
+		Codec::Decompress(method, blocks, ctrlzlen, ctrl.data(), ctrllen);
+		Codec::Decompress(method, blocks + ctrlzlen, datazlen, delta.db.data(), datalen);
+		Codec::Decompress(method, blocks + ctrlzlen + datazlen, patch.size() - headersize - ctrlzlen - datazlen, delta.eb.data(), extralen);
+		delta.ctrl = readCtrl(ctrl);
+
+		checkCtrl(delta.ctrl, addlen, copylen, newsize);
+		if ((addlen != datalen) || (copylen != extralen)) throw runtime_error("invalid patch");
+		return delta;
+	}
+
+	const size_t headersize = 32;
+	if (memcmp(header, "BSDIFF40", 8) != 0) throw runtime_error("invalid patch");
+	if (ctrlzlen + datazlen > static_cast<off_t>(patch.size() - headersize)) throw runtime_error("invalid patch");
+	auto extrazlen = patch.size() - headersize - ctrlzlen - datazlen;
+
+	delta.ctrl = readCtrl(Decompressor(header + headersize, ctrlzlen).ReadAll());
+	checkCtrl(delta.ctrl, addlen, copylen, newsize);
+	if (copylen > 0 && extrazlen == 0) throw runtime_error("invalid patch");
+
+	delta.db.resize(addlen);
+	delta.eb.resize(copylen);
+	if (addlen > 0) Decompressor(header + headersize + ctrlzlen, datazlen).Read(delta.db.data(), addlen);
+	if (copylen > 0) Decompressor(header + headersize + ctrlzlen + datazlen, extrazlen).Read(delta.eb.data(), copylen);
+	return delta;
+}
+
+/* Compresses the blocks and prepends the header */
+vector<u_char> encodePatch(const Delta& delta, off_t newsize, const Codec& codec)
+{
+	u_char buf[8];
+	u_char header[64];
+
+	vector<u_char> ctrl;
+	ctrl.reserve(delta.ctrl.size() * 8);
+	for (auto Value : delta.ctrl) {
+		offtout(Value, buf);
+		ctrl.insert(ctrl.end(), buf, buf + 8);
+	}
+
+	/* Header is
+		0	8	 "BSDIFF40"
+		8	8	length of bzip2ed ctrl block
+		16	8	length of bzip2ed diff block
+		24	8	length of new file */
+	/* File is
+		0	32	Header
+		32	??	Bzip2ed ctrl block
+		??	??	Bzip2ed diff block
+		??	??	Bzip2ed extra block */
+	/* Other codecs write "BSDIFF41" and extend the header by
+		32	8	codec, see Codec::Method
+		40	8	length of ctrl block
+		48	8	length of diff block
+		56	8	length of extra block
+	   the blocks start at 64 and the extra block is always present */
+    auto legacy = codec.Type() == Codec::Bzip2;
+    size_t headersize = legacy ? 32 : 64;
     
+    // the three blocks are independent, large ones are compressed concurrently
+    auto& Workers = DeltaWorkers();
+    auto start = [&Workers, newsize](function<vector<u_char>()> task) {
+        return newsize >= RegionSize ? Workers.Submit(task) : async(launch::deferred, task);
+    };
+
+    auto& db = delta.db;
+    auto& eb = delta.eb;
+    auto ctrlz = start([&ctrl, &codec]() { return codec.Compress(ctrl.data(), ctrl.size()); });
+    auto dataz = start([&db, &codec]() { return codec.Compress(db.data(), db.size()); });
+    auto extraz = start([&eb, &codec, legacy]() { return legacy && eb.empty() ? vector<u_char>() : codec.Compress(eb.data(), eb.size()); });
+    ctrlz.wait();
+    dataz.wait();
+    extraz.wait();
+
+    auto ctrlBlock = ctrlz.get();
+    auto dataBlock = dataz.get();
+    auto extraBlock = extraz.get();
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, legacy ? "BSDIFF40" : "BSDIFF41", 8);
+	offtout(ctrlBlock.size(), header + 8);
+	offtout(dataBlock.size(), header + 16);
+	offtout(newsize, header + 24);
+    if (legacy == false) {
+        header[32] = codec.Type();
+        offtout(ctrl.size(), header + 40);
+        offtout(db.size(), header + 48);
+        offtout(eb.size(), header + 56);
+    }
+
+    vector<unsigned char> patch(header, header + headersize);
+    patch.reserve(headersize + ctrlBlock.size() + dataBlock.size() + extraBlock.size());
+    patch.insert(patch.end(), ctrlBlock.begin(), ctrlBlock.end());
+    patch.insert(patch.end(), dataBlock.begin(), dataBlock.end());
+    patch.insert(patch.end(), extraBlock.begin(), extraBlock.end());
+
+	return patch;
+}
+
+template<typename Output>
+void applyDelta(const vector<u_char>& data, const Delta& delta, Output& output)
+{
+	off_t oldsize,oldpos,datapos,extrapos;
+	off_t add,copy;
+	off_t done,piece;
+
+	oldsize = data.size();
+	oldpos=0;datapos=0;extrapos=0;
+	for (size_t i = 0; i < delta.ctrl.size(); i += 3) {
+		add = delta.ctrl[i];
+		copy = delta.ctrl[i + 1];
+
+		for (done = 0; done < add; done += piece) {
+			piece = min(add - done, PieceSize);
+			auto news = output.Reserve(piece);
+			memcpy(news, &delta.db[datapos + done], piece);
+			addOld(news, piece, data.data(), oldsize, oldpos + done);
+			output.Commit(piece);
+		}
+		for (done = 0; done < copy; done += piece) {
+			piece = min(copy - done, PieceSize);
+			memcpy(output.Reserve(piece), &delta.eb[extrapos + done], piece);
+			output.Commit(piece);
+		}
+
+		datapos += add;
+		extrapos += copy;
+		oldpos += add + delta.ctrl[i + 2];
+	}
+}
+
+/* A run of the intermediate file, either diffed against the old file or literal */
+struct Segment
+{
+	off_t start;
+	off_t size;
+	off_t oldpos;
+	off_t offset;
+	bool literal;
+};
+
+/*
+ * Merges a patch from A to B with one from B to C into a patch from A
+ * to C. Every byte of C is either a literal or a diff byte added to a
+ * byte of B, which itself is a literal or a diff byte added to a byte
+ * of A, so the diff bytes of both patches are summed.
+ */
+Delta compose(const Delta& first, off_t midsize, const Delta& second)
+{
+	vector<Segment> segments;
+	off_t oldpos,midpos,datapos,extrapos;
+
+	oldpos=0;midpos=0;datapos=0;extrapos=0;
+	for (size_t i = 0; i < first.ctrl.size(); i += 3) {
+		if (first.ctrl[i] > 0) segments.push_back(Segment { midpos, first.ctrl[i], oldpos, datapos, false });
+		midpos += first.ctrl[i];
+		datapos += first.ctrl[i];
+		oldpos += first.ctrl[i];
+		if (first.ctrl[i + 1] > 0) segments.push_back(Segment { midpos, first.ctrl[i + 1], 0, extrapos, true });
+		midpos += first.ctrl[i + 1];
+		extrapos += first.ctrl[i + 1];
+		oldpos += first.ctrl[i + 2];
+	}
+
+	Composer composer;
+	auto segment = segments.begin();
+	midpos=0;datapos=0;extrapos=0;
+	for (size_t i = 0; i < second.ctrl.size(); i += 3) {
+		auto add = second.ctrl[i];
+		auto diffs = second.db.data() + datapos;
+		off_t done,piece;
+
+		for (done = 0; done < add; done += piece) {
+			auto pos = midpos + done;
+			if ((pos < 0) || (pos >= midsize)) {
+				/* outside of B the diff bytes are the data */
+				piece = pos < 0 ? min(add - done, -pos) : add - done;
+				memcpy(composer.Copy(piece), diffs + done, piece);
+				continue;
+			}
+
+			if ((segment == segments.end()) || (pos < segment->start) || (pos >= segment->start + segment->size)) {
+				segment = upper_bound(segments.begin(), segments.end(), pos, [](off_t value, const Segment& item) { return value < item.start; }) - 1;
+			}
+
+			auto within = pos - segment->start;
+			piece = min(add - done, segment->size - within);
+			auto source = segment->literal ? &first.eb[segment->offset + within] : &first.db[segment->offset + within];
+			auto target = segment->literal ? composer.Copy(piece) : composer.Add(segment->oldpos + within, piece);
+			for (off_t j = 0; j < piece; j++) target[j] = source[j] + diffs[done + j];
+		}
+
+		auto copy = second.ctrl[i + 1];
+		if (copy > 0) memcpy(composer.Copy(copy), &second.eb[extrapos], copy);
+
+		datapos += add;
+		extrapos += copy;
+		midpos += add + second.ctrl[i + 2];
+	}
+
+	composer.Flush(0);
+	return std::move(composer.delta);
+}
+
+/* Decodes a chain of patches and folds it into one */
+Delta composeAll(const vector<vector<u_char>>& patches, off_t& newsize)
+{
+	if (patches.empty()) throw runtime_error("no patches to compose");
+
+	auto result = decodePatch(patches[0], newsize);
+	for (size_t i = 1; i < patches.size(); i++) {
+		off_t nextsize;
+		auto next = decodePatch(patches[i], nextsize);
+		result = compose(result, newsize, next);
+		newsize = nextsize;
+	}
+	return result;
+}
+
+/* Size of the result of a BSDIFF41 patch, the header is validated before the size is trusted, -1 for other formats */
+off_t patchedSize(const vector<u_char>& patch)
+{
+	const size_t headersize = 64;
+	if ((patch.size() < headersize) || (memcmp(&patch[0], "BSDIFF41", 8) != 0)) return -1;
+
+	auto header = &patch[0];
+	auto blocks = static_cast<off_t>(patch.size() - headersize);
+	auto ctrlzlen = offtin(header + 8);
+	auto datazlen = offtin(header + 16);
+	auto newsize = offtin(header + 24);
+	auto datalen = offtin(header + 48);
+	auto extralen = offtin(header + 56);
+	if ((ctrlzlen < 0) || (datazlen < 0) || (newsize < 0) || (datalen < 0) || (extralen < 0)) throw runtime_error("invalid patch");
+	if ((ctrlzlen > blocks) || (datazlen > blocks - ctrlzlen)) throw runtime_error("invalid patch");
+	if ((datalen > newsize) || (extralen != newsize - datalen)) throw runtime_error("invalid patch");
+	return newsize;
+}
+
+template<typename Output>
+void applyPatch(const vector<u_char>& data, const vector<u_char>& patch, Output& output)
+{
+	if (patch.size() >= 8 && memcmp(&patch[0], "BSDIFF41", 8) == 0) {
+		/* the blocks of other codecs are decompressed as a whole */
+		off_t newsize;
+		applyDelta(data, decodePatch(patch, newsize), output);
+	}
+	else if (patch.size() >= 8 && memcmp(&patch[0], "CDCDIFF1", 8) == 0) applyChunkPatch(data, patch, output);
+	else applyLegacyPatch(data, patch, output);
+}
+
+/* Suffix array of the old file in the smallest index type that fits */
+template<typename Index>
+vector<Delta> indexAndDiff(const vector<u_char>& oldData, const vector<u_char>& newData, const Budget& budget)
+{
+    // the sort of a large old file alone can exceed the budget
+    auto I = budget.limited ? SuffixArray::Build<Index>(oldData, [&budget]() { budget.Check(); }) : SuffixArray::Build<Index>(oldData);
+    return diffRegions(I, oldData.data(), oldData.size(), newData.data(), newData.size(), budget);
+}
+
+vector<u_char> createPatch(const vector<u_char>& oldData, const vector<u_char>& newData, const Codec& codec, const Budget& budget)
+{
+    // 32 bit indexes halve the memory of the suffix array for common sizes
+    auto wide = oldData.size() >= static_cast<size_t>(numeric_limits<int32_t>::max());
+    auto Regions = wide ? indexAndDiff<int64_t>(oldData, newData, budget) : indexAndDiff<int32_t>(oldData, newData, budget);
+
+    auto& delta = Regions[0];
+    for (size_t Region = 1; Region < Regions.size(); ++Region) {
+        delta.ctrl.insert(delta.ctrl.end(), Regions[Region].ctrl.begin(), Regions[Region].ctrl.end());
+        delta.db.insert(delta.db.end(), Regions[Region].db.begin(), Regions[Region].db.end());
+        delta.eb.insert(delta.eb.end(), Regions[Region].eb.begin(), Regions[Region].eb.end());
+        Regions[Region] = Delta();
+    }
+
+    return encodePatch(delta, newData.size(), codec);
+}
+
+/*
+ * Content defined samples for the similarity estimate. The gear hash
+ * depends on the last 64 bytes, a sample is taken where its top byte
+ * is zero, on average every 256 bytes.
+ */
+template<typename F>
+void sampleFingerprints(const u_char* data, off_t size, F take)
+{
+	auto gear = gearTable();
+	uint64_t hash = 0;
+	for (off_t i = 0; i < size; i++) {
+		hash = (hash << 1) + gear[data[i]];
+		if ((i >= 63) && ((hash >> 56) == 0)) take(hash);
+	}
+}
+
+} // anonymous namespace
+
+vector<unsigned char> BinaryData::CreatePatch(const vector<unsigned char>& oldData, const vector<unsigned char>& newData, const Codec& codec)
+{
+    return createPatch(oldData, newData, codec, Budget { false, chrono::steady_clock::time_point() });
+}
+
+bool BinaryData::TryCreatePatch(const vector<unsigned char>& oldData, const vector<unsigned char>& newData, const Codec& codec, chrono::milliseconds budget, vector<unsigned char>& patch)
+{
+    try {
+        patch = createPatch(oldData, newData, codec, Budget { true, chrono::steady_clock::now() + budget });
+        return true;
+    }
+    catch (const Expired&) {
+        return false;
+    }
+}
+
+double BinaryData::Similarity(const vector<unsigned char>& oldData, const vector<unsigned char>& newData)
+{
+    const size_t MinimumSamples = 16;
+
+    vector<uint64_t> Samples;
+    sampleFingerprints(newData.data(), newData.size(), [&Samples](uint64_t value) { Samples.push_back(value); });
+    if (Samples.size() < MinimumSamples) return 1.0;
+
+    unordered_set<uint64_t> Known;
+    sampleFingerprints(oldData.data(), oldData.size(), [&Known](uint64_t value) { Known.insert(value); });
+
+    auto Found = count_if(Samples.begin(), Samples.end(), [&Known](uint64_t value) { return Known.count(value) > 0; });
+    return static_cast<double>(Found) / Samples.size();
+}
+
+vector<unsigned char> BinaryData::CreateChunkPatch(const vector<unsigned char>& oldData, const vector<unsigned char>& newData, const Codec& codec)
+{
+    auto delta = chunkDiff(oldData.data(), oldData.size(), newData.data(), newData.size());
+    return encodeChunkPatch(delta, newData.size(), codec);
+}
+
+BinaryData::Engine BinaryData::PatchEngine(const vector<unsigned char>& patch)
+{
+    return patch.size() >= 8 && memcmp(&patch[0], "CDCDIFF1", 8) == 0 ? ContentChunks : SuffixSort;
+}
+
+vector<unsigned char> BinaryData::ApplyPatch(const vector<unsigned char>& data, const vector<unsigned char>& patch)
+{
+    vector<unsigned char> result;
+    ApplyPatch(data, patch, result);
     return result;
 }
+
+void BinaryData::ApplyPatch(const vector<unsigned char>& data, const vector<unsigned char>& patch, vector<unsigned char>& target)
+{
+    target.clear();
+
+    // the header only hints the size, a compressed patch may claim far more than it holds
+    auto newsize = patchedSize(patch);
+    if (newsize > 0) target.reserve(static_cast<size_t>(min(newsize, static_cast<off_t>(data.size() + patch.size()))));
+
+    VectorOutput output { target };
+    applyPatch(data, patch, output);
+}
+
+void BinaryData::ApplyPatch(const vector<unsigned char>& data, const vector<unsigned char>& patch, const Sink& sink)
+{
+    SinkOutput output { sink, vector<unsigned char>() };
+    applyPatch(data, patch, output);
+}
+
+vector<unsigned char> BinaryData::ComposePatches(const vector<vector<unsigned char>>& patches, const Codec& codec)
+{
+    off_t newsize;
+    auto delta = composeAll(patches, newsize);
+    return encodePatch(delta, newsize, codec);
+}
+
+void BinaryData::ApplyPatches(const vector<unsigned char>& data, const vector<vector<unsigned char>>& patches, const Sink& sink)
+{
+    off_t newsize;
+    auto delta = composeAll(patches, newsize);
+
+    SinkOutput output { sink, vector<unsigned char>() };
+    applyDelta(data, delta, output);
+}
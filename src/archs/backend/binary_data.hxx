@@ -1,7 +1,11 @@
 #ifndef BINARY_DATA
 #define BINARY_DATA
 
+#include <chrono>
+#include <cstddef>
+#include <functional>
 #include <vector>
+#include "codec.hxx"
 
 namespace Archive
 {
@@ -11,8 +15,99 @@ namespace Backend
 class BinaryData
 {
 public:
-    static std::vector<unsigned char> CreatePatch(const std::vector<unsigned char>& oldData, const std::vector<unsigned char>& newData);
+    /*! \brief Receives consecutive pieces of data. */
+    using Sink = std::function<void(const unsigned char* data, std::size_t size)>;
+
+    /*! \brief Algorithms creating patches, the header of a patch tells which one was used. */
+    enum Engine
+    {
+        SuffixSort,
+        ContentChunks
+    };
+
+    static std::vector<unsigned char> CreatePatch(const std::vector<unsigned char>& oldData, const std::vector<unsigned char>& newData, const Codec& codec = Codec());
+
+    /*! \brief Create a patch within a time budget.
+     *
+     * Like CreatePatch, but gives up once diffing takes longer than
+     * the budget.
+     * \param oldData Data the patch is applied to.
+     * \param newData Data the patch produces.
+     * \param codec Compresses the blocks of the patch.
+     * \param budget Maximum time to spend.
+     * \param patch Receives the patch, unchanged if the budget was exceeded.
+     * \return False if the budget was exceeded.
+     */
+    static bool TryCreatePatch(const std::vector<unsigned char>& oldData, const std::vector<unsigned char>& newData, const Codec& codec, std::chrono::milliseconds budget, std::vector<unsigned char>& patch);
+
+    /*! \brief Estimate how much two versions of data have in common.
+     *
+     * Compares fingerprints sampled at content defined positions, one
+     * per 256 bytes on average, far cheaper than creating a patch.
+     * \param oldData Data a patch would be applied to.
+     * \param newData Data a patch would produce.
+     * \return Share of the samples of newData also found in oldData,
+     * 1 if newData is too small to be sampled.
+     */
+    static double Similarity(const std::vector<unsigned char>& oldData, const std::vector<unsigned char>& newData);
+
+    /*! \brief Create a patch from content defined chunks.
+     *
+     * Only a hash per chunk of a few KB of the old data is indexed,
+     * instead of a suffix array of all of it, so memory and time stay
+     * low for huge data. Edits smaller than a chunk are found less
+     * precisely than by CreatePatch.
+     * \param oldData Data the patch is applied to.
+     * \param newData Data the patch produces.
+     * \param codec Compresses the blocks of the patch.
+     * \return The patch.
+     */
+    static std::vector<unsigned char> CreateChunkPatch(const std::vector<unsigned char>& oldData, const std::vector<unsigned char>& newData, const Codec& codec = Codec());
+
+    /*! \brief Engine which created a patch. */
+    static Engine PatchEngine(const std::vector<unsigned char>& patch);
     static std::vector<unsigned char> ApplyPatch(const std::vector<unsigned char>& data, const std::vector<unsigned char>& patch);
+
+    /*! \brief Apply a patch into an existing buffer.
+     *
+     * The capacity of the target is reused, alternating two buffers
+     * walks a chain of patches without further allocations.
+     * \param data Data the patch was created against.
+     * \param patch The patch.
+     * \param target Receives the result, must not be data.
+     */
+    static void ApplyPatch(const std::vector<unsigned char>& data, const std::vector<unsigned char>& patch, std::vector<unsigned char>& target);
+
+    /*! \brief Apply a patch and stream the result.
+     *
+     * The result is never held as a whole, it is passed to the sink in
+     * pieces of at most 64 KB.
+     * \param data Data the patch was created against.
+     * \param patch The patch.
+     * \param sink Receives the result.
+     */
+    static void ApplyPatch(const std::vector<unsigned char>& data, const std::vector<unsigned char>& patch, const Sink& sink);
+
+    /*! \brief Merge consecutive patches into one.
+     *
+     * Works on the decoded blocks only, none of the intermediate data
+     * is rebuilt.
+     * \param patches Patches in the order they are applied, each one
+     * was created against the result of its predecessor.
+     * \param codec Compresses the blocks of the merged patch.
+     * \return A patch turning the data of the first patch into the
+     * result of the last one.
+     */
+    static std::vector<unsigned char> ComposePatches(const std::vector<std::vector<unsigned char>>& patches, const Codec& codec = Codec());
+
+    /*! \brief Apply consecutive patches and stream the result.
+     *
+     * The patches are merged first, so no intermediate result is held.
+     * \param data Data the first patch was created against.
+     * \param patches Patches in the order they are applied.
+     * \param sink Receives the result of the last patch.
+     */
+    static void ApplyPatches(const std::vector<unsigned char>& data, const std::vector<std::vector<unsigned char>>& patches, const Sink& sink);
 };
 
 } // namespace Backend
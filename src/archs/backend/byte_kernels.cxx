@@ -0,0 +1,258 @@
+#include "byte_kernels.hxx"
+#include <atomic>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE2
+#define TARGET_AVX2
+#else
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace std;
+using namespace Archive::Backend;
+
+namespace {
+
+struct KernelTable
+{
+    ByteKernels::Level Level;
+    size_t (*MatchLength)(const unsigned char*, const unsigned char*, size_t);
+    size_t (*CountEqual)(const unsigned char*, const unsigned char*, size_t);
+    void (*Subtract)(unsigned char*, const unsigned char*, const unsigned char*, size_t);
+    void (*Add)(unsigned char*, const unsigned char*, size_t);
+};
+
+size_t MatchLengthScalar(const unsigned char* first, const unsigned char* second, size_t size)
+{
+    size_t Position = 0;
+    while (Position < size && first[Position] == second[Position]) ++Position;
+    return Position;
+}
+
+size_t CountEqualScalar(const unsigned char* first, const unsigned char* second, size_t size)
+{
+    size_t Result = 0;
+    for (size_t Position = 0; Position < size; ++Position) Result += first[Position] == second[Position];
+    return Result;
+}
+
+void SubtractScalar(unsigned char* target, const unsigned char* minuend, const unsigned char* subtrahend, size_t size)
+{
+    for (size_t Position = 0; Position < size; ++Position) target[Position] = static_cast<unsigned char>(minuend[Position] - subtrahend[Position]);
+}
+
+void AddScalar(unsigned char* target, const unsigned char* source, size_t size)
+{
+    for (size_t Position = 0; Position < size; ++Position) target[Position] = static_cast<unsigned char>(target[Position] + source[Position]);
+}
+
+#ifdef KERNELS_X86
+
+inline unsigned LowestBit(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long Index;
+    _BitScanForward(&Index, mask);
+    return Index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+TARGET_SSE2 size_t MatchLengthSse2(const unsigned char* first, const unsigned char* second, size_t size)
+{
+    size_t Position = 0;
+    for (; Position + 16 <= size; Position += 16) {
+        auto Equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(first + Position)), _mm_loadu_si128((const __m128i*)(second + Position)));
+        auto Mask = static_cast<uint32_t>(_mm_movemask_epi8(Equal)) ^ 0xffff;
+        if (Mask != 0) return Position + LowestBit(Mask);
+    }
+    return Position + MatchLengthScalar(first + Position, second + Position, size - Position);
+}
+
+TARGET_SSE2 size_t CountEqualSse2(const unsigned char* first, const unsigned char* second, size_t size)
+{
+    // equal bytes compare to -1, subtracting counts them per lane until a lane could overflow
+    size_t Result = 0;
+    size_t Position = 0;
+    auto Zero = _mm_setzero_si128();
+    while (Position + 16 <= size) {
+        auto Counts = Zero;
+        for (auto Rounds = 0; Rounds < 255 && Position + 16 <= size; ++Rounds, Position += 16) {
+            auto Equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(first + Position)), _mm_loadu_si128((const __m128i*)(second + Position)));
+            Counts = _mm_sub_epi8(Counts, Equal);
+        }
+        auto Sums = _mm_sad_epu8(Counts, Zero);
+        Result += static_cast<size_t>(_mm_cvtsi128_si32(Sums)) + static_cast<size_t>(_mm_cvtsi128_si32(_mm_srli_si128(Sums, 8)));
+    }
+    return Result + CountEqualScalar(first + Position, second + Position, size - Position);
+}
+
+TARGET_SSE2 void SubtractSse2(unsigned char* target, const unsigned char* minuend, const unsigned char* subtrahend, size_t size)
+{
+    size_t Position = 0;
+    for (; Position + 16 <= size; Position += 16) {
+        auto Difference = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(minuend + Position)), _mm_loadu_si128((const __m128i*)(subtrahend + Position)));
+        _mm_storeu_si128((__m128i*)(target + Position), Difference);
+    }
+    SubtractScalar(target + Position, minuend + Position, subtrahend + Position, size - Position);
+}
+
+TARGET_SSE2 void AddSse2(unsigned char* target, const unsigned char* source, size_t size)
+{
+    size_t Position = 0;
+    for (; Position + 16 <= size; Position += 16) {
+        auto Sum = _mm_add_epi8(_mm_loadu_si128((const __m128i*)(target + Position)), _mm_loadu_si128((const __m128i*)(source + Position)));
+        _mm_storeu_si128((__m128i*)(target + Position), Sum);
+    }
+    AddScalar(target + Position, source + Position, size - Position);
+}
+
+TARGET_AVX2 size_t MatchLengthAvx2(const unsigned char* first, const unsigned char* second, size_t size)
+{
+    size_t Position = 0;
+    for (; Position + 32 <= size; Position += 32) {
+        auto Equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(first + Position)), _mm256_loadu_si256((const __m256i*)(second + Position)));
+        auto Mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(Equal));
+        if (Mask != 0) return Position + LowestBit(Mask);
+    }
+    return Position + MatchLengthSse2(first + Position, second + Position, size - Position);
+}
+
+TARGET_AVX2 size_t CountEqualAvx2(const unsigned char* first, const unsigned char* second, size_t size)
+{
+    size_t Result = 0;
+    size_t Position = 0;
+    auto Zero = _mm256_setzero_si256();
+    while (Position + 32 <= size) {
+        auto Counts = Zero;
+        for (auto Rounds = 0; Rounds < 255 && Position + 32 <= size; ++Rounds, Position += 32) {
+            auto Equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(first + Position)), _mm256_loadu_si256((const __m256i*)(second + Position)));
+            Counts = _mm256_sub_epi8(Counts, Equal);
+        }
+        auto Sums = _mm256_sad_epu8(Counts, Zero);
+        auto Halves = _mm_add_epi64(_mm256_castsi256_si128(Sums), _mm256_extracti128_si256(Sums, 1));
+        Result += static_cast<size_t>(_mm_cvtsi128_si32(Halves)) + static_cast<size_t>(_mm_cvtsi128_si32(_mm_srli_si128(Halves, 8)));
+    }
+    return Result + CountEqualSse2(first + Position, second + Position, size - Position);
+}
+
+TARGET_AVX2 void SubtractAvx2(unsigned char* target, const unsigned char* minuend, const unsigned char* subtrahend, size_t size)
+{
+    size_t Position = 0;
+    for (; Position + 32 <= size; Position += 32) {
+        auto Difference = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(minuend + Position)), _mm256_loadu_si256((const __m256i*)(subtrahend + Position)));
+        _mm256_storeu_si256((__m256i*)(target + Position), Difference);
+    }
+    SubtractSse2(target + Position, minuend + Position, subtrahend + Position, size - Position);
+}
+
+TARGET_AVX2 void AddAvx2(unsigned char* target, const unsigned char* source, size_t size)
+{
+    size_t Position = 0;
+    for (; Position + 32 <= size; Position += 32) {
+        auto Sum = _mm256_add_epi8(_mm256_loadu_si256((const __m256i*)(target + Position)), _mm256_loadu_si256((const __m256i*)(source + Position)));
+        _mm256_storeu_si256((__m256i*)(target + Position), Sum);
+    }
+    AddSse2(target + Position, source + Position, size - Position);
+}
+
+#endif
+
+const KernelTable Tables[] = {
+    { ByteKernels::Scalar, MatchLengthScalar, CountEqualScalar, SubtractScalar, AddScalar },
+#ifdef KERNELS_X86
+    { ByteKernels::Sse2, MatchLengthSse2, CountEqualSse2, SubtractSse2, AddSse2 },
+    { ByteKernels::Avx2, MatchLengthAvx2, CountEqualAvx2, SubtractAvx2, AddAvx2 },
+#endif
+};
+
+ByteKernels::Level Detect()
+{
+#ifdef KERNELS_X86
+#ifdef _MSC_VER
+    // AVX2 needs the processor flag and the operating system saving the ymm registers
+    int Info[4];
+    __cpuid(Info, 0);
+    auto Leaves = Info[0];
+    __cpuid(Info, 1);
+    auto Avx = (Info[2] & (1 << 27)) != 0 && (Info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+    if (Avx && Leaves >= 7) {
+        __cpuidex(Info, 7, 0);
+        if (Info[1] & (1 << 5)) return ByteKernels::Avx2;
+    }
+    return ByteKernels::Sse2;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? ByteKernels::Avx2 : ByteKernels::Sse2;
+#endif
+#else
+    return ByteKernels::Scalar;
+#endif
+}
+
+ByteKernels::Level SupportedLevel()
+{
+    static const auto Result = Detect();
+    return Result;
+}
+
+atomic<const KernelTable*>& Current()
+{
+    static atomic<const KernelTable*> Result(&Tables[SupportedLevel()]);
+    return Result;
+}
+
+} // anonymous namespace
+
+ByteKernels::Level ByteKernels::Supported()
+{
+    return SupportedLevel();
+}
+
+ByteKernels::Level ByteKernels::Active()
+{
+    return Current().load()->Level;
+}
+
+void ByteKernels::Use(Level level)
+{
+    Current() = &Tables[level < SupportedLevel() ? level : SupportedLevel()];
+}
+
+const char* ByteKernels::Name(Level level)
+{
+    switch (level) {
+    case Scalar: return "scalar";
+    case Sse2: return "sse2";
+    case Avx2: return "avx2";
+    }
+    return "unknown";
+}
+
+size_t ByteKernels::MatchLength(const unsigned char* first, const unsigned char* second, size_t size)
+{
+    return Current().load(memory_order_relaxed)->MatchLength(first, second, size);
+}
+
+size_t ByteKernels::CountEqual(const unsigned char* first, const unsigned char* second, size_t size)
+{
+    return Current().load(memory_order_relaxed)->CountEqual(first, second, size);
+}
+
+void ByteKernels::Subtract(unsigned char* target, const unsigned char* minuend, const unsigned char* subtrahend, size_t size)
+{
+    Current().load(memory_order_relaxed)->Subtract(target, minuend, subtrahend, size);
+}
+
+void ByteKernels::Add(unsigned char* target, const unsigned char* source, size_t size)
+{
+    Current().load(memory_order_relaxed)->Add(target, source, size);
+}
@@ -0,0 +1,84 @@
+#ifndef BYTE_KERNELS_HXX
+#define BYTE_KERNELS_HXX
+
+#include <cstddef>
+
+namespace Archive
+{
+namespace Backend
+{
+
+/*! \brief Byte loops of the delta engines.
+ *
+ * Each loop has a scalar, an SSE2 and an AVX2 variant, the best one the
+ * processor supports is chosen on first use. All variants give the same
+ * results, processors other than x86 always use the scalar loops.
+ */
+class ByteKernels
+{
+public:
+    /*! \brief Instruction set levels, each one includes its predecessors. */
+    enum Level
+    {
+        Scalar,
+        Sse2,
+        Avx2
+    };
+
+    /*! \brief Best level of the processor. */
+    static Level Supported();
+
+    /*! \brief Level of the variants in use. */
+    static Level Active();
+
+    /*! \brief Switch the variants in use.
+     *
+     * Meant for benchmarks and tests, levels above the supported one
+     * fall back to it.
+     * \param level The level to use.
+     */
+    static void Use(Level level);
+
+    /*! \brief Printable name of a level. */
+    static const char* Name(Level level);
+
+    /*! \brief Length of the common prefix of two buffers.
+     *
+     * \param first First buffer.
+     * \param second Second buffer.
+     * \param size Bytes available in both buffers.
+     * \return Position of the first difference, size if there is none.
+     */
+    static std::size_t MatchLength(const unsigned char* first, const unsigned char* second, std::size_t size);
+
+    /*! \brief Count the positions holding the same byte in two buffers.
+     *
+     * \param first First buffer.
+     * \param second Second buffer.
+     * \param size Bytes available in both buffers.
+     * \return Amount of equal bytes.
+     */
+    static std::size_t CountEqual(const unsigned char* first, const unsigned char* second, std::size_t size);
+
+    /*! \brief Bytewise difference modulo 256.
+     *
+     * \param target Receives minuend[i] - subtrahend[i].
+     * \param minuend Buffer subtracted from.
+     * \param subtrahend Buffer subtracted.
+     * \param size Bytes in all buffers.
+     */
+    static void Subtract(unsigned char* target, const unsigned char* minuend, const unsigned char* subtrahend, std::size_t size);
+
+    /*! \brief Bytewise sum modulo 256 in place.
+     *
+     * \param target Buffer source is added to.
+     * \param source Buffer added.
+     * \param size Bytes in both buffers.
+     */
+    static void Add(unsigned char* target, const unsigned char* source, std::size_t size);
+};
+
+} // namespace Backend
+} // namespace Archive
+
+#endif
@@ -0,0 +1,185 @@
+#include "codec.hxx"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <boost/format.hpp>
+#include <bzlib.h>
+
+using namespace std;
+using namespace Archive::Backend;
+
+namespace {
+
+// LZ4 block format limits
+const size_t MinMatch = 4;
+const size_t LastLiterals = 5;
+const size_t MatchSearchLimit = 12;
+const size_t MaxOffset = 65535;
+
+inline uint32_t Read32(const unsigned char* data)
+{
+    uint32_t Result;
+    memcpy(&Result, data, sizeof(Result));
+    return Result;
+}
+
+void WriteLength(vector<unsigned char>& target, size_t length)
+{
+    for (; length >= 255; length -= 255) target.push_back(255);
+    target.push_back(static_cast<unsigned char>(length));
+}
+
+void WriteSequence(vector<unsigned char>& target, const unsigned char* literals, size_t literalLength, size_t offset, size_t matchLength)
+{
+    auto Literals = min(literalLength, size_t(15));
+    auto Match = matchLength >= MinMatch ? min(matchLength - MinMatch, size_t(15)) : 0;
+    target.push_back(static_cast<unsigned char>(Literals << 4 | Match));
+    if (Literals == 15) WriteLength(target, literalLength - 15);
+    target.insert(target.end(), literals, literals + literalLength);
+    if (matchLength < MinMatch) return;
+
+    target.push_back(static_cast<unsigned char>(offset & 0xff));
+    target.push_back(static_cast<unsigned char>(offset >> 8));
+    if (Match == 15) WriteLength(target, matchLength - MinMatch - 15);
+}
+
+vector<unsigned char> CompressLz4(const unsigned char* data, size_t size, int level)
+{
+    vector<unsigned char> Result;
+    Result.reserve(size + size / 255 + 16);
+
+    // positions are stored plus one, zero marks an empty slot; like the
+    // reference implementation the table shrinks for small inputs, clearing
+    // it would otherwise cost more than compressing a sample
+    auto Bits = 10 + level;
+    while (Bits > 8 && (size_t(1) << (Bits - 1)) >= size) --Bits;
+    vector<uint32_t> Table(size_t(1) << Bits);
+
+    size_t Anchor = 0;
+    size_t Position = 0;
+    while (Position + MatchSearchLimit <= size) {
+        auto Sequence = Read32(data + Position);
+        auto Slot = (Sequence * 2654435761u) >> (32 - Bits);
+        auto Candidate = static_cast<size_t>(Table[Slot]);
+        Table[Slot] = static_cast<uint32_t>(Position + 1);
+
+        if (Candidate == 0 || Position - (Candidate - 1) > MaxOffset || Read32(data + Candidate - 1) != Sequence) {
+            ++Position;
+            continue;
+        }
+
+        auto Match = Candidate - 1;
+        while (Position > Anchor && Match > 0 && data[Position - 1] == data[Match - 1]) {
+            --Position;
+            --Match;
+        }
+
+        auto Length = MinMatch;
+        while (Position + Length < size - LastLiterals && data[Match + Length] == data[Position + Length]) ++Length;
+
+        WriteSequence(Result, data + Anchor, Position - Anchor, Position - Match, Length);
+        Position += Length;
+        Anchor = Position;
+    }
+
+    WriteSequence(Result, data + Anchor, size - Anchor, 0, 0);
+    return Result;
+}
+
+void DecompressLz4(const unsigned char* data, size_t size, unsigned char* target, size_t targetSize)
+{
+    auto Invalid = []() { return runtime_error("lz4: invalid data"); };
+    auto ReadLength = [data, size, &Invalid](size_t& position, size_t length) {
+        for (unsigned char Next = 255; Next == 255; length += Next) {
+            if (position >= size) throw Invalid();
+            Next = data[position++];
+        }
+        return length;
+    };
+
+    size_t Input = 0;
+    size_t Output = 0;
+    while (Input < size) {
+        auto Token = data[Input++];
+
+        size_t Literals = Token >> 4;
+        if (Literals == 15) Literals = ReadLength(Input, Literals);
+        if (Literals > size - Input || Literals > targetSize - Output) throw Invalid();
+        if (Literals > 0) memcpy(target + Output, data + Input, Literals);
+        Input += Literals;
+        Output += Literals;
+        if (Input == size) break;
+
+        if (size - Input < 2) throw Invalid();
+        size_t Offset = data[Input] | data[Input + 1] << 8;
+        Input += 2;
+        if (Offset == 0 || Offset > Output) throw Invalid();
+
+        size_t Length = Token & 15;
+        if (Length == 15) Length = ReadLength(Input, Length);
+        Length += MinMatch;
+        if (Length > targetSize - Output) throw Invalid();
+
+        // byte wise, source and target overlap for short offsets
+        for (auto Source = target + Output - Offset, End = target + Output + Length; target + Output < End; ++Output) target[Output] = *Source++;
+    }
+
+    if (Output != targetSize) throw Invalid();
+}
+
+} // anonymous namespace
+
+Codec::Codec(Method method, int level)
+: Method_(method), Level_(max(1, min(level, 9)))
+{ }
+
+vector<unsigned char> Codec::Compress(const unsigned char* data, size_t size) const
+{
+    switch (Method_) {
+    case Store:
+        return vector<unsigned char>(data, data + size);
+
+    case Lz4:
+        return CompressLz4(data, size, Level_);
+
+    case Bzip2: {
+        char Empty = 0;
+        vector<unsigned char> Result(size + size / 100 + 600);
+        auto Length = static_cast<unsigned int>(Result.size());
+        auto Source = size == 0 ? &Empty : (char*)data;
+        auto Status = BZ2_bzBuffToBuffCompress((char*)&Result[0], &Length, Source, static_cast<unsigned int>(size), Level_, 0, 30);
+        if (Status != BZ_OK) throw runtime_error((boost::format("bzip: %1% in %2% at %3%") % Status % __FILE__ % __LINE__).str());
+
+        Result.resize(Length);
+        return Result;
+    }
+    }
+
+    throw runtime_error((boost::format("unknown codec %1%") % static_cast<int>(Method_)).str());
+}
+
+void Codec::Decompress(Method method, const unsigned char* data, size_t size, unsigned char* target, size_t targetSize)
+{
+    switch (method) {
+    case Store:
+        if (size != targetSize) throw runtime_error("store: invalid data");
+        if (size > 0) memcpy(target, data, size);
+        return;
+
+    case Lz4:
+        DecompressLz4(data, size, target, targetSize);
+        return;
+
+    case Bzip2: {
+        char Empty = 0;
+        auto Length = static_cast<unsigned int>(targetSize);
+        auto Target = targetSize == 0 ? &Empty : (char*)target;
+        auto Status = BZ2_bzBuffToBuffDecompress(Target, &Length, (char*)data, static_cast<unsigned int>(size), 0, 0);
+        if (Status != BZ_OK || Length != targetSize) throw runtime_error((boost::format("bzip: %1% in %2% at %3%") % Status % __FILE__ % __LINE__).str());
+        return;
+    }
+    }
+
+    throw runtime_error((boost::format("unknown codec %1%") % static_cast<int>(method)).str());
+}
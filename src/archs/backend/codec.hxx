@@ -0,0 +1,70 @@
+#ifndef CODEC_HXX
+#define CODEC_HXX
+
+#include <cstddef>
+#include <vector>
+
+namespace Archive
+{
+namespace Backend
+{
+
+/*! \brief Compression method and level for stored data.
+ *
+ * Bzip2 compresses best and is the default, Lz4 trades size for much
+ * faster decompression, Store keeps the data as is. The Lz4 codec
+ * writes the plain LZ4 block format.
+ */
+class Codec
+{
+public:
+    /*! \brief Available methods, the values are persisted. */
+    enum Method : unsigned char
+    {
+        Store = 0,
+        Bzip2 = 1,
+        Lz4 = 2
+    };
+
+private:
+    Method Method_;
+    int Level_;
+
+public:
+    /*! \brief Constructs a codec.
+     *
+     * \param method Compression method.
+     * \param level 1 (fastest) to 9 (smallest), clamped to this range.
+     * For Bzip2 the level is the block size in 100 KB, for Lz4 it
+     * selects the size of the match finder table.
+     */
+    Codec(Method method = Bzip2, int level = 9);
+
+    Method Type() const { return Method_; }
+    int Level() const { return Level_; }
+
+    /*! \brief Compress data.
+     *
+     * \param data Data to compress, may be nullptr if size is 0.
+     * \param size Amount of bytes.
+     * \return The compressed data.
+     */
+    std::vector<unsigned char> Compress(const unsigned char* data, std::size_t size) const;
+
+    /*! \brief Decompress data.
+     *
+     * Throws std::runtime_error if the data is invalid or does not
+     * decompress to exactly targetSize bytes.
+     * \param method Method the data was compressed with.
+     * \param data Compressed data.
+     * \param size Amount of compressed bytes.
+     * \param target Receives the decompressed data.
+     * \param targetSize Expected size of the decompressed data.
+     */
+    static void Decompress(Method method, const unsigned char* data, std::size_t size, unsigned char* target, std::size_t targetSize);
+};
+
+} // namespace Backend
+} // namespace Archive
+
+#endif
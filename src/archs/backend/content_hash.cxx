@@ -0,0 +1,156 @@
+/*
+ * XXH64 by Yann Collet, see https://github.com/Cyan4973/xxHash
+ */
+
+#include "content_hash.hxx"
+#include <cstring>
+#include <boost/format.hpp>
+
+using namespace std;
+using namespace Archive::Backend;
+
+namespace
+{
+
+const uint64_t Prime1 = 11400714785074694791ULL;
+const uint64_t Prime2 = 14029467366897019727ULL;
+const uint64_t Prime3 = 1609587929392839161ULL;
+const uint64_t Prime4 = 9650029242287828579ULL;
+const uint64_t Prime5 = 2870177450012600261ULL;
+
+inline uint64_t Rotate(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t Read64(const unsigned char* data)
+{
+    uint64_t Result;
+    memcpy(&Result, data, sizeof(Result));
+    return Result;
+}
+
+inline uint32_t Read32(const unsigned char* data)
+{
+    uint32_t Result;
+    memcpy(&Result, data, sizeof(Result));
+    return Result;
+}
+
+inline uint64_t Round(uint64_t accumulator, uint64_t input)
+{
+    accumulator += input * Prime2;
+    accumulator = Rotate(accumulator, 31);
+    return accumulator * Prime1;
+}
+
+inline uint64_t Merge(uint64_t accumulator, uint64_t value)
+{
+    accumulator ^= Round(0, value);
+    return accumulator * Prime1 + Prime4;
+}
+
+// the four lanes are independent, so the loop runs at several bytes per cycle
+inline void Stripe(uint64_t lanes[4], const unsigned char* data)
+{
+    lanes[0] = Round(lanes[0], Read64(data));
+    lanes[1] = Round(lanes[1], Read64(data + 8));
+    lanes[2] = Round(lanes[2], Read64(data + 16));
+    lanes[3] = Round(lanes[3], Read64(data + 24));
+}
+
+} // anonymous namespace
+
+ContentHash::ContentHash(uint64_t seed)
+: Seed_(seed), Total_(0), Buffered_(0)
+{
+    Lanes_[0] = seed + Prime1 + Prime2;
+    Lanes_[1] = seed + Prime2;
+    Lanes_[2] = seed;
+    Lanes_[3] = seed - Prime1;
+}
+
+void ContentHash::Update(const void* data, size_t size)
+{
+    auto Position = static_cast<const unsigned char*>(data);
+    auto End = Position + size;
+    Total_ += size;
+
+    if (Buffered_ + size < sizeof(Buffer_)) {
+        if (size) memcpy(Buffer_ + Buffered_, Position, size);
+        Buffered_ += size;
+        return;
+    }
+
+    if (Buffered_) {
+        auto Missing = sizeof(Buffer_) - Buffered_;
+        memcpy(Buffer_ + Buffered_, Position, Missing);
+        Stripe(Lanes_, Buffer_);
+        Position += Missing;
+        Buffered_ = 0;
+    }
+
+    for (; Position + 32 <= End; Position += 32) {
+        Stripe(Lanes_, Position);
+    }
+
+    Buffered_ = End - Position;
+    if (Buffered_) memcpy(Buffer_, Position, Buffered_);
+}
+
+uint64_t ContentHash::Digest() const
+{
+    uint64_t Result;
+
+    if (Total_ >= 32) {
+        Result = Rotate(Lanes_[0], 1) + Rotate(Lanes_[1], 7) + Rotate(Lanes_[2], 12) + Rotate(Lanes_[3], 18);
+        Result = Merge(Result, Lanes_[0]);
+        Result = Merge(Result, Lanes_[1]);
+        Result = Merge(Result, Lanes_[2]);
+        Result = Merge(Result, Lanes_[3]);
+    }
+    else {
+        Result = Seed_ + Prime5;
+    }
+
+    Result += Total_;
+
+    auto Position = Buffer_;
+    auto End = Buffer_ + Buffered_;
+
+    for (; Position + 8 <= End; Position += 8) {
+        Result ^= Round(0, Read64(Position));
+        Result = Rotate(Result, 27) * Prime1 + Prime4;
+    }
+
+    if (Position + 4 <= End) {
+        Result ^= Read32(Position) * Prime1;
+        Result = Rotate(Result, 23) * Prime2 + Prime3;
+        Position += 4;
+    }
+
+    for (; Position < End; ++Position) {
+        Result ^= *Position * Prime5;
+        Result = Rotate(Result, 11) * Prime1;
+    }
+
+    Result ^= Result >> 33;
+    Result *= Prime2;
+    Result ^= Result >> 29;
+    Result *= Prime3;
+    Result ^= Result >> 32;
+
+    return Result;
+}
+
+string ContentHash::Checksum() const
+{
+    return (boost::format("%016x") % Digest()).str();
+}
+
+string ContentHash::Compute(const vector<unsigned char>& data)
+{
+    ContentHash Hash;
+    Hash.Update(data.data(), data.size());
+    return Hash.Checksum();
+}
@@ -0,0 +1,63 @@
+#ifndef CONTENT_HASH_HXX
+#define CONTENT_HASH_HXX
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Archive
+{
+namespace Backend
+{
+
+/*! \brief Streaming XXH64 hash of document data.
+ *
+ * Used for the checksums of document contents and as the key of the
+ * content addressed blob store. Data can be fed in pieces of any size,
+ * the result does not depend on how the input is split.
+ */
+class ContentHash
+{
+private:
+    std::uint64_t Lanes_[4];
+    std::uint64_t Seed_;
+    std::uint64_t Total_;
+    unsigned char Buffer_[32];
+    std::size_t Buffered_;
+
+public:
+    explicit ContentHash(std::uint64_t seed = 0);
+
+    /*! \brief Feed data.
+     *
+     * \param data Start of the data.
+     * \param size Length of the data in bytes.
+     */
+    void Update(const void* data, std::size_t size);
+
+    /*! \brief Hash of the data fed so far.
+     *
+     * Does not modify the state, more data may be fed afterwards.
+     * \return The hash value.
+     */
+    std::uint64_t Digest() const;
+
+    /*! \brief Checksum of the data fed so far.
+     *
+     * \return The hash value as 16 lower case hex digits.
+     */
+    std::string Checksum() const;
+
+    /*! \brief Checksum of a buffer.
+     *
+     * \param data The data to hash.
+     * \return The hash value as 16 lower case hex digits.
+     */
+    static std::string Compute(const std::vector<unsigned char>& data);
+};
+
+} // namespace Backend
+} // namespace Archive
+
+#endif
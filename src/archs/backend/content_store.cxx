@@ -0,0 +1,357 @@
+#include "content_store.hxx"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+using namespace std;
+using namespace Archive::Backend;
+
+namespace {
+
+// compressibility is judged from a few samples of this size
+const size_t SampleSize = 4096;
+const size_t Samples = 4;
+
+// compressed contents are cut into pieces of at most this size, so a range
+// read only decompresses the pieces it overlaps
+const size_t CompressedChunkSize = 1 << 20;
+
+} // anonymous namespace
+
+ContentStore::ContentStore(int chunkSize, const Codec& codec)
+: ChunkSize_(max(chunkSize, 0)), Codec_(codec)
+{ }
+
+string ContentStore::Address(const string& checksum, size_t size)
+{
+    return checksum + "-" + to_string(size);
+}
+
+void ContentStore::Store(SQLite::Connection* connection, const string& owner, const Access::BinaryData& data, const string& checksum) const
+{
+    auto Key = Address(checksum, data.size());
+
+    auto Exists = connection->Create("SELECT COUNT(*) FROM ContentBlobs WHERE Address = :Address");
+    Exists.Parameters()["Address"].SetValue(Key);
+
+    if (Exists.ExecuteScalar<int>() == 0) {
+        auto Compress = Compressible(data);
+        auto Piece = ChunkSize(Compress);
+        auto Chunked = Piece > 0 && data.size() > Piece;
+
+        vector<unsigned char> Packed;
+        auto Method = Chunked ? Codec::Store : Pack(data.data(), data.size(), Compress, Packed);
+        auto& Stored = Method == Codec::Store ? data : Packed;
+
+        auto Command = connection->Create("INSERT INTO ContentBlobs (Address, Size, RefCount, Codec, Data) VALUES (:Address, :Size, 0, :Codec, :Data)");
+        Command.Parameters()["Address"].SetValue(Key);
+        Command.Parameters()["Size"].SetValue(static_cast<int64_t>(data.size()));
+        Command.Parameters()["Codec"].SetValue(static_cast<int>(Method));
+        Command.Parameters()["Data"].SetRawValue(Chunked || Stored.empty() ? nullptr : &Stored[0], Chunked ? 0 : static_cast<int>(Stored.size()));
+        Command.Execute();
+
+        if (Chunked) StoreChunks(connection, Key, data, Compress, Piece);
+    }
+    else if (Matches(connection, Key, data) == false) {
+        auto Command = connection->Create("UPDATE DocumentContents SET Data = :Data WHERE Id = :Owner");
+        Command.Parameters()["Owner"].SetValue(owner);
+        Command.Parameters()["Data"].SetValue(data);
+        Command.Execute();
+        return;
+    }
+
+    auto Command = connection->Create("INSERT INTO ContentLinks (Owner, Address) VALUES (:Owner, :Address)");
+    Command.Parameters()["Owner"].SetValue(owner);
+    Command.Parameters()["Address"].SetValue(Key);
+    Command.Execute();
+}
+
+bool ContentStore::Share(SQLite::Connection* connection, const string& owner, const string& source) const
+{
+    auto Command = connection->Create("INSERT INTO ContentLinks (Owner, Address) SELECT :Owner, Address FROM ContentLinks WHERE Owner = :Source");
+    Command.Parameters()["Owner"].SetValue(owner);
+    Command.Parameters()["Source"].SetValue(source);
+    Command.Execute();
+
+    auto Changes = connection->Create("SELECT changes()");
+    return Changes.ExecuteScalar<int>() > 0;
+}
+
+bool ContentStore::Linked(SQLite::Connection* connection, const string& owner) const
+{
+    auto Command = connection->Create("SELECT COUNT(*) FROM ContentLinks WHERE Owner = :Owner");
+    Command.Parameters()["Owner"].SetValue(owner);
+    return Command.ExecuteScalar<int>() > 0;
+}
+
+void ContentStore::Release(SQLite::Connection* connection, const string& owner) const
+{
+    auto Command = connection->Create("DELETE FROM ContentLinks WHERE Owner = :Owner");
+    Command.Parameters()["Owner"].SetValue(owner);
+    Command.Execute();
+}
+
+bool ContentStore::Compressible(const Access::BinaryData& data) const
+{
+    if (Codec_.Type() == Codec::Store || data.empty()) return false;
+
+    size_t Sampled = 0;
+    size_t Packed = 0;
+    auto Step = max(data.size() / Samples, SampleSize);
+    for (size_t Position = 0; Position < data.size(); Position += Step) {
+        auto Size = min(SampleSize, data.size() - Position);
+        Packed += Codec_.Compress(&data[Position], Size).size();
+        Sampled += Size;
+    }
+
+    // worth it when at least a tenth is saved
+    return Packed * 10 <= Sampled * 9;
+}
+
+size_t ContentStore::ChunkSize(bool compress) const
+{
+    auto Configured = static_cast<size_t>(ChunkSize_);
+    if (compress == false) return Configured;
+    return Configured > 0 ? min(Configured, CompressedChunkSize) : CompressedChunkSize;
+}
+
+Codec::Method ContentStore::Pack(const unsigned char* data, size_t size, bool compress, vector<unsigned char>& target) const
+{
+    if (compress) {
+        target = Codec_.Compress(data, size);
+        if (target.size() < size) return Codec_.Type();
+    }
+
+    target.clear();
+    return Codec::Store;
+}
+
+bool ContentStore::Matches(SQLite::Connection* connection, const string& address, const Access::BinaryData& data) const
+{
+    {
+        auto Command = connection->Create("SELECT rowid, Size, Codec, length(Data) FROM ContentBlobs WHERE Address = :Address");
+        Command.Parameters()["Address"].SetValue(address);
+        auto Result = Command.Open();
+        if (Result.HasData() == false) return false;
+
+        auto& Row = *Result.begin();
+        if (static_cast<size_t>(Row.Get<int64_t>(1)) != data.size()) return false;
+        if (data.empty()) return true;
+
+        if (Row.Get<int64_t>(3) > 0) {
+            if (static_cast<Codec::Method>(Row.Get<int>(2)) != Codec::Store) {
+                // blobs compressed as a whole are small, see ChunkSize
+                Access::BinaryData Stored;
+                return LoadBlob(connection, address, Stored) && Stored == data;
+            }
+
+            // read piece by piece, a collision usually differs in the first one
+            auto Blob = connection->OpenBlob("ContentBlobs", "Data", Row.Get<int64_t>(0));
+            vector<unsigned char> Piece(min(data.size(), CompressedChunkSize));
+            for (size_t Position = 0; Position < data.size(); Position += Piece.size()) {
+                auto Size = min(Piece.size(), data.size() - Position);
+                Blob.Read(static_cast<int>(Position), Piece.data(), static_cast<int>(Size));
+                if (equal(Piece.begin(), Piece.begin() + Size, data.begin() + Position) == false) return false;
+            }
+            return true;
+        }
+    }
+
+    auto Command = connection->Create("SELECT Position, Size, Codec, Data FROM DocumentChunks WHERE Owner = :Owner ORDER BY SeqId");
+    Command.Parameters()["Owner"].SetValue(address);
+
+    size_t Total = 0;
+    Access::BinaryData Unpacked;
+    for (auto& Row : Command.Open()) {
+        auto Position = static_cast<size_t>(Row.Get<int64_t>(0));
+        auto Size = static_cast<size_t>(Row.Get<int64_t>(1));
+        if (Position != Total || Size > data.size() - Position) return false;
+
+        auto Method = static_cast<Codec::Method>(Row.Get<int>(2));
+        auto Chunk = Row.GetBlobView(3);
+        auto Stored = Chunk.Data;
+        if (Method == Codec::Store && Chunk.Size != Size) return false;
+        if (Method != Codec::Store) {
+            Unpacked.resize(Size);
+            Codec::Decompress(Method, Chunk.Data, Chunk.Size, Unpacked.data(), Size);
+            Stored = Unpacked.data();
+        }
+
+        if (equal(Stored, Stored + Size, data.begin() + Position) == false) return false;
+        Total += Size;
+    }
+
+    return Total == data.size();
+}
+
+bool ContentStore::Equals(SQLite::Connection* connection, const string& owner, const Access::BinaryData& data) const
+{
+    string Key;
+    {
+        auto Command = connection->Create("SELECT Address FROM ContentLinks WHERE Owner = :Owner");
+        Command.Parameters()["Owner"].SetValue(owner);
+        auto Result = Command.Open();
+        if (Result.HasData() == false) return false;
+        Key = (*Result.begin()).Get<string>(0);
+    }
+
+    return Matches(connection, Key, data);
+}
+
+void ContentStore::StoreChunks(SQLite::Connection* connection, const string& address, const Access::BinaryData& data, bool compress, size_t chunkSize) const
+{
+    const string Query = "INSERT INTO DocumentChunks (Owner, SeqId, Position, Size, Codec, Data) VALUES (:Owner, :SeqId, :Position, :Size, :Codec, :Data)";
+
+    auto Command = connection->Create(Query);
+    Command.Parameters()["Owner"].SetValue(address);
+
+    int SeqId = 1;
+    vector<unsigned char> Packed;
+    for (size_t Position = 0; Position < data.size(); Position += chunkSize) {
+        auto Size = min(data.size() - Position, chunkSize);
+        auto Method = Pack(&data[Position], Size, compress, Packed);
+
+        Command.Parameters()["SeqId"].SetValue(SeqId++);
+        Command.Parameters()["Position"].SetValue(static_cast<int64_t>(Position));
+        Command.Parameters()["Size"].SetValue(static_cast<int>(Size));
+        Command.Parameters()["Codec"].SetValue(static_cast<int>(Method));
+        if (Method == Codec::Store) Command.Parameters()["Data"].SetRawValue(&data[Position], static_cast<int>(Size));
+        else Command.Parameters()["Data"].SetRawValue(&Packed[0], static_cast<int>(Packed.size()));
+        Command.Execute();
+    }
+}
+
+bool ContentStore::LoadBlob(SQLite::Connection* connection, const string& address, Access::BinaryData& target) const
+{
+    {
+        auto Command = connection->Create("SELECT Size, Codec, Data FROM ContentBlobs WHERE Address = :Address");
+        Command.Parameters()["Address"].SetValue(address);
+        auto Result = Command.Open();
+        if (Result.HasData() == false) return false;
+
+        auto& Row = *Result.begin();
+        auto Size = static_cast<size_t>(Row.Get<int64_t>(0));
+        auto Blob = Row.GetBlobView(2);
+        target.resize(Size);
+
+        // chunked blobs keep an empty data column, everything else is decompressed in place
+        if (Blob.empty() == false || Size == 0) {
+            Codec::Decompress(static_cast<Codec::Method>(Row.Get<int>(1)), Blob.Data, Blob.Size, target.data(), Size);
+            return true;
+        }
+    }
+
+    auto Command = connection->Create("SELECT Position, Size, Codec, Data FROM DocumentChunks WHERE Owner = :Owner ORDER BY SeqId");
+    Command.Parameters()["Owner"].SetValue(address);
+
+    size_t Total = 0;
+    for (auto& Row : Command.Open()) {
+        auto Position = static_cast<size_t>(Row.Get<int64_t>(0));
+        auto Size = static_cast<size_t>(Row.Get<int64_t>(1));
+        if (Position != Total || Size > target.size() - Position) throw runtime_error("invalid chunk for content " + address);
+
+        auto Chunk = Row.GetBlobView(3);
+        Codec::Decompress(static_cast<Codec::Method>(Row.Get<int>(2)), Chunk.Data, Chunk.Size, &target[Position], Size);
+        Total += Size;
+    }
+
+    if (Total != target.size()) throw runtime_error("missing chunks for content " + address);
+    return true;
+}
+
+bool ContentStore::Load(SQLite::Connection* connection, const string& owner, Access::BinaryData& target) const
+{
+    string Key;
+    {
+        auto Command = connection->Create("SELECT Address FROM ContentLinks WHERE Owner = :Owner");
+        Command.Parameters()["Owner"].SetValue(owner);
+        auto Result = Command.Open();
+        if (Result.HasData() == false) return false;
+        Key = (*Result.begin()).Get<string>(0);
+    }
+
+    return LoadBlob(connection, Key, target);
+}
+
+Access::BinaryData ContentStore::Load(SQLite::Connection* connection, const string& owner, int offset, int length) const
+{
+    const string BlobQuery =
+R"(SELECT
+    blb.rowid, blb.Address, blb.Size, blb.Codec, length(blb.Data)
+FROM
+    ContentLinks lnk
+INNER JOIN
+    ContentBlobs blb
+ON
+    blb.Address = lnk.Address
+WHERE
+    lnk.Owner = :Owner)";
+
+    const string ChunkQuery =
+R"(SELECT
+    Position, Size, Codec, Data
+FROM
+    DocumentChunks
+WHERE
+    Owner = :Owner
+AND
+    Position < :End
+AND
+    Position + Size > :Start
+ORDER BY
+    SeqId)";
+
+    auto Start = static_cast<int64_t>(offset);
+    auto End = Start + length;
+
+    string Key;
+    {
+        auto Command = connection->Create(BlobQuery);
+        Command.Parameters()["Owner"].SetValue(owner);
+        auto Result = Command.Open();
+        if (Result.HasData() == false) return Access::BinaryData();
+
+        auto& Row = *Result.begin();
+        Key = Row.Get<string>(1);
+        auto Size = Row.Get<int64_t>(2);
+        auto Method = static_cast<Codec::Method>(Row.Get<int>(3));
+
+        if (Row.Get<int64_t>(4) > 0 || Size == 0) {
+            if (Method == Codec::Store) return connection->OpenBlob("ContentBlobs", "Data", Row.Get<int64_t>(0)).Read(offset, length);
+
+            // blobs compressed as a whole are small or predate the compressed chunks, the window is cut from the whole content
+            Access::BinaryData Content;
+            LoadBlob(connection, Key, Content);
+            auto First = min(Start, Size);
+            auto Last = min(End, Size);
+            return Access::BinaryData(Content.begin() + First, Content.begin() + Last);
+        }
+    }
+
+    auto Command = connection->Create(ChunkQuery);
+    Command.Parameters()["Owner"].SetValue(Key);
+    Command.Parameters()["Start"].SetValue(Start);
+    Command.Parameters()["End"].SetValue(End);
+
+    Access::BinaryData Result;
+    Access::BinaryData Unpacked;
+    for (auto& Row : Command.Open()) {
+        auto Position = Row.Get<int64_t>(0);
+        auto Size = Row.Get<int64_t>(1);
+        auto Method = static_cast<Codec::Method>(Row.Get<int>(2));
+        auto Chunk = Row.GetBlobView(3);
+
+        auto Data = Chunk.Data;
+        if (Method != Codec::Store) {
+            Unpacked.resize(static_cast<size_t>(Size));
+            Codec::Decompress(Method, Chunk.Data, Chunk.Size, Unpacked.data(), Unpacked.size());
+            Data = Unpacked.data();
+        }
+
+        auto First = static_cast<size_t>(max(Start - Position, int64_t(0)));
+        auto Last = static_cast<size_t>(min(End - Position, Size));
+        Result.insert(Result.end(), Data + First, Data + Last);
+    }
+
+    return Result;
+}
@@ -0,0 +1,138 @@
+#ifndef CONTENT_STORE_HXX
+#define CONTENT_STORE_HXX
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "codec.hxx"
+#include "sqlite.hxx"
+#include "Archive.h"
+
+namespace Archive
+{
+namespace Backend
+{
+
+/*! \brief Content addressed storage for document contents.
+ *
+ * Full contents are stored once per bucket in the ContentBlobs table,
+ * keyed by their checksum and size. DocumentContents rows refer to them
+ * through ContentLinks and keep an empty Data blob, triggers maintain
+ * a reference count and remove a blob together with its last link,
+ * so destroying a document releases its contents via the cascade.
+ *
+ * Large contents are split into fixed size chunks stored in the
+ * DocumentChunks table, keyed by the address of the blob and the
+ * chunk number. Rows holding their data inline (patches and contents
+ * written before this layout existed) are not affected.
+ *
+ * Blobs and chunks may be compressed, the Codec column of a row names
+ * the method. Whether a content is compressed is decided by compressing
+ * a few samples of it, data which does not shrink is stored as is.
+ * Compressed contents are chunked even without a configured chunk size,
+ * in chunks of at most 1 MB, so each of them is decoded on its own.
+ */
+class ContentStore
+{
+private:
+    int ChunkSize_;
+    Codec Codec_;
+
+    bool Compressible(const Access::BinaryData& data) const;
+    std::size_t ChunkSize(bool compress) const;
+    Codec::Method Pack(const unsigned char* data, std::size_t size, bool compress, std::vector<unsigned char>& target) const;
+    bool LoadBlob(SQLite::Connection* connection, const std::string& address, Access::BinaryData& target) const;
+    bool Matches(SQLite::Connection* connection, const std::string& address, const Access::BinaryData& data) const;
+    void StoreChunks(SQLite::Connection* connection, const std::string& address, const Access::BinaryData& data, bool compress, std::size_t chunkSize) const;
+
+public:
+    /*! \brief Constructs the store.
+     *
+     * \param chunkSize Size of a chunk in bytes, 0 disables the chunked layout.
+     * \param codec Codec for new contents, Codec::Store disables compression.
+     */
+    ContentStore(int chunkSize, const Codec& codec);
+
+    /*! \brief Address of a content.
+     *
+     * \param checksum Checksum of the content, see ContentHash.
+     * \param size Size of the content in bytes.
+     * \return Key of the content within the blob store.
+     */
+    static std::string Address(const std::string& checksum, std::size_t size);
+
+    /*! \brief Store a content for a content row.
+     *
+     * Data already present in the bucket is not written again, the row
+     * is linked to the existing blob. In the unlikely case of an address
+     * collision the data is written inline into the content row.
+     * \param connection Connection with an open transaction.
+     * \param owner Id of the content row.
+     * \param data Content to store.
+     * \param checksum Checksum of the content, see ContentHash.
+     */
+    void Store(SQLite::Connection* connection, const std::string& owner, const Access::BinaryData& data, const std::string& checksum) const;
+
+    /*! \brief Share the content of another content row.
+     *
+     * \param connection Connection with an open transaction.
+     * \param owner Id of the new content row.
+     * \param source Id of the content row to share.
+     * \return false if source holds its data inline.
+     */
+    bool Share(SQLite::Connection* connection, const std::string& owner, const std::string& source) const;
+
+    /*! \brief Check whether a content row is linked to a blob.
+     *
+     * \param connection Connection to read from.
+     * \param owner Id of the content row.
+     * \return true if the row holds a full content in the blob store.
+     */
+    bool Linked(SQLite::Connection* connection, const std::string& owner) const;
+
+    /*! \brief Compare the content of a content row with data.
+     *
+     * The stored content is compared chunk by chunk and the comparison
+     * stops at the first difference.
+     * \param connection Connection to read from.
+     * \param owner Id of the content row.
+     * \param data Content to compare with.
+     * \return true if the row is linked to a blob holding exactly data.
+     */
+    bool Equals(SQLite::Connection* connection, const std::string& owner, const Access::BinaryData& data) const;
+
+    /*! \brief Release the content of a content row.
+     *
+     * The blob is removed together with its last reference.
+     * \param connection Connection with an open transaction.
+     * \param owner Id of the content row.
+     */
+    void Release(SQLite::Connection* connection, const std::string& owner) const;
+
+    /*! \brief Load the content of a content row.
+     *
+     * \param connection Connection to read from.
+     * \param owner Id of the content row.
+     * \param target Receives the content, left untouched if the row is not linked.
+     * \return true if the row is linked to a blob.
+     */
+    bool Load(SQLite::Connection* connection, const std::string& owner, Access::BinaryData& target) const;
+
+    /*! \brief Read a byte range of a linked content.
+     *
+     * Only the overlapping chunks or the requested part of the blob are
+     * loaded and decompressed, a compressed blob which is not chunked is
+     * loaded as a whole.
+     * \param connection Connection to read from.
+     * \param owner Id of the content row.
+     * \param offset Position of the first byte to read.
+     * \param length Maximum amount of bytes to read.
+     * \return The data, clipped to the size of the content.
+     */
+    Access::BinaryData Load(SQLite::Connection* connection, const std::string& owner, int offset, int length) const;
+};
+
+} // namespace Backend
+} // namespace Archive
+
+#endif
@@ -2,6 +2,8 @@
 #include "document_schema.hxx"
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
+#include <algorithm>
+#include <stdexcept>
 
 using namespace std;
 using namespace boost;
@@ -9,6 +11,7 @@ using namespace boost::filesystem;
 using namespace Archive::Backend;
 
 DataBucket::DataBucket(int id, const SettingsProvider& settings)
+: ReaderLimit_(static_cast<size_t>(max(settings.ReaderConnections(), 1))), Stopping_(false), Running_(nullptr), PatchCodec(settings.PatchCodec(id))
 {
     auto Location = settings.DataLocation() != ":memory:"
                     ?
@@ -34,12 +37,179 @@ DataBucket::DataBucket(int id, const SettingsProvider& settings)
         Command.Execute();
     }
     
+    // a private cache reads the last committed snapshot of the log,
+    // in the shared cache a table being written locks out its readers
     Setup.ReadOnly = true;
+    Setup.SharedCache = Location == ":memory:";
+    ReadSetup_ = Setup;
 
-    Read = make_unique<SQLite::Connection>(Setup);
-    Read->Open();
+    // open the first reader right away, a broken database fails here
+    Borrow();
+
+    Writer_ = thread([this]() { WriteBatches(); });
+}
+
+DataBucket::~DataBucket()
+{
     {
-        auto Command = Read->Create("PRAGMA cell_size_check = on");
-        Command.Execute();
+        lock_guard<mutex> Lock(WritesGuard_);
+        Stopping_ = true;
+    }
+    WriteSubmitted_.notify_one();
+    Writer_.join();
+}
+
+DataBucket::ReaderLease DataBucket::Borrow()
+{
+    auto Self = this_thread::get_id();
+    if (Self == Writer_.get_id()) return ReaderLease(this, nullptr, Write.get());
+
+    unique_lock<mutex> Lock(ReadersGuard_);
+
+    for (;;) {
+        ReaderSlot* Idle = nullptr;
+        for (auto& Slot : Readers_) {
+            if (Slot->Owner == Self) {
+                ++Slot->Depth;
+                return ReaderLease(this, Slot.get(), Slot->Connection.get());
+            }
+            if (Idle == nullptr && Slot->Depth == 0) Idle = Slot.get();
+        }
+
+        if (Idle == nullptr && Readers_.size() < ReaderLimit_) {
+            auto Slot = make_unique<ReaderSlot>();
+            Slot->Connection = make_unique<SQLite::Connection>(ReadSetup_);
+            Slot->Connection->Open();
+            auto Command = Slot->Connection->Create("PRAGMA cell_size_check = on");
+            Command.Execute();
+            Slot->Depth = 0;
+            Readers_.push_back(std::move(Slot));
+            Idle = Readers_.back().get();
+        }
+
+        if (Idle != nullptr) {
+            Idle->Owner = Self;
+            Idle->Depth = 1;
+            return ReaderLease(this, Idle, Idle->Connection.get());
+        }
+
+        ReaderReleased_.wait(Lock);
+    }
+}
+
+void DataBucket::Release(ReaderSlot* slot)
+{
+    {
+        lock_guard<mutex> Lock(ReadersGuard_);
+        if (--slot->Depth > 0) return;
+        slot->Owner = thread::id();
+    }
+    ReaderReleased_.notify_one();
+}
+
+future<void> DataBucket::Submit(function<void()> mutation, function<void()> committed)
+{
+    PendingWrite Pending { std::move(mutation), vector<function<void()>>(), promise<void>() };
+    if (committed) Pending.Committed.push_back(std::move(committed));
+    auto Result = Pending.Done.get_future();
+
+    if (this_thread::get_id() == Writer_.get_id()) {
+        try {
+            // a nested mutation is committed together with the one running it
+            Pending.Mutation();
+            if (Running_) Running_->Committed.insert(Running_->Committed.end(), Pending.Committed.begin(), Pending.Committed.end());
+            else for (auto& Committed : Pending.Committed) Committed();
+            Pending.Done.set_value();
+        }
+        catch (...) {
+            Pending.Done.set_exception(current_exception());
+        }
+        return Result;
+    }
+
+    {
+        lock_guard<mutex> Lock(WritesGuard_);
+        Writes_.push_back(std::move(Pending));
+    }
+    WriteSubmitted_.notify_one();
+    return Result;
+}
+
+CommitStatistics DataBucket::CommitUsage()
+{
+    lock_guard<mutex> Lock(WritesGuard_);
+    return Statistics_;
+}
+
+void DataBucket::WriteBatches()
+{
+    unique_lock<mutex> Lock(WritesGuard_);
+    for (;;) {
+        WriteSubmitted_.wait(Lock, [this]() { return Stopping_ || Writes_.empty() == false; });
+        if (Writes_.empty()) return;
+
+        vector<PendingWrite> Batch;
+        Batch.swap(Writes_);
+        ++Statistics_.Commits;
+        Statistics_.Mutations += Batch.size();
+        Statistics_.LargestBatch = max(Statistics_.LargestBatch, Batch.size());
+
+        Lock.unlock();
+        Commit(Batch);
+        Lock.lock();
+    }
+}
+
+void DataBucket::Commit(vector<PendingWrite>& batch)
+{
+    vector<exception_ptr> Errors(batch.size());
+    {
+        // maintenance outside of the writer thread still locks the connection directly
+        lock_guard<recursive_mutex> Lock(WriteGuard);
+        try {
+            auto Scope = Write->Begin();
+            for (size_t Index = 0; Index < batch.size(); ++Index) {
+                if (Write->InTransaction() == false) throw runtime_error("DataBucket::Commit - the transaction was aborted");
+                auto Step = Write->Begin();
+                Running_ = &batch[Index];
+                try {
+                    batch[Index].Mutation();
+                    Step.Commit();
+                }
+                catch (...) {
+                    Errors[Index] = current_exception();
+                }
+                Running_ = nullptr;
+            }
+            Scope.Commit();
+        }
+        catch (...) {
+            // a failed commit fails all mutations of the batch, those which failed on their own keep their error
+            for (auto& Error : Errors) {
+                if (!Error) Error = current_exception();
+            }
+        }
+    }
+
+    // state kept outside of the database only follows changes which were committed
+    for (size_t Index = 0; Index < batch.size(); ++Index) {
+        if (Errors[Index]) continue;
+        try {
+            for (auto& Committed : batch[Index].Committed) Committed();
+        }
+        catch (...) {
+            Errors[Index] = current_exception();
+        }
+    }
+
+    // a mutation may hold the last reference to its bucket, it must be gone before its caller wakes up
+    for (auto& Pending : batch) {
+        Pending.Mutation = nullptr;
+        Pending.Committed.clear();
+    }
+
+    for (size_t Index = 0; Index < batch.size(); ++Index) {
+        if (Errors[Index]) batch[Index].Done.set_exception(Errors[Index]);
+        else batch[Index].Done.set_value();
     }
 }
@@ -1,8 +1,15 @@
 #ifndef DATA_BUCKET_HXX
 #define DATA_BUCKET_HXX
 
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
+#include "codec.hxx"
 #include "sqlite.hxx"
 #include "settings_provider.hxx"
 
@@ -11,23 +18,117 @@ namespace Archive
 namespace Backend
 {
 
+/*! \brief How the mutations of a bucket were committed.
+ *
+ * Mutations submitted while a commit is running are batched into the
+ * next transaction, Commits is the number of those transactions.
+ */
+struct CommitStatistics
+{
+    std::uint64_t Commits { 0 };
+    std::uint64_t Mutations { 0 };
+    std::size_t LargestBatch { 0 };
+};
+
 class DataBucket
 {
 private:
-    std::unique_ptr<SQLite::Connection> Read;
+    struct ReaderSlot
+    {
+        std::unique_ptr<SQLite::Connection> Connection;
+        std::thread::id Owner;
+        int Depth;
+    };
+
+    struct PendingWrite
+    {
+        std::function<void()> Mutation;
+        std::vector<std::function<void()>> Committed;
+        std::promise<void> Done;
+    };
+
     std::unique_ptr<SQLite::Connection> Write;
-    
+    SQLite::Configuration ReadSetup_;
+    std::size_t ReaderLimit_;
+    std::vector<std::unique_ptr<ReaderSlot>> Readers_;
+    std::mutex ReadersGuard_;
+    std::condition_variable ReaderReleased_;
+    std::vector<PendingWrite> Writes_;
+    std::mutex WritesGuard_;
+    std::condition_variable WriteSubmitted_;
+    CommitStatistics Statistics_;
+    bool Stopping_;
+    PendingWrite* Running_;
+    std::thread Writer_;
+
+    void Release(ReaderSlot* slot);
+    void WriteBatches();
+    void Commit(std::vector<PendingWrite>& batch);
+
 public:
+    /*! \brief A reader connection checked out of the pool.
+     *
+     * The connection returns to the pool when the lease is destroyed.
+     */
+    class ReaderLease
+    {
+    friend class DataBucket;
+
+    private:
+        DataBucket* Bucket_;
+        ReaderSlot* Slot_;
+        SQLite::Connection* Connection_;
+
+        ReaderLease(DataBucket* bucket, ReaderSlot* slot, SQLite::Connection* connection) : Bucket_(bucket), Slot_(slot), Connection_(connection) { }
+
+    public:
+        ReaderLease(ReaderLease&& other) : Bucket_(other.Bucket_), Slot_(other.Slot_), Connection_(other.Connection_) { other.Slot_ = nullptr; }
+        ~ReaderLease() { if (Slot_ != nullptr) Bucket_->Release(Slot_); }
+        ReaderLease(const ReaderLease&) = delete;
+        void operator= (const ReaderLease&) = delete;
+
+        SQLite::Connection* Get() const { return Connection_; }
+        SQLite::Connection* operator-> () const { return Get(); }
+    };
+
     DataBucket(int id, const SettingsProvider& settings);
+    ~DataBucket();
     DataBucket(const DataBucket&) = delete;
     void operator= (const DataBucket&) = delete;
 
-    const SQLite::Connection& Reader() const { return *Read; }
+    /*! \brief Check out a reader connection.
+     *
+     * Up to SettingsProvider::ReaderConnections connections are opened
+     * on demand, further callers wait until one is returned. A thread
+     * holding a lease already gets the same connection again, so nested
+     * reads share one snapshot and never wait for themselves. Mutations
+     * run by Submit get the writer connection, so they see the changes
+     * of the mutations batched before them.
+     * \return The lease of the connection.
+     */
+    ReaderLease Borrow();
+
+    /*! \brief Queue a mutation for the writer thread of the bucket.
+     *
+     * The writer runs all mutations queued while it was busy in one
+     * transaction, each within a savepoint of its own, a failing one is
+     * rolled back without affecting the others. Called from a mutation,
+     * the mutation given is run right away.
+     * \param mutation Changes the database through Writing().
+     * \param committed Run on the writer thread once the changes of the
+     * mutation are committed, for state kept outside of the database.
+     * \return Future completed once the transaction is committed,
+     * receiving the exception of the mutation or of the commit.
+     */
+    std::future<void> Submit(std::function<void()> mutation, std::function<void()> committed = nullptr);
+
+    /*! \brief Snapshot of the commit counters. */
+    CommitStatistics CommitUsage();
+
     const SQLite::Connection& Writer() const { return *Write; }
-    SQLite::Connection* Reading() const { return Read.get(); }
     SQLite::Connection* Writing() const { return Write.get(); }
-    std::recursive_mutex ReadGuard;
     std::recursive_mutex WriteGuard;
+    const Codec PatchCodec;
 };
 
 } // namespace Backend
@@ -84,6 +84,58 @@ CREATE UNIQUE INDEX IF NOT EXISTS DocumentContents_IDX1 ON DocumentContents(
 );
 )",
 R"(
+CREATE TABLE IF NOT EXISTS ContentBlobs(
+    Address TEXT NOT NULL PRIMARY KEY,
+    Size INT NOT NULL,
+    RefCount INT NOT NULL,
+    Codec INT NOT NULL DEFAULT 0,
+    Data BLOB NOT NULL
+);
+)",
+R"(
+CREATE TABLE IF NOT EXISTS ContentLinks(
+    Owner TEXT NOT NULL PRIMARY KEY,
+    Address TEXT NOT NULL,
+    FOREIGN KEY(Owner) REFERENCES DocumentContents(Id) ON DELETE CASCADE DEFERRABLE INITIALLY DEFERRED,
+    FOREIGN KEY(Address) REFERENCES ContentBlobs(Address) DEFERRABLE INITIALLY DEFERRED
+);
+)",
+R"(
+CREATE INDEX IF NOT EXISTS ContentLinks_IDX1 ON ContentLinks(
+    Address
+);
+)",
+R"(
+CREATE TABLE IF NOT EXISTS ContentBases(
+    Owner TEXT NOT NULL PRIMARY KEY,
+    Base INT NOT NULL,
+    FOREIGN KEY(Owner) REFERENCES DocumentContents(Id) ON DELETE CASCADE DEFERRABLE INITIALLY DEFERRED
+);
+)",
+R"(
+CREATE TABLE IF NOT EXISTS DocumentChunks(
+    Owner TEXT NOT NULL,
+    SeqId INT NOT NULL,
+    Position INT NOT NULL,
+    Size INT NOT NULL,
+    Codec INT NOT NULL DEFAULT 0,
+    Data BLOB NOT NULL,
+    PRIMARY KEY(Owner, SeqId),
+    FOREIGN KEY(Owner) REFERENCES ContentBlobs(Address) ON DELETE CASCADE DEFERRABLE INITIALLY DEFERRED
+);
+)",
+R"(
+CREATE TRIGGER IF NOT EXISTS ContentLinks_Ins AFTER INSERT ON ContentLinks BEGIN
+  UPDATE ContentBlobs SET RefCount = RefCount + 1 WHERE Address = new.Address;
+END;
+)",
+R"(
+CREATE TRIGGER IF NOT EXISTS ContentLinks_Del AFTER DELETE ON ContentLinks BEGIN
+  UPDATE ContentBlobs SET RefCount = RefCount - 1 WHERE Address = old.Address;
+  DELETE FROM ContentBlobs WHERE Address = old.Address AND RefCount <= 0;
+END;
+)",
+R"(
 CREATE VIRTUAL TABLE IF NOT EXISTS DocumentMetas USING fts5(
     Owner UNINDEXED,
     Tags
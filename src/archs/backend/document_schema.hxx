@@ -229,7 +229,7 @@ protected:
         item.History = data.Get<std::string>("Owner");
         item.Revision = data.Get<int>("SeqId");
         item.Checksum = data.Get<std::string>("Checksum");
-        item.Content = data.GetBlob("data");
+        data.GetBlob("data", item.Content);
     }
     
     void Serialize(const SQLite::ParameterSet& target, const Access::DocumentContent& item) const override
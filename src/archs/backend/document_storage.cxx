@@ -1,4 +1,5 @@
 #include "binary_data.hxx"
+#include "content_hash.hxx"
 #include "document_storage.hxx"
 #include "document_schema.hxx"
 #include "transformer.hxx"
@@ -14,8 +15,11 @@
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
+#include <chrono>
 #include <future>
+#include <map>
 #include <mutex>
+#include <thread>
 
 using namespace std;
 using namespace Archive::Backend;
@@ -27,6 +31,22 @@ using namespace boost::gregorian;
 namespace
 {
 
+const char* LatestContentQuery =
+R"(SELECT
+    %1%
+FROM
+    DocumentContents cnt
+INNER JOIN
+    DocumentHistories hst
+ON
+    cnt.Owner = hst.Id
+AND
+    hst.SeqId = (SELECT MAX(SeqId) FROM DocumentHistories hin WHERE hin.Owner = hst.Owner AND EXISTS(SELECT 1 FROM DocumentContents nst WHERE nst.Owner = hin.Id))
+WHERE
+    hst.Owner = :Owner
+AND
+    cnt.Owner = hst.Id)";
+
 string AliasFields(const vector<string>& fields, const string alias)
 {
     vector<string> Result;
@@ -54,12 +74,39 @@ void FillHeaderFromRow(Access::DocumentDataPtr& target, const SQLite::ResultRow&
     target->Revision = source.Get<int>(12);
 }
 
+/* Content of the first revision of a chain, the patches are applied from the full content backwards */
+Access::BinaryData Rebuild(vector<Access::DocumentContentPtr>& chain)
+{
+    Access::BinaryData Content = std::move(chain.back()->Content), Next;
+    for (auto Item = chain.rbegin() + 1; Item != chain.rend(); ++Item) {
+        BinaryData::ApplyPatch(Content, (*Item)->Content, Next);
+        Content.swap(Next);
+    }
+    return Content;
+}
+
+/* Folders of a document, collected by a mutation and updated in the tree once it is committed */
+struct DocumentFolders
+{
+    vector<string> Paths;
+    bool Directory = false;
+};
+
+/* Position of a revision in the patch chain of a document */
+struct StoredRevision
+{
+    string Id;
+    int SeqId;
+    int Base;
+    bool Full;
+};
+
 } // anonymous namespace
 
 using Guard = lock_guard<recursive_mutex>;
 
 DocumentStorage::DocumentStorage(const SettingsProvider& settings)
-: Settings_(settings), Timer_(hours(3), boost::bind(&DocumentStorage::Optimizer, this))
+: Settings_(settings), Executor_(settings.QueryWorkers() > 0 ? settings.QueryWorkers() : thread::hardware_concurrency()), Timer_(hours(3), boost::bind(&DocumentStorage::Optimizer, this)), Contents_(settings.ContentChunkSize(), settings.ContentCodec())
 {
     InitializeBuckets();
     auto& Builder = async(launch::async, [this]() { BuildFolderTree(); });
@@ -70,6 +117,9 @@ DocumentStorage::DocumentStorage(const SettingsProvider& settings)
 
 DocumentStorage::~DocumentStorage()
 {
+    // reads and mutations still queued by the asynchronous operations use the members
+    Executor_.Wait();
+    for (auto& Handle : DistinctHandles_) Handle->Submit([]() {}).wait();
     for (auto& Bucket : Buckets_) Bucket.reset();
 }
 
@@ -100,14 +150,14 @@ INNER JOIN
 ON
     asg.Owner = hst.Id AND asg.SeqId = hst.SeqId
 WHERE
-    hst.Owner = '%1%'
+    hst.Owner = :Owner
 )";
-    auto Query = (format(QueryTemplate) % id).str();
     auto& Handle = FetchBucket(id);
     
-    Guard Lock(Handle->ReadGuard);
+    auto Reader = Handle->Borrow();
     
-    auto& Command = Handle->Reader().Create(Query);
+    auto& Command = Reader->Create(QueryTemplate);
+    Command.Parameters()["Owner"].SetValue(id);
     auto& Data = Command.Open();
     
     vector<string> Result;
@@ -123,115 +173,130 @@ Access::DocumentDataPtr DocumentStorage::Load(const string& id, const string& us
 }
 
 void DocumentStorage::AssignKeywords(const string& id, const string& keywords, const string& user) const
+{
+    AssignKeywordsAsync(id, keywords, user).get();
+}
+
+future<void> DocumentStorage::AssignKeywordsAsync(const string& id, const string& keywords, const string& user) const
 {
     ReadOnlyDenied(user);
     
     auto Handle = FetchBucket(id);
-    Guard Lock(Handle->WriteGuard);
+    return Handle->Submit([=]() {
+        Access::DocumentDataPtr Document = FetchChecked(Handle, id, user);
     
-    Access::DocumentDataPtr Document = FetchChecked(Handle, id, user);
-    
-    TransformerQueue Actions(Handle->Writing());
+        TransformerQueue Actions(Handle->Writing());
     
-    Document->Keywords = keywords;
-    Actions.Update(*Document);
+        Document->Keywords = keywords;
+        Actions.Update(*Document);
     
-    Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
-    History->Id = Utils::NewId();
-    History->Action = Access::Keywords;
-    History->Actor = user;
-    History->Created = Utils::Ticks(microsec_clock::local_time());
-    History->Document = id;
-    History->Revision = LatestRevision(Handle->Writing(), id) + 1;
-    Actions.Insert(*History);
+        Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
+        History->Id = Utils::NewId();
+        History->Action = Access::Keywords;
+        History->Actor = user;
+        History->Created = Utils::Ticks(microsec_clock::local_time());
+        History->Document = id;
+        History->Revision = LatestRevision(Handle->Writing(), id) + 1;
+        Actions.Insert(*History);
     
-    Actions.Flush();
+        Actions.Flush();
+    });
 }
 
 void DocumentStorage::AssignMetaData(const string& id, const string& data, const string& user) const
+{
+    AssignMetaDataAsync(id, data, user).get();
+}
+
+future<void> DocumentStorage::AssignMetaDataAsync(const string& id, const string& data, const string& user) const
 {
     ReadOnlyDenied(user);
     
     auto Handle = FetchBucket(id);
-    Guard Lock(Handle->WriteGuard);
-    
-    auto Tokens = Utils::Split(data, 30);
-    if (Tokens.empty()) throw invalid_argument("unable to parse meta tags");
+    return Handle->Submit([=]() {
+        auto Tokens = Utils::Split(data, 30);
+        if (Tokens.empty()) throw invalid_argument("unable to parse meta tags");
+    
+        vector<string> Metas;
+        transform(
+            Tokens.begin(),
+            Tokens.end(),
+            back_inserter(Metas),
+            [](const string& token) {
+                auto Parts = Utils::Split(token, '=');
+                return Parts.size() == 2 ? Parts[0] : string();
+            }
+        );
     
-    vector<string> Metas;
-    transform(
-        Tokens.begin(),
-        Tokens.end(),
-        back_inserter(Metas),
-        [](const string& token) {
-            auto Parts = Utils::Split(token, '=');
-            return Parts.size() == 2 ? Parts[0] : string();
+        auto Transaction = Handle->Writing()->Begin();
+        {
+            auto Command = Handle->Writing()->Create("INSERT INTO DocumentMetas(Owner, Tags)VALUES(:Owner, :Tags)");
+            Command.Parameters()["Owner"].SetValue(id);
+            Command.Parameters()["Tags"].SetValue(data);
+            Command.Execute();
         }
-    );
-    
-    auto Transaction = Handle->Writing()->Begin();
-    {
-        auto Command = Handle->Writing()->Create("INSERT INTO DocumentMetas(Owner, Tags)VALUES(:Owner, :Tags)");
-        Command.Parameters()["Owner"].SetValue(id);
-        Command.Parameters()["Tags"].SetValue(data);
-        Command.Execute();
-    }
-    {
-        auto Command = Handle->Writing()->Create("REPLACE INTO DocumentTags(Tag)VALUES(:Tag)");
+        {
+            auto Command = Handle->Writing()->Create("REPLACE INTO DocumentTags(Tag)VALUES(:Tag)");
         
-        for (auto& Meta : Metas) {
-            if (Meta.empty() == false) {
-                Command.Parameters()["Tag"].SetValue(Meta);
-                Command.Execute();
+            for (auto& Meta : Metas) {
+                if (Meta.empty() == false) {
+                    Command.Parameters()["Tag"].SetValue(Meta);
+                    Command.Execute();
+                }
             }
         }
-    }
-    Transaction.Commit();
+        Transaction.Commit();
+    });
 }
 
 void DocumentStorage::ReplaceMetaData(const string& id, const string& data, const string& user) const
+{
+    ReplaceMetaDataAsync(id, data, user).get();
+}
+
+future<void> DocumentStorage::ReplaceMetaDataAsync(const string& id, const string& data, const string& user) const
 {
     ReadOnlyDenied(user);
     
     auto Handle = FetchBucket(id);
-    Guard Lock(Handle->WriteGuard);
-    
-    auto Tokens = Utils::Split(data, 30);
+    return Handle->Submit([=]() {
+        auto Tokens = Utils::Split(data, 30);
+    
+        vector<string> Metas;
+        transform(
+            Tokens.begin(),
+            Tokens.end(),
+            back_inserter(Metas),
+            [](const string& token) {
+                auto Parts = Utils::Split(token, '=');
+                return Parts.size() == 2 ? Parts[0] : string();
+            }
+        );
     
-    vector<string> Metas;
-    transform(
-        Tokens.begin(),
-        Tokens.end(),
-        back_inserter(Metas),
-        [](const string& token) {
-            auto Parts = Utils::Split(token, '=');
-            return Parts.size() == 2 ? Parts[0] : string();
+        auto Transaction = Handle->Writing()->Begin();
+        {
+            auto Command = Handle->Writing()->Create("DELETE FROM DocumentMetas WHERE Owner = :Owner");
+            Command.Parameters()["Owner"].SetValue(id);
+            Command.Execute();
         }
-    );
-    
-    auto Transaction = Handle->Writing()->Begin();
-    {
-        auto Command = Handle->Writing()->Create("DELETE FROM DocumentMetas WHERE Owner = :Owner");
-        Command.Parameters()["Owner"].SetValue(id);
-        Command.Execute();
-    }
-    if (data.empty() == false) {
-        auto Command = Handle->Writing()->Create("INSERT INTO DocumentMetas(Owner, Tags)VALUES(:Owner, :Tags)");
-        Command.Parameters()["Owner"].SetValue(id);
-        Command.Parameters()["Tags"].SetValue(data);
-        Command.Execute();
-    }
-    if (Metas.empty() == false) {
-        auto Command = Handle->Writing()->Create("REPLACE INTO DocumentTags(Tag)VALUES(:Tag)");
+        if (data.empty() == false) {
+            auto Command = Handle->Writing()->Create("INSERT INTO DocumentMetas(Owner, Tags)VALUES(:Owner, :Tags)");
+            Command.Parameters()["Owner"].SetValue(id);
+            Command.Parameters()["Tags"].SetValue(data);
+            Command.Execute();
+        }
+        if (Metas.empty() == false) {
+            auto Command = Handle->Writing()->Create("REPLACE INTO DocumentTags(Tag)VALUES(:Tag)");
         
-        for (auto& Meta : Metas) {
-            if (Meta.empty() == false) {
-                Command.Parameters()["Tag"].SetValue(Meta);
-                Command.Execute();
+            for (auto& Meta : Metas) {
+                if (Meta.empty() == false) {
+                    Command.Parameters()["Tag"].SetValue(Meta);
+                    Command.Execute();
+                }
             }
         }
-    }
-    Transaction.Commit();
+        Transaction.Commit();
+    });
 }
 
 vector<string> DocumentStorage::ListMetaTags() const
@@ -240,13 +305,15 @@ vector<string> DocumentStorage::ListMetaTags() const
 
     vector<future<vector<string>>> Intermediates;
     
-    for (auto& Handle : DistinctHandles_) {
+    for (size_t Index = 0; Index < DistinctHandles_.size(); ++Index) {
+        auto& Handle = DistinctHandles_[Index];
         Intermediates.push_back(
-            async(
+            Executor_.Submit(
+                Index,
                 [&Handle, &Query]() {
                     vector<string> Result;
-                    lock_guard<recursive_mutex> Lock(Handle->ReadGuard);
-                    auto& Command = Handle->Reader().Create(Query);
+                    auto Reader = Handle->Borrow();
+                    auto& Command = Reader->Create(Query);
                     
                     for (auto& Row : Command.Open()) {
                         Result.push_back(Row.Get<string>(0));
@@ -271,12 +338,13 @@ vector<string> DocumentStorage::ListMetaTags() const
 vector<string> DocumentStorage::ListMetaTags(const string& id) const
 {
     auto Handle = FetchBucket(id);
-    Guard Lock(Handle->ReadGuard);
+    auto Reader = Handle->Borrow();
     
-    const string Query = "SELECT Tag FROM DocumentTags WHERE Owner = '" + id + "'";
+    const string Query = "SELECT Tag FROM DocumentTags WHERE Owner = :Owner";
     
     vector<string> Result;
-    auto& Command = Handle->Reader().Create(Query);
+    auto& Command = Reader->Create(Query);
+    Command.Parameters()["Owner"].SetValue(id);
     
     for (auto& Row : Command.Open()) {
         Result.push_back(Row.Get<string>(0));
@@ -299,7 +367,7 @@ INNER JOIN
 INNER JOIN
     DocumentHistories hsv ON hsv.SeqId = (SELECT MAX(hsi.SeqId) FROM DocumentHistories hsi WHERE hsi.Owner = doc.Id) AND hsv.Owner = doc.Id
 WHERE
-    doc.Id = '%1%' AND doc.State = 0
+    doc.Id = :Id AND doc.State = 0
 )";
 
     const string QueryRevisionTemplate =
@@ -314,18 +382,19 @@ INNER JOIN
 INNER JOIN
     Documents doc ON hst.Owner = doc.Id
 WHERE
-    doc.Id = '%1%' AND doc.State = 0
+    doc.Id = :Id AND doc.State = 0
 AND
-    hst.SeqId = %2%
+    hst.SeqId = :SeqId
 )";
 
-    auto Query = number == 0 ? (format(QueryTemplate) % id).str() : (format(QueryRevisionTemplate) % id % number).str();
     auto& Handle = FetchBucket(id);
     
-    Guard Lock(Handle->ReadGuard);
+    auto Reader = Handle->Borrow();
     
     Access::DocumentDataPtr Result = new Access::DocumentData();
-    auto& Command = Handle->Reader().Create(Query);
+    auto& Command = Reader->Create(number == 0 ? QueryTemplate : QueryRevisionTemplate);
+    Command.Parameters()["Id"].SetValue(id);
+    if (number != 0) Command.Parameters()["SeqId"].SetValue(number);
     auto& Data = Command.Open();
     
     if (Data.HasData()) {
@@ -350,19 +419,24 @@ INNER JOIN
 INNER JOIN
     DocumentHistories hsv ON hsv.SeqId = (SELECT MAX(hsi.SeqId) FROM DocumentHistories hsi WHERE hsi.Owner = doc.Id) AND hsv.Owner = doc.Id
 WHERE
-    asg.Path = '%1%' AND doc.FileName = '%2%' AND doc.State = 0
+    asg.Path = :Path AND doc.FileName = :FileName AND doc.State = 0
 )";
     
-    auto Query = (format(QueryTemplate) % boost::algorithm::to_lower_copy(folderPath) % boost::algorithm::to_lower_copy(fileName)).str();
+    auto Path = boost::algorithm::to_lower_copy(folderPath);
+    auto FileName = boost::algorithm::to_lower_copy(fileName);
     vector<future<Access::DocumentDataPtr>> Intermediate;
     vector<Access::DocumentDataPtr> Result;
     
-    for (auto& Handle : DistinctHandles_) {
+    for (size_t Index = 0; Index < DistinctHandles_.size(); ++Index) {
+        auto& Handle = DistinctHandles_[Index];
         Intermediate.push_back(
-            async(
-                [&Handle, &Query]() {
-                    lock_guard<recursive_mutex> Lock(Handle->ReadGuard);
-                    auto& Command = Handle->Reader().Create(Query);
+            Executor_.Submit(
+                Index,
+                [&Handle, &QueryTemplate, &Path, &FileName]() {
+                    auto Reader = Handle->Borrow();
+                    auto& Command = Reader->Create(QueryTemplate);
+                    Command.Parameters()["Path"].SetValue(Path);
+                    Command.Parameters()["FileName"].SetValue(FileName);
                     Access::DocumentDataPtr Item;
                     for (auto& Row : Command.Open()) {
                         Item = new Access::DocumentData();
@@ -378,7 +452,7 @@ WHERE
     
     for (auto& Found : Intermediate) {
         auto Item = Found.get();
-        if (Item->Id.empty()) continue;
+        if (!Item || Item->Id.empty()) continue;
         
         Result.push_back(Item);
     }
@@ -400,11 +474,15 @@ INNER JOIN
 INNER JOIN
     DocumentHistories hsv ON hsv.SeqId = (SELECT MAX(hsi.SeqId) FROM DocumentHistories hsi WHERE hsi.Owner = doc.Id) AND hsv.Owner = doc.Id
 WHERE
-    asg.Path = '%1%' AND lower(doc.DisplayName) = '%2%' AND doc.State = 0
+    asg.Path = :Path AND lower(doc.DisplayName) = :Display AND doc.State = 0
 )";
-    auto Query = (format(QueryTemplate) % algorithm::to_lower_copy(folderPath) % boost::algorithm::to_lower_copy(displayName)).str();
+    auto Path = algorithm::to_lower_copy(folderPath);
+    auto Display = algorithm::to_lower_copy(displayName);
     
-    return FetchFromAll(Query);
+    return FetchFromAll(QueryTemplate, [&Path, &Display](const SQLite::ParameterSet& parameters) {
+        parameters["Path"].SetValue(Path);
+        parameters["Display"].SetValue(Display);
+    });
 }
 
 vector<Access::DocumentDataPtr> DocumentStorage::FindKeywords(const string& keywords) const
@@ -425,11 +503,13 @@ WHERE
 )";
     auto Values = Utils::Split(keywords, ' ');
     vector<string> Parts;
-    transform(Values.begin(), Values.end(), back_inserter(Parts), [](const string& word) { return "doc.Keywords LIKE '%" + word + "%'"; });
+    for (size_t Index = 0; Index < Values.size(); ++Index) Parts.push_back((format("doc.Keywords LIKE '%%' || :Word%1% || '%%'") % Index).str());
     auto Restrict = join(Parts, " OR ");
     auto Query = (format(QueryTemplate) % Restrict).str();
     
-    return FetchFromAll(Query);
+    return FetchFromAll(Query, [&Values](const SQLite::ParameterSet& parameters) {
+        for (size_t Index = 0; Index < Values.size(); ++Index) parameters["Word" + to_string(Index)].SetValue(Values[Index]);
+    });
 }
 
 vector<Access::DocumentDataPtr> DocumentStorage::FindMetaData(const string& tags) const
@@ -448,15 +528,16 @@ INNER JOIN
 INNER JOIN 
     DocumentMetas ON DocumentMetas.Owner = doc.Id
 WHERE
-    DocumentMetas MATCH '%1%' AND doc.State = 0
+    DocumentMetas MATCH :Tags AND doc.State = 0
 )";
     auto Values = Utils::Split(tags, 30);
     vector<string> Parts;
     transform(Values.begin(), Values.end(), back_inserter(Parts), [](const string& word) { return "\"" + word + "\"*"; });
     auto Restrict = join(Parts, " AND ");
-    auto Query = (format(QueryTemplate) % Restrict).str();
     
-    return FetchFromAll(Query);
+    return FetchFromAll(QueryTemplate, [&Restrict](const SQLite::ParameterSet& parameters) {
+        parameters["Tags"].SetValue(Restrict);
+    });
 }
 
 vector<Access::DocumentDataPtr> DocumentStorage::FindFilenames(const string& names) const
@@ -477,11 +558,13 @@ WHERE
 )";
     auto Values = Utils::Split(names, ' ');
     vector<string> Parts;
-    transform(Values.begin(), Values.end(), back_inserter(Parts), [](const string& word) { return "doc.FileName LIKE '%" + word + "%'"; });
+    for (size_t Index = 0; Index < Values.size(); ++Index) Parts.push_back((format("doc.FileName LIKE '%%' || :Name%1% || '%%'") % Index).str());
     auto Restrict = join(Parts, " OR ");
     auto Query = (format(QueryTemplate) % Restrict).str();
     
-    return FetchFromAll(Query);
+    return FetchFromAll(Query, [&Values](const SQLite::ParameterSet& parameters) {
+        for (size_t Index = 0; Index < Values.size(); ++Index) parameters["Name" + to_string(Index)].SetValue(Values[Index]);
+    });
 }
 
 vector<Access::DocumentDataPtr> DocumentStorage::FindFilenameMatch(const string& expression) const
@@ -498,11 +581,12 @@ INNER JOIN
 INNER JOIN
     DocumentHistories hsv ON hsv.SeqId = (SELECT MAX(hsi.SeqId) FROM DocumentHistories hsi WHERE hsi.Owner = doc.Id) AND hsv.Owner = doc.Id
 WHERE
-    (FileName REGEXP '%1%') AND doc.State = 0
+    (FileName REGEXP :Expression) AND doc.State = 0
 )";
-    auto Query = (format(QueryTemplate) % expression).str();
     
-    return FetchFromAll(Query);
+    return FetchFromAll(QueryTemplate, [&expression](const SQLite::ParameterSet& parameters) {
+        parameters["Expression"].SetValue(expression);
+    });
 }
 
 vector<Access::DocumentDataPtr> DocumentStorage::FindDeleted(const string& root, int depth) const
@@ -519,412 +603,858 @@ INNER JOIN
 INNER JOIN
     DocumentHistories hsv ON hsv.SeqId = (SELECT MAX(hsi.SeqId) FROM DocumentHistories hsi WHERE hsi.Owner = doc.Id) AND hsv.Owner = doc.Id
 WHERE
-    asg.Path LIKE lower('%1%%%')
+    asg.Path LIKE lower(:Root) || '%'
 AND
     doc.State = 1
 AND
-    PARTSCOUNT(asg.Path, '/') - %2% <= %3%
+    PARTSCOUNT(asg.Path, '/') - :Difference <= :Depth
 )";
-    auto Difference = depth == LONG_MAX ? 0 : Utils::Split(root, '/').size();
-    auto Query = (format(QueryTemplate) % root % Difference % depth).str();
+    auto Difference = depth == LONG_MAX ? 0 : (int)Utils::Split(root, '/').size();
     
-    return FetchFromAll(Query);
+    return FetchFromAll(QueryTemplate, [&root, Difference, depth](const SQLite::ParameterSet& parameters) {
+        parameters["Root"].SetValue(root);
+        parameters["Difference"].SetValue(Difference);
+        parameters["Depth"].SetValue(depth);
+    });
 }
 
 void DocumentStorage::Save(const Access::DocumentDataPtr& document, const Access::BinaryData& data, const string& user, const string& comment)
+{
+    // the caller waits for the writer, so the content is not copied
+    Store(document, std::shared_ptr<const Access::BinaryData>(&data, [](const Access::BinaryData*) {}), user, comment).get();
+}
+
+future<void> DocumentStorage::SaveAsync(const Access::DocumentDataPtr& document, Access::BinaryData data, const string& user, const string& comment)
+{
+    return Store(document, std::make_shared<const Access::BinaryData>(std::move(data)), user, comment);
+}
+
+void DocumentStorage::SaveMany(const vector<BulkDocument>& documents, const string& user, const string& comment)
+{
+    vector<const BulkDocument*> Known;
+    vector<vector<const BulkDocument*>> Groups(DistinctHandles_.size());
+    for (auto& Item : documents) {
+        auto& Document = Item.first;
+        if (Document->Id.empty() == false) {
+            Known.push_back(&Item);
+            continue;
+        }
+        Document->Id = Utils::NewId();
+        Document->Creator = user;
+        Document->User = user;
+        Document->Size = Item.second.size();
+        Groups[BucketIndex(FetchBucket(Document->Id))].push_back(&Item);
+    }
+
+    // the contents are hashed by the query workers, the writer of each bucket inserts its group
+    vector<future<vector<string>>> Hashes;
+    for (size_t Index = 0; Index < Groups.size(); ++Index) {
+        Hashes.push_back(
+            Executor_.Submit(
+                Index,
+                [&Groups, Index]() {
+                    vector<string> Checksums;
+                    for (auto Item : Groups[Index]) Checksums.push_back(ContentHash::Compute(Item->second));
+                    return Checksums;
+                }
+            )
+        );
+    }
+
+    for (auto& Hash : Hashes) Hash.wait();
+    vector<vector<string>> Checksums;
+    for (auto& Hash : Hashes) Checksums.push_back(Hash.get());
+
+    // a group is split into batches of limited size, the writer commits the queued batches together
+    struct Batch { size_t Group; size_t First; size_t Last; future<void> Done; };
+    auto Size = static_cast<size_t>(max(Settings_.BulkBatchSize(), 1));
+    vector<Batch> Inserts;
+    for (size_t Index = 0; Index < Groups.size(); ++Index) {
+        auto& Handle = DistinctHandles_[Index];
+        for (size_t First = 0; First < Groups[Index].size(); First += Size) {
+            auto Last = min(First + Size, Groups[Index].size());
+            Inserts.push_back({ Index, First, Last, Handle->Submit([this, &Handle, &Groups, &Checksums, &comment, Index, First, Last]() {
+                TransformerQueue Actions(Handle->Writing());
+                vector<Common::PersistablePtr> Rows;
+                for (size_t Position = First; Position < Last; ++Position) {
+                    auto& Content = Groups[Index][Position]->second;
+                    auto& Checksum = Checksums[Index][Position];
+                    QueueInsert(Actions, Rows, Groups[Index][Position]->first, comment, Checksum, [this, &Content, &Checksum](SQLite::Connection* connection, const string& owner) {
+                        Contents_.Store(connection, owner, Content, Checksum);
+                    });
+                }
+                Actions.Flush();
+            }) });
+        }
+    }
+
+    // the first error is passed on after all are done
+    exception_ptr Error;
+    vector<future<void>> Updates;
+    for (auto Item : Known) {
+        try {
+            Updates.push_back(Store(Item->first, std::shared_ptr<const Access::BinaryData>(&Item->second, [](const Access::BinaryData*) {}), user, comment));
+        }
+        catch (...) {
+            if (Error == nullptr) Error = current_exception();
+        }
+    }
+
+    // the folder tree counts the stored batches only
+    map<string, int> Counted, Uncounted;
+    for (auto& Insert : Inserts) {
+        try {
+            Insert.Done.get();
+            for (auto Position = Insert.First; Position < Insert.Last; ++Position) {
+                auto& Document = Groups[Insert.Group][Position]->first;
+                ++(Document->Name != Access::DocumentDirectoryName ? Counted : Uncounted)[Document->FolderPath];
+            }
+        }
+        catch (...) {
+            if (Error == nullptr) Error = current_exception();
+        }
+    }
+    Folders_.Add(Counted, Uncounted);
+
+    for (auto& Update : Updates) {
+        try {
+            Update.get();
+        }
+        catch (...) {
+            if (Error == nullptr) Error = current_exception();
+        }
+    }
+    if (Error) rethrow_exception(Error);
+}
+
+future<void> DocumentStorage::Store(const Access::DocumentDataPtr& document, const std::shared_ptr<const Access::BinaryData>& data, const string& user, const string& comment) const
 {
     if (document->Id.empty()) {
         document->Creator = user;
         document->User = user;
-        InsertIntoDatabase(document, data, comment);
+        return InsertIntoDatabase(document, data, comment);
     }
     else {
-        UpdateInDatabase(document, data, user, comment);
+        return UpdateInDatabase(document, data, user, comment);
     }
 }
 
 void DocumentStorage::Lock(const string& id, const string& user) const
+{
+    LockAsync(id, user).get();
+}
+
+future<void> DocumentStorage::LockAsync(const string& id, const string& user) const
 {
     ReadOnlyDenied(user);
     
     auto Handle = FetchBucket(id);
-    Guard Lock(Handle->WriteGuard);
-    
-    Access::DocumentDataPtr Document = FetchChecked(Handle, id, user);
-    if (Document->Locker.empty() == false && Document->Locker != user) throw Access::LockError((format("document %1% is already locked by %2%") % Document->Display % Document->Locker).str());
+    return Handle->Submit([=]() {
+        Access::DocumentDataPtr Document = FetchChecked(Handle, id, user);
+        if (Document->Locker.empty() == false && Document->Locker != user) throw Access::LockError((format("document %1% is already locked by %2%") % Document->Display % Document->Locker).str());
     
-    TransformerQueue Actions(Handle->Writing());
-    Document->Locker = user;
-    Actions.Update(*Document);
-    Actions.Flush();
+        TransformerQueue Actions(Handle->Writing());
+        Document->Locker = user;
+        Actions.Update(*Document);
+        Actions.Flush();
+    });
 }
 
 void DocumentStorage::Unlock(const string& id, const string& user) const
+{
+    UnlockAsync(id, user).get();
+}
+
+future<void> DocumentStorage::UnlockAsync(const string& id, const string& user) const
 {
     ReadOnlyDenied(user);
     
     auto Handle = FetchBucket(id);
-    Guard Lock(Handle->WriteGuard);
-    
-    Access::DocumentDataPtr Document = FetchChecked(Handle, id, user);
+    return Handle->Submit([=]() {
+        Access::DocumentDataPtr Document = FetchChecked(Handle, id, user);
     
-    TransformerQueue Actions(Handle->Writing());
-    Document->Locker = "";
-    Actions.Update(*Document);
-    Actions.Flush();
+        TransformerQueue Actions(Handle->Writing());
+        Document->Locker = "";
+        Actions.Update(*Document);
+        Actions.Flush();
+    });
 }
 
 void DocumentStorage::Move(const string& id, const string& oldPath, const string& newPath, const string& user) const
+{
+    MoveAsync(id, oldPath, newPath, user).get();
+}
+
+future<void> DocumentStorage::MoveAsync(const string& id, const string& oldPath, const string& newPath, const string& user) const
 {
     ReadOnlyDenied(user);
     auto Handle = FetchBucket(id);
-    Guard Lock(Handle->WriteGuard);
-
-    Access::DocumentAssignmentPtr Assignment = Fetch(Handle->Writing(), id, oldPath);
-
-    auto& FolderInfo = async(launch::async, [this, &newPath, &oldPath]() {
-         Folders_.Add(newPath);
-         Folders_.Remove(oldPath);
-    });
-    
-    TransformerQueue Actions(Handle->Writing());
+    return Handle->Submit([=]() {
+        Access::DocumentAssignmentPtr Assignment = Fetch(Handle->Writing(), id, oldPath);
     
-    Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
-    History->Id = Utils::NewId();
-    History->Action = Access::Moved;
-    History->Actor = user;
-    History->Created = Utils::Ticks(microsec_clock::local_time());
-    History->Document = id;
-    History->Revision = LatestRevision(Handle->Writing(), id) + 1;
-    History->Source = oldPath;
-    History->Target = newPath;
-    Actions.Insert(*History);
+        TransformerQueue Actions(Handle->Writing());
     
-    Assignment->Path = newPath;
-    Actions.Update(*Assignment);
+        Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
+        History->Id = Utils::NewId();
+        History->Action = Access::Moved;
+        History->Actor = user;
+        History->Created = Utils::Ticks(microsec_clock::local_time());
+        History->Document = id;
+        History->Revision = LatestRevision(Handle->Writing(), id) + 1;
+        History->Source = oldPath;
+        History->Target = newPath;
+        Actions.Insert(*History);
     
-    Actions.Flush();
+        Assignment->Path = newPath;
+        Actions.Update(*Assignment);
     
-    FolderInfo.wait();
+        Actions.Flush();
+    }, [this, newPath, oldPath]() {
+        Folders_.Add(newPath);
+        Folders_.Remove(oldPath);
+    });
 }
 
 void DocumentStorage::Link(const string& id, const string& sourcePath, const string& targetPath, const string& user) const
+{
+    LinkAsync(id, sourcePath, targetPath, user).get();
+}
+
+future<void> DocumentStorage::LinkAsync(const string& id, const string& sourcePath, const string& targetPath, const string& user) const
 {
     ReadOnlyDenied(user);
     auto Handle = FetchBucket(id);
-    Guard Lock(Handle->WriteGuard);
-    
-    Access::DocumentAssignmentPtr Assignment = Fetch(Handle->Writing(), id, sourcePath);
-    auto Item = Fetch(Handle, id);
-
-    auto& FolderInfo = async(launch::async, [this, &targetPath]() {
-         Folders_.Add(targetPath);
-    });
+    return Handle->Submit([=]() {
+        Access::DocumentAssignmentPtr Assignment = Fetch(Handle->Writing(), id, sourcePath);
+        auto Item = Fetch(Handle, id);
     
-    TransformerQueue Actions(Handle->Writing());
-    
-    Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
-    History->Id = Utils::NewId();
-    History->Action = Access::Linked;
-    History->Actor = user;
-    History->Created = Utils::Ticks(microsec_clock::local_time());
-    History->Document = id;
-    History->Revision = LatestRevision(Handle->Writing(), id) + 1;
-    History->Source = sourcePath;
-    History->Target = targetPath;
-    Actions.Insert(*History);
+        TransformerQueue Actions(Handle->Writing());
     
-    Access::DocumentAssignmentPtr NewAssignment = new Access::DocumentAssignment();
-    NewAssignment->History = History->Id;
-    NewAssignment->Id = Utils::NewId();
-    NewAssignment->Path = targetPath;
-    NewAssignment->AssignmentId = Assignment->AssignmentId;
-    NewAssignment->AssignmentType = Assignment->AssignmentType;
-    NewAssignment->Revision = History->Revision;
-    Actions.Insert(*NewAssignment);
+        Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
+        History->Id = Utils::NewId();
+        History->Action = Access::Linked;
+        History->Actor = user;
+        History->Created = Utils::Ticks(microsec_clock::local_time());
+        History->Document = id;
+        History->Revision = LatestRevision(Handle->Writing(), id) + 1;
+        History->Source = sourcePath;
+        History->Target = targetPath;
+        Actions.Insert(*History);
     
-    Actions.Flush();
+        Access::DocumentAssignmentPtr NewAssignment = new Access::DocumentAssignment();
+        NewAssignment->History = History->Id;
+        NewAssignment->Id = Utils::NewId();
+        NewAssignment->Path = targetPath;
+        NewAssignment->AssignmentId = Assignment->AssignmentId;
+        NewAssignment->AssignmentType = Assignment->AssignmentType;
+        NewAssignment->Revision = History->Revision;
+        Actions.Insert(*NewAssignment);
     
-    FolderInfo.wait();
+        Actions.Flush();
+    }, [this, targetPath]() {
+        Folders_.Add(targetPath);
+    });
 }
 
 void DocumentStorage::Copy(const string& id, const string& sourcePath, const string& targetPath, const string& user) const
+{
+    CopyAsync(id, sourcePath, targetPath, user).get();
+}
+
+future<void> DocumentStorage::CopyAsync(const string& id, const string& sourcePath, const string& targetPath, const string& user) const
 {
     ReadOnlyDenied(user);
     auto Handle = FetchBucket(id);
-    Guard Lock(Handle->WriteGuard);
-    
-    Access::DocumentAssignmentPtr Assignment = Fetch(Handle->Writing(), id, sourcePath);
-    auto Item = Fetch(Handle, id);
 
-    auto& FolderInfo = async(launch::async, [this, &targetPath]() {
-         Folders_.Add(targetPath);
-    });
-    
+    // the clone may belong to another bucket, reading the source must not wait for this bucket's writer
+    Access::DocumentDataPtr Item;
+    Access::DocumentContentPtr Source;
+    auto Data = std::make_shared<Access::BinaryData>();
+    {
+        auto Reader = Handle->Borrow();
+        auto Snapshot = Reader->Begin();
+        Fetch(Reader.Get(), id, sourcePath);
+        Item = Fetch(Handle, id);
+        Source = LatestContentHeader(Reader.Get(), Item->Id);
+        if (Source->Checksum.empty()) {
+            *Data = LatestContent(Reader.Get(), Item->Id)->Content;
+            Source->Checksum = ContentHash::Compute(*Data);
+        }
+    }
+
     Access::DocumentDataPtr Clone = new Access::DocumentData(*Item);
     Clone->FolderPath = targetPath;
-    InsertIntoDatabase(Clone, LatestContent(Handle->Writing(), Item->Id)->Content, "");
-    
-    FolderInfo.wait();
+
+    // the folder of the clone is counted by the insert once it is committed
+    return InsertIntoDatabase(Clone, "", Source->Checksum, [this, Handle, Item, Source, Data](SQLite::Connection* connection, const string& owner) {
+        // within the same bucket the stored content is shared, unless an update replaced it meanwhile
+        if (connection == Handle->Writing() && LatestContentHeader(connection, Item->Id)->Id == Source->Id && Contents_.Share(connection, owner, Source->Id)) return;
+
+        // otherwise the copied revision is rebuilt, an update may have turned it into a patch by now
+        if (Data->empty()) {
+            auto Reader = Handle->Borrow();
+            auto Chain = RevisionChain(Reader.Get(), Item->Id, Source->Revision);
+            *Data = Rebuild(Chain);
+        }
+        Contents_.Store(connection, owner, *Data, Source->Checksum);
+    });
 }
 
 void DocumentStorage::Associate(const string& id, const string& path, const string& item, const string& type, const string& user) const
+{
+    AssociateAsync(id, path, item, type, user).get();
+}
+
+future<void> DocumentStorage::AssociateAsync(const string& id, const string& path, const string& item, const string& type, const string& user) const
 {
     ReadOnlyDenied(user);
     auto Handle = FetchBucket(id);
-    Guard Lock(Handle->WriteGuard);
-    
-    Access::DocumentAssignmentPtr Assignment = Fetch(Handle->Writing(), id, path);
-    Assignment->AssignmentId = item;
-    Assignment->AssignmentType = type;
+    return Handle->Submit([=]() {
+        Access::DocumentAssignmentPtr Assignment = Fetch(Handle->Writing(), id, path);
+        Assignment->AssignmentId = item;
+        Assignment->AssignmentType = type;
     
-    TransformerQueue Actions(Handle->Writing());
-    Actions.Update(*Assignment);
-    Actions.Flush();
+        TransformerQueue Actions(Handle->Writing());
+        Actions.Update(*Assignment);
+        Actions.Flush();
+    });
 }
 
 void DocumentStorage::Delete(const string& id, const string& user) const
+{
+    DeleteAsync(id, user).get();
+}
+
+future<void> DocumentStorage::DeleteAsync(const string& id, const string& user) const
 {
     ReadOnlyDenied(user);
     
     auto Handle = FetchBucket(id);
-    Guard Lock(Handle->WriteGuard);
+    auto Folders = std::make_shared<DocumentFolders>();
+    return Handle->Submit([=]() {
+        Access::DocumentDataPtr Document = Fetch(Handle, id);
+        if (Document->Locker.empty() == false && Document->Locker != user) throw Access::LockError((format("document %1% is locked by %2%") % Document->Display % Document->Locker).str());
+        if (Document->Deleted) throw Access::LockError((format("document %1% is already in the deleted state") % Document->Display).str());
     
-    Access::DocumentDataPtr Document = Fetch(Handle, id);
-    if (Document->Locker.empty() == false && Document->Locker != user) throw Access::LockError((format("document %1% is locked by %2%") % Document->Display % Document->Locker).str());
-    if (Document->Deleted) throw Access::LockError((format("document %1% is already in the deleted state") % Document->Display).str());
+        Folders->Paths = FoldersOf(id);
+        Folders->Directory = Document->Name == Access::DocumentDirectoryName;
     
-    auto Folders = FoldersOf(id);
-    auto& FolderInfo = async(launch::async, [this, &Folders, &Document]() {
-         for (auto& Folder : Folders) {
-             if (Document->Name == Access::DocumentDirectoryName)
-                Folders_.RemoveUncounted(Folder);
-             else {
-                Folders_.Remove(Folder);
-             }
-         }
-    });
-    
-    TransformerQueue Actions(Handle->Writing());
+        TransformerQueue Actions(Handle->Writing());
     
-    Document->Deleted = true;
-    Actions.Update(*Document);
+        Document->Deleted = true;
+        Actions.Update(*Document);
     
-    Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
-    History->Id = Utils::NewId();
-    History->Action = Access::Deleted;
-    History->Actor = user;
-    History->Created = Utils::Ticks(microsec_clock::local_time());
-    History->Document = id;
-    History->Revision = LatestRevision(Handle->Writing(), id) + 1;
-    Actions.Insert(*History);
+        Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
+        History->Id = Utils::NewId();
+        History->Action = Access::Deleted;
+        History->Actor = user;
+        History->Created = Utils::Ticks(microsec_clock::local_time());
+        History->Document = id;
+        History->Revision = LatestRevision(Handle->Writing(), id) + 1;
+        Actions.Insert(*History);
     
-    Actions.Flush();
-    FolderInfo.wait();
+        Actions.Flush();
+    }, [this, Folders]() {
+        for (auto& Folder : Folders->Paths) {
+            if (Folders->Directory)
+                Folders_.RemoveUncounted(Folder);
+            else {
+                Folders_.Remove(Folder);
+            }
+        }
+    });
 }
 
 void DocumentStorage::Destroy(const string& id, const string& user) const
+{
+    DestroyAsync(id, user).get();
+}
+
+future<void> DocumentStorage::DestroyAsync(const string& id, const string& user) const
 {
     ReadOnlyDenied(user);
     
     auto Handle = FetchBucket(id);
-    Guard Lock(Handle->WriteGuard);
+    auto Folders = std::make_shared<DocumentFolders>();
+    return Handle->Submit([=]() {
+        Access::DocumentDataPtr Document = Fetch(Handle, id);
+        if (Document->Locker.empty() == false && Document->Locker != user) throw Access::LockError((format("document %1% is locked by %2%") % Document->Display % Document->Locker).str());
+        if (Document->Deleted) throw Access::LockError((format("document %1% is already in the deleted state") % Document->Display).str());
     
-    Access::DocumentDataPtr Document = Fetch(Handle, id);
-    if (Document->Locker.empty() == false && Document->Locker != user) throw Access::LockError((format("document %1% is locked by %2%") % Document->Display % Document->Locker).str());
-    if (Document->Deleted) throw Access::LockError((format("document %1% is already in the deleted state") % Document->Display).str());
+        Folders->Paths = FoldersOf(id);
+        Folders->Directory = Document->Name == Access::DocumentDirectoryName;
     
-    auto Folders = FoldersOf(id);
-    auto& FolderInfo = async(launch::async, [this, &Folders, &Document]() {
-         for (auto& Folder : Folders) {
-             if (Document->Name == Access::DocumentDirectoryName)
+        TransformerQueue Actions(Handle->Writing());
+        Actions.Delete(*Document);
+        Actions.Flush();
+    }, [this, Folders]() {
+        for (auto& Folder : Folders->Paths) {
+            if (Folders->Directory)
                 Folders_.RemoveUncounted(Folder);
-             else {
+            else {
                 Folders_.Remove(Folder);
-             }
-         }
+            }
+        }
     });
-    
-    TransformerQueue Actions(Handle->Writing());
-    Actions.Delete(*Document);
-    Actions.Flush();
-    
-    FolderInfo.wait();
 }
 
 void DocumentStorage::Undelete(const vector<string>& ids, const string& user) const
 {
     ReadOnlyDenied(user);
     
-    for (auto& Id : ids) {
-        auto Handle = FetchBucket(Id);
-        Guard Lock(Handle->WriteGuard);
-        
-        Access::DocumentDataPtr Document = Fetch(Handle, Id);
+    // all documents are queued first, the writers commit them in as few transactions as they can
+    vector<future<void>> Pending;
+    for (auto& Id : ids) Pending.push_back(UndeleteAsync(Id, user));
+    for (auto& Result : Pending) Result.get();
+}
+
+void DocumentStorage::Undelete(const string& id, const string& user) const
+{
+    UndeleteAsync(id, user).get();
+}
+
+future<void> DocumentStorage::UndeleteAsync(const string& id, const string& user) const
+{
+    ReadOnlyDenied(user);
+    
+    auto Handle = FetchBucket(id);
+    auto Folders = std::make_shared<DocumentFolders>();
+    return Handle->Submit([=]() {
+        Access::DocumentDataPtr Document = Fetch(Handle, id);
         if (Document->Locker.empty() == false && Document->Locker != user) throw Access::LockError((format("document %1% is locked by %2%") % Document->Display % Document->Locker).str());
         if (Document->Deleted == false) throw Access::LockError((format("document %1% is not in the deleted state") % Document->Display).str());
-        
-        auto Folders = FoldersOf(Id);
-        auto& FolderInfo = async(launch::async, [this, &Folders, &Document]() {
-             for (auto& Folder : Folders) {
-                 if (Document->Name == Access::DocumentDirectoryName)
-                    Folders_.AddUncounted(Folder);
-                 else {
-                    Folders_.Add(Folder);
-                 }
-             }
-        });
-        
+    
+        Folders->Paths = FoldersOf(id);
+        Folders->Directory = Document->Name == Access::DocumentDirectoryName;
+    
         TransformerQueue Actions(Handle->Writing());
-        
+    
         Document->Deleted = false;
         Actions.Update(*Document);
-        
+    
         Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
         History->Id = Utils::NewId();
         History->Action = Access::Recovered;
         History->Actor = user;
         History->Created = Utils::Ticks(microsec_clock::local_time());
-        History->Document = Id;
-        History->Revision = LatestRevision(Handle->Writing(), Id) + 1;
+        History->Document = id;
+        History->Revision = LatestRevision(Handle->Writing(), id) + 1;
         Actions.Insert(*History);
-        
-        Actions.Flush();
-        FolderInfo.wait();
-    }
-}
-
-void DocumentStorage::Undelete(const string& id, const string& user) const
-{
-    ReadOnlyDenied(user);
     
-    auto Handle = FetchBucket(id);
-    Guard Lock(Handle->WriteGuard);
-    
-    Access::DocumentDataPtr Document = Fetch(Handle, id);
-    if (Document->Locker.empty() == false && Document->Locker != user) throw Access::LockError((format("document %1% is locked by %2%") % Document->Display % Document->Locker).str());
-    if (Document->Deleted == false) throw Access::LockError((format("document %1% is not in the deleted state") % Document->Display).str());
-    
-    auto Folders = FoldersOf(id);
-    auto& FolderInfo = async(launch::async, [this, &Folders, &Document]() {
-         for (auto& Folder : Folders) {
-             if (Document->Name == Access::DocumentDirectoryName)
+        Actions.Flush();
+    }, [this, Folders]() {
+        for (auto& Folder : Folders->Paths) {
+            if (Folders->Directory)
                 Folders_.AddUncounted(Folder);
-             else {
+            else {
                 Folders_.Add(Folder);
-             }
-         }
+            }
+        }
     });
-    
-    TransformerQueue Actions(Handle->Writing());
-    
-    Document->Deleted = false;
-    Actions.Update(*Document);
-    
-    Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
-    History->Id = Utils::NewId();
-    History->Action = Access::Recovered;
-    History->Actor = user;
-    History->Created = Utils::Ticks(microsec_clock::local_time());
-    History->Document = id;
-    History->Revision = LatestRevision(Handle->Writing(), id) + 1;
-    Actions.Insert(*History);
-    
-    Actions.Flush();
-    FolderInfo.wait();
 }
 
 void DocumentStorage::Rename(const string& id, const string& user, const string& display) const
+{
+    RenameAsync(id, user, display).get();
+}
+
+future<void> DocumentStorage::RenameAsync(const string& id, const string& user, const string& display) const
 {
     ReadOnlyDenied(user);
     
     auto Handle = FetchBucket(id);
-    Guard Lock(Handle->WriteGuard);
-    
-    Access::DocumentDataPtr Document = FetchChecked(Handle, id, user);
-    TransformerQueue Actions(Handle->Writing());
+    return Handle->Submit([=]() {
+        Access::DocumentDataPtr Document = FetchChecked(Handle, id, user);
+        TransformerQueue Actions(Handle->Writing());
     
-    Document->Display = display;
-    Actions.Update(*Document);
+        Document->Display = display;
+        Actions.Update(*Document);
     
-    Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
-    History->Id = Utils::NewId();
-    History->Action = Access::Retitled;
-    History->Actor = user;
-    History->Created = Utils::Ticks(microsec_clock::local_time());
-    History->Document = id;
-    History->Revision = LatestRevision(Handle->Writing(), id) + 1;
-    Actions.Insert(*History);
+        Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
+        History->Id = Utils::NewId();
+        History->Action = Access::Retitled;
+        History->Actor = user;
+        History->Created = Utils::Ticks(microsec_clock::local_time());
+        History->Document = id;
+        History->Revision = LatestRevision(Handle->Writing(), id) + 1;
+        Actions.Insert(*History);
     
-    Actions.Flush();
+        Actions.Flush();
+    });
 }
 
 Access::DocumentContentPtr DocumentStorage::Read(const string& id, const string& user) const
 {
     auto& Handle = FetchBucket(id);
-    auto Content = LatestContent(Handle->Reading(), id);
+    auto Reader = Handle->Borrow();
+    auto Content = LatestContent(Reader.Get(), id);
 
     return Content;
 }
 
-Access::DocumentContentPtr DocumentStorage::Read(const string& id, const string& user, int revision) const
+Access::DocumentContentPtr DocumentStorage::Read(const string& id, const string& user, int offset, int length) const
+{
+    if (offset < 0 || length < 0) throw Access::ArgumentError("invalid offset or length");
+
+    auto& Handle = FetchBucket(id);
+    auto Reader = Handle->Borrow();
+    FetchChecked(Handle, id, user);
+
+    // the older revision is rewritten into a patch on update, keep the lookup and the blob read in one snapshot
+    auto Snapshot = Reader->Begin();
+    auto Command = Reader->Create((format(LatestContentQuery) % "cnt.rowid, cnt.Id, cnt.Owner, cnt.SeqId, cnt.Checksum").str());
+    Command.Parameters()["Owner"].SetValue(id);
+    auto Data = Command.Open();
+    if (Data.HasData() == false) throw Access::NotFoundError((format("no content for document id %1%") % id).str());
+
+    auto& Row = *Data.begin();
+    Access::DocumentContentPtr Result = new Access::DocumentContent();
+    Result->Id = Row.Get<string>(1);
+    Result->History = Row.Get<string>(2);
+    Result->Revision = Row.Get<int>(3);
+    Result->Checksum = Row.Get<string>(4);
+
+    auto Blob = Reader->OpenBlob("DocumentContents", "Data", Row.Get<int64_t>(0));
+    Result->Content = Blob.Size() > 0 ? Blob.Read(offset, length) : Contents_.Load(Reader.Get(), Result->Id, offset, length);
+
+    return Result;
+}
+
+vector<Access::DocumentContentPtr> DocumentStorage::RevisionChain(const string& id, const string& user, int revision) const
+{
+    auto& Handle = FetchBucket(id);
+    auto Reader = Handle->Borrow();
+    FetchChecked(Handle, id, user);
+
+    return RevisionChain(Reader.Get(), id, revision);
+}
+
+vector<Access::DocumentContentPtr> DocumentStorage::RevisionChain(SQLite::Connection* connection, const string& id, int revision) const
 {
     const string QueryTemplate =
 R"(SELECT
-    %1%
+    %1%, IFNULL(bas.Base, -1) AS Base
 FROM
     DocumentContents cnt
 INNER JOIN
     DocumentHistories hst
 ON
     cnt.Owner = hst.Id
+LEFT JOIN
+    ContentBases bas
+ON
+    bas.Owner = cnt.Id
 WHERE
-    hst.Owner = '%2%'
+    hst.Owner = :Owner
+AND
+    cnt.SeqId >= :Revision
 ORDER BY
-    cnt.SeqId DESC)";
-    
-    auto& Handle = FetchBucket(id);
-    Guard Lock(Handle->ReadGuard);
-    auto Header = FetchChecked(Handle, id, user);
+    cnt.SeqId)";
 
     auto Fields = AliasFields(ContentTransformer::FieldNames(), "cnt");
-    auto Query = (format(QueryTemplate) % Fields % id).str();
-    auto Command = Handle->Reading()->Create(Query);
+    auto Query = (format(QueryTemplate) % Fields).str();
+    auto Command = connection->Create(Query);
+    Command.Parameters()["Owner"].SetValue(id);
+    Command.Parameters()["Revision"].SetValue(revision);
     
-    Access::DocumentContentPtr Last = new Access::DocumentContent();
-    vector<unsigned char> Content;
+    // patches are collected upwards until a full content is found,
+    // a checkpoint stops the walk before the latest revision and
+    // compacted patches skip the revisions in between
+    vector<Access::DocumentContentPtr> Chain;
+    auto Next = revision;
 
     ContentTransformer Transformer;
     for (auto& Row : Command.Open()) {
-        Transformer.Load(Row, *Last);
-        if (Content.empty()) {
-            Content = Last->Content;
-        }
-        else {
-            if (Last->Revision < revision) break;
-            Content = BinaryData::ApplyPatch(Content, Last->Content);
-        }
+        if (Row.Get<int>("SeqId") < Next) continue;
+
+        Access::DocumentContentPtr Item = new Access::DocumentContent();
+        Transformer.Load(Row, *Item);
+        Chain.push_back(Item);
+        if (Item->Content.empty() && Contents_.Load(connection, Item->Id, Item->Content)) break;
+
+        auto Base = Row.Get<int>("Base");
+        Next = Base < 0 ? Item->Revision + 1 : Base;
+    }
+
+    if (Chain.empty()) throw Access::NotFoundError((format("no revision %1% for document id %2%") % revision % id).str());
+    return Chain;
+}
+
+Access::DocumentContentPtr DocumentStorage::Read(const string& id, const string& user, int revision) const
+{
+    // the chain is loaded under the lock, patches are applied without it
+    auto Chain = RevisionChain(id, user, revision);
+    auto Content = Rebuild(Chain);
+
+    auto& First = Chain.front();
+    Access::DocumentContentPtr Result = new Access::DocumentContent();
+    Result->Checksum = First->Checksum;
+    Result->Content = std::move(Content);
+    Result->History = First->History;
+    Result->Id = First->Id;
+    Result->Revision = First->Revision;
+    
+    return Result;
+}
+
+Access::DocumentContentPtr DocumentStorage::Stream(const string& id, const string& user, int revision, const BinaryData::Sink& sink) const
+{
+    auto Chain = RevisionChain(id, user, revision);
+
+    auto Content = std::move(Chain.back()->Content);
+    if (Chain.size() == 1) {
+        if (Content.empty() == false) sink(Content.data(), Content.size());
+    }
+    else {
+        // the patches are merged, no revision in between is rebuilt
+        vector<vector<unsigned char>> Patches;
+        for (auto Item = Chain.rbegin() + 1; Item != Chain.rend(); ++Item) Patches.push_back(std::move((*Item)->Content));
+        BinaryData::ApplyPatches(Content, Patches, sink);
     }
 
+    auto& First = Chain.front();
     Access::DocumentContentPtr Result = new Access::DocumentContent();
-    Result->Checksum = Last->Checksum;
-    Result->Content = Content;
-    Result->History = Last->History;
-    Result->Id = Last->Id;
-    Result->Revision = Last->Revision;
+    Result->Checksum = First->Checksum;
+    Result->History = First->History;
+    Result->Id = First->Id;
+    Result->Revision = First->Revision;
     
     return Result;
 }
 
+void DocumentStorage::CalculateHashes() const
+{
+    vector<future<void>> Workers;
+    for (auto& Handle : DistinctHandles_) {
+        Workers.push_back(async(launch::async, [this, &Handle]() { CalculateHashes(Handle); }));
+    }
+
+    for (auto& Worker : Workers) Worker.get();
+}
+
+void DocumentStorage::CalculateHashes(const BucketHandle& handle) const
+{
+    const string QueryTemplate =
+R"(SELECT
+    %1%, IFNULL(bas.Base, -1) AS Base
+FROM
+    DocumentContents cnt
+INNER JOIN
+    DocumentHistories hst
+ON
+    cnt.Owner = hst.Id
+LEFT JOIN
+    ContentBases bas
+ON
+    bas.Owner = cnt.Id
+WHERE
+    hst.Owner = :Owner
+ORDER BY
+    cnt.SeqId DESC)";
+
+    const string BasesQuery =
+R"(SELECT
+    bas.Base, COUNT(*)
+FROM
+    ContentBases bas
+INNER JOIN
+    DocumentContents cnt
+ON
+    bas.Owner = cnt.Id
+INNER JOIN
+    DocumentHistories hst
+ON
+    cnt.Owner = hst.Id
+WHERE
+    hst.Owner = :Owner
+GROUP BY
+    bas.Base)";
+
+    vector<string> Documents;
+    {
+        auto Reader = handle->Borrow();
+        auto Command = Reader->Create("SELECT Id FROM Documents");
+        for (auto& Row : Command.Open()) Documents.push_back(Row.Get<string>(0));
+    }
+
+    ContentTransformer Transformer;
+    auto Query = (format(QueryTemplate) % AliasFields(ContentTransformer::FieldNames(), "cnt")).str();
+
+    for (auto& Id : Documents) {
+        // lock per document, writers are blocked only briefly
+        Guard Lock(handle->WriteGuard);
+        auto Connection = handle->Writing();
+        vector<pair<string, string>> Changes;
+
+        {
+            // revisions compacted patches are based on are kept until their last use
+            map<int, pair<int, Access::BinaryData>> Bases;
+            auto Based = Connection->Create(BasesQuery);
+            Based.Parameters()["Owner"].SetValue(Id);
+            for (auto& Row : Based.Open()) Bases[Row.Get<int>(0)].first = Row.Get<int>(1);
+
+            auto Command = Connection->Create(Query);
+            Command.Parameters()["Owner"].SetValue(Id);
+
+            Access::DocumentContentPtr Last = new Access::DocumentContent();
+            Access::BinaryData Content, Next;
+            auto First = true;
+
+            for (auto& Row : Command.Open()) {
+                Transformer.Load(Row, *Last);
+                auto Base = Row.Get<int>("Base");
+                auto Full = (Last->Content.empty() && Contents_.Load(Connection, Last->Id, Last->Content)) || First;
+
+                if (Full) Content = std::move(Last->Content);
+                else if (Base < 0) {
+                    BinaryData::ApplyPatch(Content, Last->Content, Next);
+                    Content.swap(Next);
+                }
+                else {
+                    auto& Saved = Bases.at(Base);
+                    BinaryData::ApplyPatch(Saved.second, Last->Content, Next);
+                    Content.swap(Next);
+                    if (--Saved.first == 0) Bases.erase(Base);
+                }
+                First = false;
+
+                auto Needed = Bases.find(Last->Revision);
+                if (Needed != Bases.end()) Needed->second.second = Content;
+
+                auto Checksum = ContentHash::Compute(Content);
+                if (Checksum != Last->Checksum) Changes.emplace_back(Last->Id, Checksum);
+            }
+        }
+
+        if (Changes.empty()) continue;
+
+        auto Scope = Connection->Begin();
+        auto Command = Connection->Create("UPDATE DocumentContents SET Checksum = :Checksum WHERE Id = :Id");
+        for (auto& Change : Changes) {
+            Command.Parameters()["Id"].SetValue(Change.first);
+            Command.Parameters()["Checksum"].SetValue(Change.second);
+            Command.Execute();
+        }
+        Scope.Commit();
+    }
+}
+
+void DocumentStorage::CompactRevisions() const
+{
+    vector<future<void>> Workers;
+    for (auto& Handle : DistinctHandles_) {
+        Workers.push_back(async(launch::async, [this, &Handle]() { CompactRevisions(Handle); }));
+    }
+
+    for (auto& Worker : Workers) Worker.get();
+}
+
+void DocumentStorage::CompactRevisions(const BucketHandle& handle) const
+{
+    const string Query =
+R"(SELECT
+    cnt.Id, cnt.SeqId, IFNULL(bas.Base, -1), LENGTH(cnt.Data)
+FROM
+    DocumentContents cnt
+INNER JOIN
+    DocumentHistories hst
+ON
+    cnt.Owner = hst.Id
+LEFT JOIN
+    ContentBases bas
+ON
+    bas.Owner = cnt.Id
+WHERE
+    hst.Owner = :Owner
+ORDER BY
+    cnt.SeqId)";
+
+    auto Span = Settings_.ContentCompactionSpan();
+    if (Span < 2) return;
+
+    vector<string> Documents;
+    {
+        auto Reader = handle->Borrow();
+        auto Command = Reader->Create("SELECT Id FROM Documents");
+        for (auto& Row : Command.Open()) Documents.push_back(Row.Get<string>(0));
+    }
+
+    for (auto& Id : Documents) {
+        // lock per document, writers are blocked only briefly
+        Guard Lock(handle->WriteGuard);
+        auto Connection = handle->Writing();
+
+        vector<StoredRevision> Revisions;
+        {
+            auto Command = Connection->Create(Query);
+            Command.Parameters()["Owner"].SetValue(Id);
+            for (auto& Row : Command.Open()) {
+                Revisions.push_back(StoredRevision { Row.Get<string>(0), Row.Get<int>(1), Row.Get<int>(2), Row.Get<int64_t>(3) == 0 });
+            }
+        }
+        if (Revisions.empty()) continue;
+        Revisions.back().Full = true;
+
+        // every span-th revision is patched against the next one of them or the next full revision,
+        // reads walk at most span patches to get there and skip along from then on
+        for (size_t Index = 0; Index < Revisions.size(); ++Index) {
+            auto& Anchor = Revisions[Index];
+            if (Anchor.Full || Anchor.Base >= 0 || Anchor.SeqId % Span != 0) continue;
+
+            vector<size_t> Path;
+            auto Base = -1;
+            for (auto Position = Index; Base < 0; ) {
+                Path.push_back(Position);
+                auto& Current = Revisions[Position];
+                auto Target = Current.Base < 0 ? Current.SeqId + 1 : Current.Base;
+
+                auto Next = Position + 1;
+                while (Next < Revisions.size() && Revisions[Next].SeqId < Target) ++Next;
+                if (Next == Revisions.size()) break;
+                if (Revisions[Next].Full || Revisions[Next].SeqId % Span == 0) Base = Revisions[Next].SeqId;
+                Position = Next;
+            }
+            if (Base < 0 || Path.size() < 2) continue;
+
+            // the patch nearest to the base is applied first
+            vector<vector<unsigned char>> Patches;
+            auto Command = Connection->Create("SELECT Data FROM DocumentContents WHERE Id = :Id");
+            for (auto Position = Path.rbegin(); Position != Path.rend(); ++Position) {
+                Command.Parameters()["Id"].SetValue(Revisions[*Position].Id);
+                auto Data = Command.Open();
+                if (Data.HasData() == false) throw Access::NotFoundError((format("no content for revision %1% of document id %2%") % Revisions[*Position].SeqId % Id).str());
+                Patches.push_back(Data.begin()->GetBlob(0));
+            }
+
+            auto Patch = BinaryData::ComposePatches(Patches, handle->PatchCodec);
+
+            auto Scope = Connection->Begin();
+            auto Update = Connection->Create("UPDATE DocumentContents SET Data = :Data WHERE Id = :Id");
+            Update.Parameters()["Id"].SetValue(Anchor.Id);
+            Update.Parameters()["Data"].SetValue(Patch);
+            Update.Execute();
+
+            auto Insert = Connection->Create("INSERT INTO ContentBases(Owner, Base) VALUES(:Owner, :Base)");
+            Insert.Parameters()["Owner"].SetValue(Anchor.Id);
+            Insert.Parameters()["Base"].SetValue(Base);
+            Insert.Execute();
+            Scope.Commit();
+
+            Anchor.Base = Base;
+        }
+    }
+}
+
 vector<Access::DocumentHistoryEntryPtr> DocumentStorage::Revisions(const string& id) const
 {
-    const string QueryTemplate = "SELECT %1% FROM DocumentHistories WHERE Owner = '%2%'";
+    const string QueryTemplate = "SELECT %1% FROM DocumentHistories WHERE Owner = :Owner";
     auto& Handle = FetchBucket(id);
-    Guard Lock(Handle->ReadGuard);
+    auto Reader = Handle->Borrow();
 
     auto Fields = join(HistoryTransformer::FieldNames(), ", ");
-    auto Query = (format(QueryTemplate) % Fields % id).str();
-    auto Command = Handle->Reading()->Create(Query);
+    auto Query = (format(QueryTemplate) % Fields).str();
+    auto Command = Reader->Create(Query);
+    Command.Parameters()["Owner"].SetValue(id);
     
     vector<Access::DocumentHistoryEntryPtr> Result;
     HistoryTransformer Transformer;
@@ -937,6 +1467,36 @@ vector<Access::DocumentHistoryEntryPtr> DocumentStorage::Revisions(const string&
     return Result;
 }
 
+future<Access::DocumentDataPtr> DocumentStorage::LoadAsync(const string& id, const string& user) const
+{
+    return Executor_.Submit(BucketIndex(FetchBucket(id)), [this, id, user]() { return Load(id, user); });
+}
+
+future<Access::DocumentDataPtr> DocumentStorage::FindByIdAsync(const string& id, int number) const
+{
+    return Executor_.Submit(BucketIndex(FetchBucket(id)), [this, id, number]() { return FindById(id, number); });
+}
+
+future<Access::DocumentContentPtr> DocumentStorage::ReadAsync(const string& id, const string& user) const
+{
+    return Executor_.Submit(BucketIndex(FetchBucket(id)), [this, id, user]() { return Read(id, user); });
+}
+
+future<Access::DocumentContentPtr> DocumentStorage::ReadAsync(const string& id, const string& user, int revision) const
+{
+    return Executor_.Submit(BucketIndex(FetchBucket(id)), [this, id, user, revision]() { return Read(id, user, revision); });
+}
+
+future<Access::DocumentContentPtr> DocumentStorage::ReadAsync(const string& id, const string& user, int offset, int length) const
+{
+    return Executor_.Submit(BucketIndex(FetchBucket(id)), [this, id, user, offset, length]() { return Read(id, user, offset, length); });
+}
+
+future<vector<Access::DocumentHistoryEntryPtr>> DocumentStorage::RevisionsAsync(const string& id) const
+{
+    return Executor_.Submit(BucketIndex(FetchBucket(id)), [this, id]() { return Revisions(id); });
+}
+
 void DocumentStorage::InitializeBuckets()
 {
     if (Settings_.DataLocation() != ":memory:") create_directory(Settings_.DataLocation());
@@ -998,7 +1558,7 @@ INNER JOIN
 INNER JOIN
     Documents ON Documents.Id = DocumentHistories.Owner AND Documents.State = 0
 WHERE
-    DocumentAssignments.Path LIKE '%1%'
+    DocumentAssignments.Path LIKE :StartWith
 )";
     vector<Access::FolderInfo> Result;
     
@@ -1006,18 +1566,21 @@ WHERE
                  ?
                  static_cast<string>(AllFoldersQuery)
                  :
-                 (format(SubFoldersQuery) % startWith).str()
+                 static_cast<string>(SubFoldersQuery)
                  ;
     
     vector<future<vector<pair<string,string>>>> Intermediates;
     
-    for (auto& Handle : DistinctHandles_) {
+    for (size_t Index = 0; Index < DistinctHandles_.size(); ++Index) {
+        auto& Handle = DistinctHandles_[Index];
         Intermediates.push_back(
-            async(
-                [&Handle, &Query]() {
-                    lock_guard<recursive_mutex> Lock(Handle->ReadGuard);
+            Executor_.Submit(
+                Index,
+                [&Handle, &Query, &startWith]() {
+                    auto Reader = Handle->Borrow();
                     vector<pair<string, string>> Intermediate;
-                    auto& Command = Handle->Reader().Create(Query);
+                    auto& Command = Reader->Create(Query);
+                    if (startWith.empty() == false) Command.Parameters()["StartWith"].SetValue(startWith);
                     
                     for (auto& Row : Command.Open()) {
                         Intermediate.push_back(make_pair<string, string>(Row.Get<string>(0), Row.Get<string>(1)));
@@ -1064,11 +1627,11 @@ WHERE
 
 Access::DocumentDataPtr DocumentStorage::Fetch(BucketHandle handle, const string& id) const
 {
-    DocumentTransformer Transformer(handle->Reading());
+    auto Reader = handle->Borrow();
+    DocumentTransformer Transformer(Reader.Get());
     Access::DocumentDataPtr Result = new Access::DocumentData();
     Result->Id = id;
     
-    Guard Lock(handle->ReadGuard);
     if (Transformer.Load(*Result) == false) throw Access::NotFoundError((format("a document with id %1% is not known") % id).str());
     
     return Result;
@@ -1076,11 +1639,11 @@ Access::DocumentDataPtr DocumentStorage::Fetch(BucketHandle handle, const string
 
 Access::DocumentDataPtr DocumentStorage::FetchChecked(BucketHandle handle, const string& id, const string& user) const
 {
-    DocumentTransformer Transformer(handle->Reading());
+    auto Reader = handle->Borrow();
+    DocumentTransformer Transformer(Reader.Get());
     Access::DocumentDataPtr Result = new Access::DocumentData();
     Result->Id = id;
     
-    Guard Lock(handle->ReadGuard);
     if (Transformer.Load(*Result) == false) throw Access::NotFoundError((format("a document with id %1% is not known") % id).str());
     if (Result->Locker.empty() == false && Result->Locker != user) throw Access::LockError((format("document %1% is locked by %2%") % Result->Display % Result->Locker).str());
     if (Result->Deleted) throw Access::LockError((format("document %1% is in the deleted state") % Result->Display).str());
@@ -1099,16 +1662,41 @@ BucketHandle DocumentStorage::FetchBucket(const string& value) const
     return Buckets_[strtoul(Buffer, &Dummy, 16)];
 }
 
+size_t DocumentStorage::BucketIndex(const BucketHandle& handle) const
+{
+    // the same affinity the queries over all buckets use
+    return find(DistinctHandles_.begin(), DistinctHandles_.end(), handle) - DistinctHandles_.begin();
+}
+
 void DocumentStorage::ReadOnlyDenied(const string& user) const
 {
     if (user == Access::ViewOnlyUser) throw Authentication::AuthenticationError("read only user is not permitted for this operation");
 }
 
-void DocumentStorage::InsertIntoDatabase(const Access::DocumentDataPtr& document, const Access::BinaryData& data, const string& comment) const
+future<void> DocumentStorage::InsertIntoDatabase(const Access::DocumentDataPtr& document, const std::shared_ptr<const Access::BinaryData>& data, const string& comment) const
+{
+    auto Checksum = ContentHash::Compute(*data);
+
+    document->Size = data->size();
+    return InsertIntoDatabase(document, comment, Checksum, [this, data, Checksum](SQLite::Connection* connection, const string& owner) {
+        Contents_.Store(connection, owner, *data, Checksum);
+    });
+}
+
+future<void> DocumentStorage::InsertIntoDatabase(const Access::DocumentDataPtr& document, const string& comment, const string& checksum, const ContentWriter& writer) const
 {
     document->Id = Utils::NewId();
     auto Handle = FetchBucket(document->Id);
-    auto& FolderInfo = async(launch::async, [this, &document]() {
+    return Handle->Submit([=]() {
+        TransformerQueue Actions(Handle->Writing());
+        vector<Common::PersistablePtr> Rows;
+        QueueInsert(Actions, Rows, document, comment, checksum, writer);
+        Actions.Flush();
+
+        /*
+        UpdateFullTextSearch(Data.Content, document.Id, document.Name);
+        */
+    }, [this, document]() {
         if (document->Name != Access::DocumentDirectoryName) {
             Folders_.Add(document->FolderPath);
         }
@@ -1116,14 +1704,15 @@ void DocumentStorage::InsertIntoDatabase(const Access::DocumentDataPtr& document
             Folders_.AddUncounted(document->FolderPath);
         }
     });
-    
-    TransformerQueue Actions(Handle->Writing());
+}
 
+void DocumentStorage::QueueInsert(TransformerQueue& actions, vector<Common::PersistablePtr>& rows, const Access::DocumentDataPtr& document, const string& comment, const string& checksum, const ContentWriter& writer) const
+{
+    // the queue refers to the rows, they are kept until it is flushed
     document->Created = Utils::Ticks(microsec_clock::local_time());
     document->Creator = document->Creator.empty() ? document->User : document->Creator;
     document->Deleted = false;
-    document->Size = data.size();
-    Actions.Insert(*document);
+    actions.Insert(*document);
 
     Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
     History->Action = Access::Created;
@@ -1133,14 +1722,15 @@ void DocumentStorage::InsertIntoDatabase(const Access::DocumentDataPtr& document
     History->Id = Utils::NewId();
     History->Comment = comment;
     History->Revision = 1;
-    Actions.Insert(*History);
+    actions.Insert(*History);
 
     Access::DocumentContentPtr Data = new Access::DocumentContent();
-    Data->Content = data;
+    Data->Checksum = checksum;
     Data->History = History->Id;
     Data->Id = Utils::NewId();
     Data->Revision = 1;
-    Actions.Insert(*Data);
+    actions.Insert(*Data);
+    actions.Execute([Data, writer](SQLite::Connection* connection) { writer(connection, Data->Id); });
 
     Access::DocumentAssignmentPtr Assignment = new Access::DocumentAssignment();
     Assignment->AssignmentId = document->AssociatedItem;
@@ -1149,110 +1739,202 @@ void DocumentStorage::InsertIntoDatabase(const Access::DocumentDataPtr& document
     Assignment->Id = Utils::NewId();
     Assignment->Path = document->FolderPath;
     Assignment->Revision = 1;
-    Actions.Insert(*Assignment);
+    actions.Insert(*Assignment);
+
+    rows.push_back(document.get());
+    rows.push_back(History.get());
+    rows.push_back(Data.get());
+    rows.push_back(Assignment.get());
+}
+
+bool DocumentStorage::CreatePatch(const Access::BinaryData& data, const Access::BinaryData& oldData, const Codec& codec, bool optional, Access::BinaryData& patch) const
+{
+    // the suffix array of huge documents takes too much memory and time
+    auto Threshold = static_cast<size_t>(Settings_.PatchChunkingThreshold());
+    auto Chunking = Threshold > 0 && max(data.size(), oldData.size()) >= Threshold;
+    auto Budget = Settings_.PatchTimeBudget();
+
+    // an optional patch is skipped if it will not pay off, the old revision stays full then,
+    // small revisions are patched anyway, their patches are cheap to create
+    const size_t SmallRevision = 4096;
+    optional = optional && oldData.size() >= SmallRevision;
+
+    auto Kept = [this](uint64_t PatchStatistics::* counter) {
+        lock_guard<mutex> Lock(StatisticsGuard_);
+        ++(Statistics_.*counter);
+        return false;
+    };
 
-    Actions.Flush();
+    if (optional && Chunking == false && BinaryData::Similarity(data, oldData) * 100 < Settings_.PatchSimilarityPercent()) return Kept(&PatchStatistics::Dissimilar);
 
-    /*
-    UpdateFullTextSearch(Data.Content, document.Id, document.Name);
-    */
-    FolderInfo.wait();
+    if (Chunking) patch = BinaryData::CreateChunkPatch(data, oldData, codec);
+    else if (optional == false || Budget <= 0) patch = BinaryData::CreatePatch(data, oldData, codec);
+    else if (BinaryData::TryCreatePatch(data, oldData, codec, chrono::milliseconds(Budget), patch) == false) return Kept(&PatchStatistics::Expired);
+
+    if (optional && patch.size() >= oldData.size()) return Kept(&PatchStatistics::Oversized);
+
+    lock_guard<mutex> Lock(StatisticsGuard_);
+    ++Statistics_.Patched;
+    Statistics_.FullBytes += oldData.size();
+    Statistics_.PatchBytes += patch.size();
+    return true;
 }
 
-void DocumentStorage::UpdateInDatabase(const Access::DocumentDataPtr& document, const Access::BinaryData& data, const string& user, const string& comment) const
+PatchStatistics DocumentStorage::PatchUsage() const
 {
-    auto Handle = FetchBucket(document->Id);
-    Guard Lock(Handle->WriteGuard);
-    
-    TransformerQueue Queue(Handle->Writing());
-    Access::DocumentDataPtr Item = Fetch(Handle, document->Id);
-    
-    if (Item->Locker.empty() == false && Item->Locker != user) throw Access::LockError((format("document %1% is already locked by %2%") % Item->Display % Item->Locker).str());
+    lock_guard<mutex> Lock(StatisticsGuard_);
+    return Statistics_;
+}
 
-    vector<string> Actions;
+Utils::WorkStealingPool::Statistics DocumentStorage::QueryUsage() const
+{
+    return Executor_.Usage();
+}
 
-    if (document->Name != Item->Name) {
-        Actions.push_back(Access::Renamed);
-    }
-    if (document->Display != Item->Display) {
-        Actions.push_back(Access::Retitled);
-    }
-    if (document->Keywords != Item->Keywords) {
-        Actions.push_back(Access::Keywords);
-    }
-    if (data.empty() == false) {
-        Actions.push_back(Access::Revision);
+CommitStatistics DocumentStorage::CommitUsage() const
+{
+    CommitStatistics Result;
+    for (auto& Handle : DistinctHandles_) {
+        auto Usage = Handle->CommitUsage();
+        Result.Commits += Usage.Commits;
+        Result.Mutations += Usage.Mutations;
+        Result.LargestBatch = max(Result.LargestBatch, Usage.LargestBatch);
     }
+    return Result;
+}
+
+future<void> DocumentStorage::UpdateInDatabase(const Access::DocumentDataPtr& document, const std::shared_ptr<const Access::BinaryData>& data, const string& user, const string& comment) const
+{
+    auto Handle = FetchBucket(document->Id);
+    return Handle->Submit([=]() {
+        auto& Data = *data;
+        TransformerQueue Queue(Handle->Writing());
+        Access::DocumentDataPtr Item = Fetch(Handle, document->Id);
+    
+        if (Item->Locker.empty() == false && Item->Locker != user) throw Access::LockError((format("document %1% is already locked by %2%") % Item->Display % Item->Locker).str());
+
+        string Checksum;
+        auto Modified = Data.empty() == false;
+        if (Modified) {
+            // an unchanged upload is detected by its checksum, confirmed without running a diff
+            Checksum = ContentHash::Compute(Data);
+            auto Latest = LatestContentHeader(Handle->Writing(), document->Id);
+            if (Latest->Checksum == Checksum) {
+                // a linked content is compared piece by piece, only inline data is loaded
+                auto Linked = Contents_.Linked(Handle->Writing(), Latest->Id);
+                Modified = Linked ? Contents_.Equals(Handle->Writing(), Latest->Id, Data) == false : LatestContent(Handle->Writing(), document->Id)->Content != Data;
+            }
+        }
+
+        vector<string> Actions;
+
+        if (document->Name != Item->Name) {
+            Actions.push_back(Access::Renamed);
+        }
+        if (document->Display != Item->Display) {
+            Actions.push_back(Access::Retitled);
+        }
+        if (document->Keywords != Item->Keywords) {
+            Actions.push_back(Access::Keywords);
+        }
+        if (Modified) {
+            Actions.push_back(Access::Revision);
+        }
     
-    Item->Name = document->Name;
-    Item->Display = document->Display;
-    Item->Keywords = document->Keywords;
-    Item->Size = data.empty() ? Item->Size : data.size();
-    
-    Queue.Update(*Item);
-    
-    Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
-    History->Action = join(Actions, ";");
-    History->Actor = document->Creator;
-    History->Created = Utils::Ticks(microsec_clock::local_time());
-    History->Document = document->Id;
-    History->Id = Utils::NewId();
-    History->Comment = comment;
-    History->Revision = LatestRevision(Handle->Writing(), document->Id) + 1;
+        Item->Name = document->Name;
+        Item->Display = document->Display;
+        Item->Keywords = document->Keywords;
+        Item->Size = Modified ? Data.size() : Item->Size;
     
-    Queue.Insert(*History);
-    Access::DocumentContentPtr Content;
-    Access::DocumentContentPtr OldData;
+        Queue.Update(*Item);
     
-    if (data.empty() == false) {
-        Content = new Access::DocumentContent();
-
-        OldData = LatestContent(Handle->Writing(), document->Id);
-        OldData->Content = BinaryData::CreatePatch(data, OldData->Content);
-
-        Content->Id = Utils::NewId();
-        Content->Content = data;
-        Content->History = History->Id;
-        Content->Revision = OldData->Revision + 1;
-        Queue.Update(*OldData);
-        Queue.Insert(*Content);
-    }
+        Access::DocumentHistoryEntryPtr History = new Access::DocumentHistoryEntry();
+        History->Action = join(Actions, ";");
+        History->Actor = document->Creator;
+        History->Created = Utils::Ticks(microsec_clock::local_time());
+        History->Document = document->Id;
+        History->Id = Utils::NewId();
+        History->Comment = comment;
+        History->Revision = LatestRevision(Handle->Writing(), document->Id) + 1;
+    
+        Queue.Insert(*History);
+        Access::DocumentContentPtr Content;
+        Access::DocumentContentPtr OldData;
+    
+        if (Modified) {
+            Content = new Access::DocumentContent();
+
+            auto Latest = LatestContentHeader(Handle->Writing(), document->Id);
+            auto Interval = Settings_.ContentCheckpointInterval();
+
+            Content->Checksum = Checksum;
+            Content->Id = Utils::NewId();
+            Content->History = History->Id;
+            Content->Revision = Latest->Revision + 1;
+            Queue.Insert(*Content);
+
+            // store before releasing, an unchanged content keeps its blob
+            Queue.Execute([this, &Content, &Data](SQLite::Connection* connection) { Contents_.Store(connection, Content->Id, Data, Content->Checksum); });
+
+            // a checkpoint keeps its full content, reads of older revisions start there,
+            // only revisions stored as blobs can stay full
+            auto Linked = Contents_.Linked(Handle->Writing(), Latest->Id);
+            auto Checkpoint = Interval > 0 && Latest->Revision % Interval == 0 && Linked;
+            if (Checkpoint) {
+                lock_guard<mutex> Counting(StatisticsGuard_);
+                ++Statistics_.Checkpoints;
+            }
+            else {
+                OldData = LatestContent(Handle->Writing(), document->Id);
+                Access::BinaryData Patch;
+                if (CreatePatch(Data, OldData->Content, Handle->PatchCodec, Linked, Patch)) {
+                    OldData->Content = std::move(Patch);
+                    Queue.Update(*OldData);
+                    Queue.Execute([this, &OldData](SQLite::Connection* connection) { Contents_.Release(connection, OldData->Id); });
+                }
+            }
+        }
 
-    Queue.Flush();
+        Queue.Flush();
+    });
 }
 
 int DocumentStorage::LatestRevision(SQLite::Connection* connection, const string& id) const
 {
-    const string QueryTemplate = "SELECT MAX(SeqId) FROM DocumentHistories WHERE Owner = '%1%'";
+    const string Query = "SELECT MAX(SeqId) FROM DocumentHistories WHERE Owner = :Owner";
 
-    auto Command = connection->Create((format(QueryTemplate) % id).str());
+    auto Command = connection->Create(Query);
+    Command.Parameters()["Owner"].SetValue(id);
     return Command.ExecuteScalar<int>();
 }
 
 Access::DocumentContentPtr DocumentStorage::LatestContent(SQLite::Connection* connection, const string& id) const
 {
-    const string QueryTemplate =
-R"(SELECT
-    %1%
-FROM
-    DocumentContents cnt
-INNER JOIN
-    DocumentHistories hst
-ON
-    cnt.Owner = hst.Id
-AND
-    hst.SeqId = (SELECT MAX(SeqId) FROM DocumentHistories hin WHERE hin.Owner = hst.Owner AND EXISTS(SELECT 1 FROM DocumentContents nst WHERE nst.Owner = hin.Id))
-WHERE
-    hst.Owner = '%2%'
-AND
-    cnt.Owner = hst.Id)";
-
     ContentTransformer Transformer;
     Access::DocumentContentPtr Result = new Access::DocumentContent();
     auto Fields = AliasFields(ContentTransformer::FieldNames(), "cnt");
-    auto& Command = connection->Create((format(QueryTemplate) % Fields % id).str());
+    auto& Command = connection->Create((format(LatestContentQuery) % Fields).str());
+    Command.Parameters()["Owner"].SetValue(id);
     auto& Data = Command.Open();
     if (Transformer.Load(Data, *Result) == false) throw Access::NotFoundError((format("no content for document id %1%") % id).str());
+    if (Result->Content.empty()) Contents_.Load(connection, Result->Id, Result->Content);
+
+    return Result;
+}
+
+Access::DocumentContentPtr DocumentStorage::LatestContentHeader(SQLite::Connection* connection, const string& id) const
+{
+    auto Command = connection->Create((format(LatestContentQuery) % "cnt.Id, cnt.Owner, cnt.SeqId, cnt.Checksum").str());
+    Command.Parameters()["Owner"].SetValue(id);
+    auto Data = Command.Open();
+    if (Data.HasData() == false) throw Access::NotFoundError((format("no content for document id %1%") % id).str());
+
+    auto& Row = *Data.begin();
+    Access::DocumentContentPtr Result = new Access::DocumentContent();
+    Result->Id = Row.Get<string>(0);
+    Result->History = Row.Get<string>(1);
+    Result->Revision = Row.Get<int>(2);
+    Result->Checksum = Row.Get<string>(3);
 
     return Result;
 }
@@ -1269,15 +1951,17 @@ INNER JOIN
 ON
     asg.Owner = hst.Id AND asg.SeqId = hst.SeqId
 WHERE
-    asg.Path = '%2%'
+    asg.Path = :Path
 AND
-    hst.Owner = '%3%'
+    hst.Owner = :Owner
 )";
 
     AssignmentTransformer Transformer;
     Access::DocumentAssignmentPtr Assignment = new Access::DocumentAssignment();
     auto Fields = AliasFields(AssignmentTransformer::FieldNames(), "asg");
-    auto& Command = connection->Create((format(QueryTemplate) % Fields % algorithm::to_lower_copy(path) % id).str());
+    auto& Command = connection->Create((format(QueryTemplate) % Fields).str());
+    Command.Parameters()["Path"].SetValue(algorithm::to_lower_copy(path));
+    Command.Parameters()["Owner"].SetValue(id);
     auto& Data = Command.Open();
     if (Transformer.Load(Data, *Assignment) == false) throw Access::NotFoundError((format("no assignment for document id %1%") % id).str());
 
@@ -1287,13 +1971,19 @@ AND
 void DocumentStorage::Optimizer()
 {
     vector<future<void>> Actions;
-    for (auto& Handle : DistinctHandles_) {
+    for (size_t Index = 0; Index < DistinctHandles_.size(); ++Index) {
+        auto& Handle = DistinctHandles_[Index];
         Actions.push_back(
-            async(
-                [&Handle]() {
-                    Guard Lock(Handle->WriteGuard);
-                    auto& Command = Handle->Reader().Create("PRAGMA optimize");
-                    Command.Execute();
+            Executor_.Submit(
+                Index,
+                [this, &Handle]() {
+                    {
+                        Guard Lock(Handle->WriteGuard);
+                        auto Reader = Handle->Borrow();
+                        auto& Command = Reader->Create("PRAGMA optimize");
+                        Command.Execute();
+                    }
+                    CompactRevisions(Handle);
                 }
             )
         );
@@ -1302,18 +1992,20 @@ void DocumentStorage::Optimizer()
     for (auto& Action : Actions) Action.wait();
 }
 
-vector<Access::DocumentDataPtr> DocumentStorage::FetchFromAll(const string& query) const
+vector<Access::DocumentDataPtr> DocumentStorage::FetchFromAll(const string& query, const ParameterBinder& binder) const
 {
     vector<future<vector<Access::DocumentDataPtr>>> Intermediates;
     DocumentTransformer Transformer;
     
-    for (auto& Handle : DistinctHandles_) {
+    for (size_t Index = 0; Index < DistinctHandles_.size(); ++Index) {
+        auto& Handle = DistinctHandles_[Index];
         Intermediates.push_back(
-            async(
-				launch::async,
-                [handle = Handle, query = query, transformer = Transformer]() {
-                    Guard Lock(handle->ReadGuard);
-                    SQLite::Command Command(handle->Reader().Create(query));
+            Executor_.Submit(
+                Index,
+                [handle = Handle, query = query, &binder, transformer = Transformer]() {
+                    auto Reader = handle->Borrow();
+                    SQLite::Command Command(Reader->Create(query));
+                    if (binder) binder(Command.Parameters());
                     vector<Access::DocumentDataPtr> Items;
                     auto ResultSet = Command.Open();
                     for (auto& Row : ResultSet) {
@@ -1,9 +1,15 @@
 #ifndef DOCUMENT_STORAGE_HXX
 #define DOCUMENT_STORAGE_HXX
 
+#include <cstdint>
 #include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <utility>
 #include <vector>
+#include "binary_data.hxx"
+#include "content_store.hxx"
 #include "data_bucket.hxx"
 #include "settings_provider.hxx"
 #include "virtual_tree.hxx"
@@ -15,8 +21,31 @@ namespace Archive /*! Everything is in the Archive namespace */
 namespace Backend /*! Backend ist the server side */
 {
 
+class TransformerQueue;
+
 using BucketHandle = std::shared_ptr<DataBucket>;
 using CreateHandle = std::function<BucketHandle(int)>;
+using ParameterBinder = std::function<void(const SQLite::ParameterSet&)>;
+using ContentWriter = std::function<void(SQLite::Connection*, const std::string&)>;
+using BulkDocument = std::pair<Access::DocumentDataPtr, Access::BinaryData>;
+
+/*! \brief How the previous revisions were stored on updates.
+ *
+ * A revision is replaced by a patch against its successor unless it
+ * is kept full, either as a checkpoint or because diffing did not pay
+ * off. FullBytes and PatchBytes sum up the sizes of the patched
+ * revisions before and after.
+ */
+struct PatchStatistics
+{
+    std::uint64_t Patched { 0 };
+    std::uint64_t Checkpoints { 0 };
+    std::uint64_t Dissimilar { 0 };
+    std::uint64_t Expired { 0 };
+    std::uint64_t Oversized { 0 };
+    std::uint64_t FullBytes { 0 };
+    std::uint64_t PatchBytes { 0 };
+};
 
 /*!
  * Implements the 'real' archive operations as commands
@@ -28,8 +57,12 @@ private:
     BucketHandle Buckets_[256];
     const SettingsProvider& Settings_;
     std::vector<BucketHandle> DistinctHandles_;
+    mutable Utils::WorkStealingPool Executor_;
     mutable VirtualTree Folders_;
     Utils::PeriodicTimer Timer_;
+    ContentStore Contents_;
+    mutable std::mutex StatisticsGuard_;
+    mutable PatchStatistics Statistics_;
 
 private:
     void InitializeBuckets();
@@ -39,15 +72,25 @@ private:
     std::vector<Access::FolderInfo> ReadBranches(const std::string& startWith);
     BucketHandle FetchBucket(const std::string& value) const;
     void ReadOnlyDenied(const std::string& user) const;
-    void InsertIntoDatabase(const Access::DocumentDataPtr& document, const Access::BinaryData& data, const std::string& comment) const;
-    void UpdateInDatabase(const Access::DocumentDataPtr& document, const Access::BinaryData& data, const std::string& user, const std::string& comment) const;
+    std::size_t BucketIndex(const BucketHandle& handle) const;
+    std::future<void> Store(const Access::DocumentDataPtr& document, const std::shared_ptr<const Access::BinaryData>& data, const std::string& user, const std::string& comment) const;
+    std::future<void> InsertIntoDatabase(const Access::DocumentDataPtr& document, const std::shared_ptr<const Access::BinaryData>& data, const std::string& comment) const;
+    std::future<void> InsertIntoDatabase(const Access::DocumentDataPtr& document, const std::string& comment, const std::string& checksum, const ContentWriter& writer) const;
+    void QueueInsert(TransformerQueue& actions, std::vector<Common::PersistablePtr>& rows, const Access::DocumentDataPtr& document, const std::string& comment, const std::string& checksum, const ContentWriter& writer) const;
+    std::future<void> UpdateInDatabase(const Access::DocumentDataPtr& document, const std::shared_ptr<const Access::BinaryData>& data, const std::string& user, const std::string& comment) const;
+    bool CreatePatch(const Access::BinaryData& data, const Access::BinaryData& oldData, const Codec& codec, bool optional, Access::BinaryData& patch) const;
     Access::DocumentDataPtr Fetch(BucketHandle handle, const std::string& id) const;
     Access::DocumentDataPtr FetchChecked(BucketHandle handle, const std::string& id, const std::string& user) const;
     int LatestRevision(SQLite::Connection* connection, const std::string& id) const;
     Access::DocumentContentPtr LatestContent(SQLite::Connection* connection, const std::string& id) const;
+    Access::DocumentContentPtr LatestContentHeader(SQLite::Connection* connection, const std::string& id) const;
+    std::vector<Access::DocumentContentPtr> RevisionChain(const std::string& id, const std::string& user, int revision) const;
+    std::vector<Access::DocumentContentPtr> RevisionChain(SQLite::Connection* connection, const std::string& id, int revision) const;
+    void CalculateHashes(const BucketHandle& handle) const;
+    void CompactRevisions(const BucketHandle& handle) const;
     Access::DocumentAssignmentPtr Fetch(SQLite::Connection* connection, const std::string& id, const std::string& path) const;
     void Optimizer();
-    std::vector<Access::DocumentDataPtr> DocumentStorage::FetchFromAll(const std::string& query) const;
+    std::vector<Access::DocumentDataPtr> DocumentStorage::FetchFromAll(const std::string& query, const ParameterBinder& binder = ParameterBinder()) const;
     
 public:
     /*!
@@ -99,6 +142,19 @@ public:
      */
     Access::DocumentDataPtr Load(const std::string& id, const std::string& user) const;
     void Save(const Access::DocumentDataPtr& document, const Access::BinaryData& data, const std::string& user, const std::string& comment = "");
+
+    /*! \brief Save many documents at once.
+     *
+     * Meant for mass imports. The new documents are grouped by bucket,
+     * each group is inserted in batches of BulkBatchSize documents and
+     * the buckets are written in parallel. The folder tree is updated
+     * once all batches are stored. Documents with an id are updated
+     * like by Save.
+     * \param documents Headers with their content.
+     * \param user Originator of the operation.
+     * \param comment Comment of the revisions.
+     */
+    void SaveMany(const std::vector<BulkDocument>& documents, const std::string& user, const std::string& comment = "");
     void Lock(const std::string& id, const std::string& user) const;
     void Unlock(const std::string& id, const std::string& user) const;
     Access::DocumentDataPtr FindById(const std::string& id, int number = 0) const;
@@ -141,7 +197,131 @@ public:
     std::vector<std::string> ListMetaTags(const std::string& id) const;
     Access::DocumentContentPtr Read(const std::string& id, const std::string& user) const;
     Access::DocumentContentPtr Read(const std::string& id, const std::string& user, int revision) const;
+
+    /*! \brief Stream a revision.
+     *
+     * The revision is passed to the sink in pieces instead of being
+     * returned. Only the nearest full revision is held in memory as a
+     * whole, the patches up to the requested revision are merged and
+     * applied once.
+     * \param id Id of the document.
+     * \param user Originator of the operation.
+     * \param revision The revision to read.
+     * \param sink Receives the content.
+     * \return The header of the revision, without content.
+     */
+    Access::DocumentContentPtr Stream(const std::string& id, const std::string& user, int revision, const BinaryData::Sink& sink) const;
+
+    /*! \brief Read a part of the latest revision.
+     *
+     * Only the requested byte window is loaded from the database,
+     * large documents can be fetched in chunks this way.
+     * \param id Id of the document.
+     * \param user Originator of the operation.
+     * \param offset Position of the first byte to read.
+     * \param length Maximum amount of bytes to read.
+     * \return The content, holding less than length bytes at the end of the data.
+     */
+    Access::DocumentContentPtr Read(const std::string& id, const std::string& user, int offset, int length) const;
     std::vector<Access::DocumentHistoryEntryPtr> Revisions(const std::string& id) const;
+
+    /*! \brief Recalculate stored checksums.
+     *
+     * Every revision of every document is rebuilt from its deltas and
+     * hashed, stored checksums which differ are replaced. The buckets
+     * are processed in parallel.
+     */
+    void CalculateHashes() const;
+
+    /*! \brief Shorten the patch chains of old revisions.
+     *
+     * Every revision which is a multiple of the compaction span gets a
+     * patch against the next such revision, merged from the patches in
+     * between. Runs with the optimizer, does nothing if the span given
+     * by the settings is less than 2.
+     */
+    void CompactRevisions() const;
+
+    /*! \brief Counters of the patch decisions.
+     *
+     * \return How the previous revisions were stored on updates since
+     * the storage has been created.
+     */
+    PatchStatistics PatchUsage() const;
+
+    /*! \brief Counters of the workers querying all buckets.
+     *
+     * Searches and the optimizer run their per bucket queries there,
+     * each bucket preferring the same worker.
+     * \return Queue depths and task counts since the storage has been
+     * created.
+     */
+    Utils::WorkStealingPool::Statistics QueryUsage() const;
+
+    /*! \brief Commit counters summed over all buckets.
+     *
+     * \return How many transactions the mutations since the storage
+     * has been created were committed in.
+     */
+    CommitStatistics CommitUsage() const;
+
+public:
+    /*! \brief Load a header without blocking the caller.
+     *
+     * The asynchronous variants return as soon as the operation is
+     * queued. Reads run on the query workers, preferring the worker of
+     * the document's bucket, mutations are queued to the writer of the
+     * bucket and committed with the other mutations pending there.
+     * Errors of the operation are delivered through the future, a
+     * denied user or a malformed id is thrown right away. The searches
+     * over all buckets have no asynchronous variant, they wait for the
+     * same workers.
+     * \param id Id of a known document.
+     * \param user Login of requesting user.
+     * \return Future receiving the header.
+     */
+    std::future<Access::DocumentDataPtr> LoadAsync(const std::string& id, const std::string& user) const;
+    std::future<Access::DocumentDataPtr> FindByIdAsync(const std::string& id, int number = 0) const;
+    std::future<Access::DocumentContentPtr> ReadAsync(const std::string& id, const std::string& user) const;
+    std::future<Access::DocumentContentPtr> ReadAsync(const std::string& id, const std::string& user, int revision) const;
+    std::future<Access::DocumentContentPtr> ReadAsync(const std::string& id, const std::string& user, int offset, int length) const;
+    std::future<std::vector<Access::DocumentHistoryEntryPtr>> RevisionsAsync(const std::string& id) const;
+
+    /*! \brief Save a document without blocking the caller.
+     *
+     * The content is moved into the queued mutation. A new document
+     * gets its id before returning, the header must not be changed
+     * until the future is ready.
+     * \param document Header of the document, an empty id creates it.
+     * \param data The new content, empty keeps the latest revision.
+     * \param user Originator of the operation.
+     * \param comment Comment of the revision.
+     * \return Future signaling the commit.
+     */
+    std::future<void> SaveAsync(const Access::DocumentDataPtr& document, Access::BinaryData data, const std::string& user, const std::string& comment = "");
+    std::future<void> LockAsync(const std::string& id, const std::string& user) const;
+    std::future<void> UnlockAsync(const std::string& id, const std::string& user) const;
+    std::future<void> MoveAsync(const std::string& id, const std::string& oldPath, const std::string& newPath, const std::string& user) const;
+    std::future<void> LinkAsync(const std::string& id, const std::string& sourcePath, const std::string& targetPath, const std::string& user) const;
+    /*! \brief Queues a copy of a document to another folder.
+     *
+     * The source is read before returning, the clone gets the revision
+     * which was the latest at that time.
+     * \param id Id of the document to copy.
+     * \param sourcePath Folder the document is assigned to.
+     * \param targetPath Folder of the copy.
+     * \param user Originator of the operation.
+     * \return Future signaling the commit.
+     */
+    std::future<void> CopyAsync(const std::string& id, const std::string& sourcePath, const std::string& targetPath, const std::string& user) const;
+    std::future<void> AssociateAsync(const std::string& id, const std::string& path, const std::string& item, const std::string& type, const std::string& user) const;
+    std::future<void> DestroyAsync(const std::string& id, const std::string& user) const;
+    std::future<void> DeleteAsync(const std::string& id, const std::string& user) const;
+    std::future<void> UndeleteAsync(const std::string& id, const std::string& user) const;
+    std::future<void> RenameAsync(const std::string& id, const std::string& user, const std::string& display) const;
+    std::future<void> AssignKeywordsAsync(const std::string& id, const std::string& keywords, const std::string& user) const;
+    std::future<void> AssignMetaDataAsync(const std::string& id, const std::string& data, const std::string& user) const;
+    std::future<void> ReplaceMetaDataAsync(const std::string& id, const std::string& data, const std::string& user) const;
 };
 
 } // Backend
@@ -2,6 +2,7 @@
 #define  SETTINGS_PROVIDER_HXX
 
 #include <string>
+#include "codec.hxx"
 
 namespace Archive
 {
@@ -14,6 +15,17 @@ public:
     virtual const std::string& DataLocation() const = 0;
     virtual int Backends() const { return 1; }
     virtual const std::string FulltextFile() const;
+    virtual int ContentChunkSize() const { return 0; }
+    virtual int ContentCheckpointInterval() const { return 0; }
+    virtual int ContentCompactionSpan() const { return 0; }
+    virtual Codec PatchCodec(int bucket) const { return Codec(); }
+    virtual int PatchChunkingThreshold() const { return 256 << 20; }
+    virtual int PatchSimilarityPercent() const { return 5; }
+    virtual int PatchTimeBudget() const { return 30000; }
+    virtual int ReaderConnections() const { return 4; }
+    virtual int QueryWorkers() const { return 0; }
+    virtual int BulkBatchSize() const { return 500; }
+    virtual Codec ContentCodec() const { return Codec(Codec::Store); }
 };
 
 } // namespace Backend
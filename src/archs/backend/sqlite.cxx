@@ -1,8 +1,10 @@
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <initializer_list>
+#include <list>
+#include <mutex>
 #include <unordered_map>
-#include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include "sqlite.hxx"
@@ -83,6 +85,242 @@ int CheckAndThrow(int code, const initializer_list<int>& accepted, sqlite3* hand
 #define CHECKS_AND_THROW(op, list, handle) CheckAndThrow(op, list, handle, __LINE__, __FILE__)
 #define THROW(msg) throw sqlite_exception(msg, SQLITE_ERROR, __LINE__, __FILE__);
 
+inline unsigned char Lower(char value)
+{
+    return static_cast<unsigned char>(value >= 'A' && value <= 'Z' ? value - 'A' + 'a' : value);
+}
+
+struct CaseInsensitiveHash
+{
+    size_t operator()(const string& value) const
+    {
+        // FNV-1a over the lower case characters
+        size_t Result = 2166136261u;
+        for (auto Character : value) {
+            Result ^= Lower(Character);
+            Result *= 16777619u;
+        }
+        return Result;
+    }
+};
+
+struct CaseInsensitiveEqual
+{
+    bool operator()(const string& left, const string& right) const
+    {
+        if (left.size() != right.size()) return false;
+        for (size_t Index = 0; Index < left.size(); ++Index) {
+            if (Lower(left[Index]) != Lower(right[Index])) return false;
+        }
+        return true;
+    }
+};
+
+} // anonymous namespace
+
+/*
+ * Maps parameter or column names to their positions.
+ */
+struct Archive::Backend::SQLite::NameIndex : unordered_map<string, int, CaseInsensitiveHash, CaseInsensitiveEqual>
+{ };
+
+namespace
+{
+
+/*
+ * A compiled statement together with the positions
+ * of its named parameters and result columns.
+ */
+struct PreparedStatement
+{
+    string Sql;
+    sqlite3_stmt* Handle;
+    NameIndex Parameters;
+    NameIndex Columns;
+
+    PreparedStatement(sqlite3* connection, const string& sql)
+    : Sql(sql), Handle(nullptr)
+    {
+        CHECK_AND_THROW(sqlite3_prepare_v2(
+            connection,
+            sql.c_str(),
+            -1,
+            &Handle,
+            nullptr
+        ),
+        connection);
+
+        for (int Index = 1; Index <= sqlite3_bind_parameter_count(Handle); ++Index) {
+            auto Name = sqlite3_bind_parameter_name(Handle, Index);
+            if (Name != nullptr) Parameters.emplace(Name + 1, Index);
+        }
+
+        for (int Index = 0; Index < sqlite3_column_count(Handle); ++Index) {
+            Columns.emplace(sqlite3_column_name(Handle, Index), Index);
+        }
+    }
+
+    ~PreparedStatement()
+    {
+        if (Handle != nullptr) sqlite3_finalize(Handle);
+    }
+
+    PreparedStatement(const PreparedStatement&) = delete;
+    void operator= (const PreparedStatement&) = delete;
+};
+
+/*
+ * Idle prepared statements of one connection, keyed by their SQL text.
+ * A command takes a statement out while it is alive and puts it back
+ * when destroyed, the least recently returned one is dropped if the
+ * cache grows beyond its capacity.
+ */
+class StatementCache
+{
+private:
+    using Entry = unique_ptr<PreparedStatement>;
+
+    mutex Sync_;
+    list<Entry> Idle_;
+    unordered_map<string, list<Entry>::iterator> Index_;
+    size_t Capacity_;
+    atomic<uint64_t> Hits_;
+    atomic<uint64_t> Misses_;
+
+public:
+    explicit StatementCache(size_t capacity)
+    : Capacity_(capacity), Hits_(0), Misses_(0)
+    { }
+
+    ~StatementCache()
+    {
+        Clear();
+    }
+
+    StatementCache(const StatementCache&) = delete;
+    void operator= (const StatementCache&) = delete;
+
+    Entry Acquire(const string& sql)
+    {
+        lock_guard<mutex> Lock(Sync_);
+
+        auto Found = Index_.find(sql);
+        if (Found == Index_.end()) {
+            ++Misses_;
+            return nullptr;
+        }
+
+        ++Hits_;
+        auto Result = move(*Found->second);
+        Idle_.erase(Found->second);
+        Index_.erase(Found);
+
+        return Result;
+    }
+
+    void Release(Entry statement)
+    {
+        sqlite3_reset(statement->Handle);
+        sqlite3_clear_bindings(statement->Handle);
+
+        Entry Victim;
+        {
+            lock_guard<mutex> Lock(Sync_);
+
+            if (Capacity_ == 0 || Index_.count(statement->Sql)) {
+                Victim = move(statement);
+            }
+            else {
+                Idle_.push_front(move(statement));
+                Index_[Idle_.front()->Sql] = Idle_.begin();
+
+                if (Idle_.size() > Capacity_) {
+                    Victim = move(Idle_.back());
+                    Index_.erase(Victim->Sql);
+                    Idle_.pop_back();
+                }
+            }
+        }
+    }
+
+    void Clear()
+    {
+        lock_guard<mutex> Lock(Sync_);
+
+        Idle_.clear();
+        Index_.clear();
+    }
+
+    CacheStatistics Usage() const
+    {
+        CacheStatistics Result;
+        Result.Hits = Hits_;
+        Result.Misses = Misses_;
+
+        return Result;
+    }
+};
+
+/*
+ * Assigns a parameter value to its slot within a statement.
+ * Text and blob data are never copied, owned values live
+ * within the parameter until it is assigned again.
+ */
+class Binder : public boost::static_visitor<>
+{
+private:
+    sqlite3_stmt* Handle_;
+    int Index_;
+
+public:
+    Binder(sqlite3_stmt* handle, int index)
+    : Handle_(handle), Index_(index)
+    { }
+
+    void operator()(const boost::blank&) const
+    {
+        sqlite3_bind_null(Handle_, Index_);
+    }
+
+    void operator()(int value) const
+    {
+        sqlite3_bind_int(Handle_, Index_, value);
+    }
+
+    void operator()(int64_t value) const
+    {
+        sqlite3_bind_int64(Handle_, Index_, value);
+    }
+
+    void operator()(double value) const
+    {
+        sqlite3_bind_double(Handle_, Index_, value);
+    }
+
+    void operator()(const Parameter::TextReference& value) const
+    {
+        sqlite3_bind_text(Handle_, Index_, value.Data, value.Size, SQLITE_STATIC);
+    }
+
+    void operator()(const Parameter::BlobReference& value) const
+    {
+        // a null pointer would bind NULL instead of an empty blob
+        if (value.Size == 0) sqlite3_bind_zeroblob(Handle_, Index_, 0);
+        else sqlite3_bind_blob(Handle_, Index_, value.Data, value.Size, SQLITE_STATIC);
+    }
+
+    void operator()(const string& value) const
+    {
+        sqlite3_bind_text(Handle_, Index_, value.c_str(), static_cast<int>(value.size()), SQLITE_STATIC);
+    }
+
+    void operator()(const vector<unsigned char>& value) const
+    {
+        if (value.empty()) sqlite3_bind_zeroblob(Handle_, Index_, 0);
+        else sqlite3_bind_blob(Handle_, Index_, &value[0], static_cast<int>(value.size()), SQLITE_STATIC);
+    }
+};
+
 } // anonymous namespace
 
 struct Connection::Implementation
@@ -92,7 +330,7 @@ struct Connection::Implementation
 #endif
 
     Implementation(Configuration configuration)
-    : Handle(nullptr), Setup(configuration)
+    : Handle(nullptr), Setup(configuration), Statements(make_shared<StatementCache>(max(configuration.StatementCacheSize, 0)))
     {
 #ifdef _DEBUG
     ++ActiveConnections;
@@ -101,7 +339,11 @@ struct Connection::Implementation
 
     ~Implementation()
     {
-        if (Handle != nullptr) sqlite3_close(Handle);
+        Statements->Clear();
+        Statements.reset();
+
+        // Commands outliving their connection finalize their statements later on
+        if (Handle != nullptr) sqlite3_close_v2(Handle);
         Handle = nullptr;
 #ifdef _DEBUG
     --ActiveConnections;
@@ -110,6 +352,8 @@ struct Connection::Implementation
 
     sqlite3* Handle;
     Configuration Setup;
+    shared_ptr<StatementCache> Statements;
+    unsigned Savepoints = 0;
 
     int ReadSingleInteger(const string& sql)
     {
@@ -286,9 +530,10 @@ struct Connection::Implementation
     {
         auto Flags = Setup.ReadOnly
                      ?
-                     SQLITE_OPEN_SHAREDCACHE | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_READONLY
+                     SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_READONLY
                      :
-                     SQLITE_OPEN_SHAREDCACHE | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_READWRITE;
+                     SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_READWRITE;
+        Flags |= Setup.SharedCache ? SQLITE_OPEN_SHAREDCACHE : SQLITE_OPEN_PRIVATECACHE;
 
         CHECK_AND_THROW(sqlite3_open_v2(Setup.Path.c_str(), &Handle, Flags, nullptr), Handle);
         if (Setup.ReadOnly == false) ApplySetup();
@@ -335,11 +580,12 @@ int Connection::Implementation::ActiveConnections = 0;
 
 struct ResultSet::Implementation
 {
-    Implementation(sqlite3_stmt* statement, bool data)
-    : Handle(statement), Data(data)
+    Implementation(sqlite3_stmt* statement, const NameIndex* columns, bool data)
+    : Handle(statement), Columns(columns), Data(data)
     { }
 
     sqlite3_stmt* Handle;
+    const NameIndex* Columns;
     bool Data;
 };
 
@@ -350,7 +596,7 @@ struct Command::Implementation
 #endif
 
     Implementation(Command& owner)
-    : Owner(owner), Handle(nullptr), Parameters(ParameterList)
+    : Owner(owner), Handle(nullptr), Parameters(ParameterList, nullptr)
     {
 #ifdef _DEBUG
     ++ActiveCommands;
@@ -359,8 +605,7 @@ struct Command::Implementation
 
     ~Implementation()
     {
-        if (Handle != nullptr) sqlite3_finalize(Handle);
-        Handle = nullptr;
+        ReleaseStatement();
 #ifdef _DEBUG
     --ActiveCommands;
 #endif
@@ -371,61 +616,50 @@ struct Command::Implementation
 
     Command& Owner;
     sqlite3_stmt* Handle;
+    unique_ptr<PreparedStatement> Prepared;
+    weak_ptr<StatementCache> Cache;
     vector<Parameter> ParameterList;
     ParameterSet Parameters;
 
-    void Prepare(sqlite3* handle, const string& sql)
+    void ReleaseStatement()
     {
-        if (Handle != nullptr) sqlite3_finalize(Handle);
         Handle = nullptr;
+        if (Prepared == nullptr) return;
 
-        CHECK_AND_THROW(sqlite3_prepare_v2(
-            handle,
-            sql.c_str(),
-            -1,
-            &Handle,
-            nullptr
-        ),
-        handle);
+        auto Statements = Cache.lock();
+        if (Statements) {
+            Statements->Release(move(Prepared));
+        }
+        Prepared.reset();
+    }
 
-        for (int Index = 1; Index <= sqlite3_bind_parameter_count(Handle); ++Index) {
-            ParameterList.push_back(Parameter(Owner, sqlite3_bind_parameter_name(Handle, Index), sqlite3_bind_parameter_name(Handle, Index) + 1));
+    void Prepare(sqlite3* handle, const string& sql, const shared_ptr<StatementCache>& cache)
+    {
+        ReleaseStatement();
+        ParameterList.clear();
+
+        Cache = cache;
+        Prepared = cache->Acquire(sql);
+        if (Prepared == nullptr) Prepared.reset(new PreparedStatement(handle, sql));
+
+        Handle = Prepared->Handle;
+        Parameters = ParameterSet(ParameterList, &Prepared->Parameters);
+
+        auto Count = sqlite3_bind_parameter_count(Handle);
+        ParameterList.reserve(Count);
+
+        for (int Index = 1; Index <= Count; ++Index) {
+            ParameterList.push_back(Parameter(Owner, sqlite3_bind_parameter_name(Handle, Index), sqlite3_bind_parameter_name(Handle, Index) + 1, Index));
         }
     }
 
     void BindParameters()
     {
+        // Statements may be reused, start over from a clean state
+        sqlite3_reset(Handle);
+
         for (auto& Item : ParameterList) {
-            if (Item.IsEmpty()) {
-                sqlite3_bind_null(Handle, sqlite3_bind_parameter_index(Handle, Item.RealName_.c_str()));
-            }
-            else if (Item.Value().type() == typeid(int)) {
-                sqlite3_bind_int(Handle, sqlite3_bind_parameter_index(Handle, Item.RealName_.c_str()), boost::any_cast<int>(Item.Value_));
-            }
-            else if (Item.Value().type() == typeid(int64_t)) {
-                sqlite3_bind_int64(Handle, sqlite3_bind_parameter_index(Handle, Item.RealName_.c_str()), boost::any_cast<int64_t>(Item.Value_));
-            }
-            else if (Item.Value().type() == typeid(double)) {
-                sqlite3_bind_double(Handle, sqlite3_bind_parameter_index(Handle, Item.RealName_.c_str()), boost::any_cast<double>(Item.Value_));
-            }
-            else if (Item.Value().type() == typeid(float)) {
-                sqlite3_bind_double(Handle, sqlite3_bind_parameter_index(Handle, Item.RealName_.c_str()), (double)boost::any_cast<float>(Item.Value_));
-            }
-            else if (Item.Value().type() == typeid(string)) {
-                auto& Buffer = boost::any_cast<const string&>(Item.Value_);
-                sqlite3_bind_text(Handle, sqlite3_bind_parameter_index(Handle, Item.RealName_.c_str()), Buffer.c_str(), -1, nullptr);
-            }
-            else if (Item.Value().type() == typeid(vector<unsigned char>)) {
-                auto& Buffer = boost::any_cast<const vector<unsigned char>&>(Item.Value_);
-                const void* Pointer = Buffer.empty() ? nullptr : &Buffer[0];
-                sqlite3_bind_blob(Handle, sqlite3_bind_parameter_index(Handle, Item.RealName_.c_str()), Pointer, Buffer.size(), nullptr);
-            }
-            else if (Item.Value().type() == typeid(const char*)) {
-                sqlite3_bind_text(Handle, sqlite3_bind_parameter_index(Handle, Item.RealName_.c_str()), boost::any_cast<const char*>(Item.Value_), -1, nullptr);
-            }
-            else if (Item.Value().type() == typeid(const void*)) {
-                sqlite3_bind_blob(Handle, sqlite3_bind_parameter_index(Handle, Item.RealName_.c_str()), boost::any_cast<const void*>(Item.Value_), Item.RawSize(), nullptr);
-            }
+            boost::apply_visitor(Binder(Handle, Item.Index()), Item.Value());
         }
     }
 
@@ -466,41 +700,59 @@ int Command::Implementation::ActiveCommands = 0;
 struct Transaction::Implementation
 {
     sqlite3* Handle;
+    string Savepoint;
+};
+
+struct Blob::Implementation
+{
+    Implementation()
+    : Connection(nullptr), Handle(nullptr)
+    { }
+
+    ~Implementation()
+    {
+        if (Handle != nullptr) sqlite3_blob_close(Handle);
+    }
+
+    sqlite3* Connection;
+    sqlite3_blob* Handle;
 };
 
 Parameter::Parameter(const Command& owner)
-: Owner_(owner)
+: Owner_(owner), Index_(0)
 { }
 
-Parameter::Parameter(const Command& owner, const string& realName, const string& name)
-: Owner_(owner), RealName_(realName), Name_(name)
+Parameter::Parameter(const Command& owner, const string& realName, const string& name, int index)
+: Owner_(owner), RealName_(realName), Name_(name), Index_(index)
 { }
 
 void Parameter::SetRawValue(const void* data, int size)
 {
-    Value_ = data;
-    RawSize_ = size;
+    Value_ = BlobReference { data, size };
+}
+
+int Parameter::RawSize() const
+{
+    auto Reference = boost::get<BlobReference>(&Value_);
+    return Reference != nullptr ? Reference->Size : 0;
 }
 
 Parameter& ParameterSet::operator[](const std::string& key) const
 {
-    auto Result = find_if(
-        Parameters_.begin(),
-        Parameters_.end(),
-        [&key](Parameter item) { return boost::algorithm::to_lower_copy(item.Name()) == boost::algorithm::to_lower_copy(key); }
-    );
-    if (Result == Parameters_.end()) throw runtime_error("key not found");
+    if (Index_ == nullptr) throw runtime_error("key not found");
 
-    return const_cast<Parameter&>(*Result);
+    auto Result = Index_->find(key);
+    if (Result == Index_->end()) throw runtime_error("key not found");
+
+    return const_cast<Parameter&>((*Parameters_)[Result->second - 1]);
 }
 
 int ResultRow::ColumnIndex(const std::string& name) const
 {
-    int Index = 0;
-    while (_stricmp(name.c_str(), sqlite3_column_name(Owner_.Inner->Handle, Index)) && Index < sqlite3_column_count(Owner_.Inner->Handle)) ++Index;
-    if (Index == sqlite3_column_count(Owner_.Inner->Handle)) throw runtime_error("key not found");
+    auto Result = Owner_.Inner->Columns->find(name);
+    if (Result == Owner_.Inner->Columns->end()) throw runtime_error("key not found");
 
-    return Index;
+    return Result->second;
 }
 
 template <>
@@ -530,22 +782,46 @@ int64_t ResultRow::Get(int index) const
 template <>
 string ResultRow::Get(const std::string& name) const
 {
-    auto data = sqlite3_column_text(Owner_.Inner->Handle, ColumnIndex(name));
-    return data != nullptr ? reinterpret_cast<const char*>(data) : "";
+    return GetText(ColumnIndex(name)).to_string();
 }
 
 template <>
 string ResultRow::Get(int index) const
 {
-    auto data = sqlite3_column_text(Owner_.Inner->Handle, index);
-    return data != nullptr ? reinterpret_cast<const char*>(data) : "";
+    return GetText(index).to_string();
+}
+
+boost::string_ref ResultRow::GetText(int index) const
+{
+    // the pointer has to be fetched before the size, see sqlite3_column_bytes
+    auto Data = sqlite3_column_text(Owner_.Inner->Handle, index);
+    if (Data == nullptr) return boost::string_ref();
+
+    return boost::string_ref(reinterpret_cast<const char*>(Data), sqlite3_column_bytes(Owner_.Inner->Handle, index));
+}
+
+boost::string_ref ResultRow::GetText(const std::string& name) const
+{
+    return GetText(ColumnIndex(name));
+}
+
+BlobView ResultRow::GetBlobView(int index) const
+{
+    auto Data = static_cast<const unsigned char*>(sqlite3_column_blob(Owner_.Inner->Handle, index));
+    if (Data == nullptr) return BlobView { nullptr, 0 };
+
+    return BlobView { Data, static_cast<size_t>(sqlite3_column_bytes(Owner_.Inner->Handle, index)) };
+}
+
+BlobView ResultRow::GetBlobView(const std::string& name) const
+{
+    return GetBlobView(ColumnIndex(name));
 }
 
 vector<unsigned char> ResultRow::GetBlob(int index) const
 {
-    auto Size = sqlite3_column_bytes(Owner_.Inner->Handle, index);
-    vector<unsigned char> Result((vector<unsigned char>::size_type)Size);
-    if (Size) memcpy(&Result[0], sqlite3_column_blob(Owner_.Inner->Handle, index), Size);
+    vector<unsigned char> Result;
+    GetBlob(index, Result);
 
     return Result;
 }
@@ -555,8 +831,19 @@ vector<unsigned char> ResultRow::GetBlob(const std::string& name) const
     return GetBlob(ColumnIndex(name));
 }
 
+void ResultRow::GetBlob(int index, vector<unsigned char>& target) const
+{
+    auto Data = GetBlobView(index);
+    target.assign(Data.begin(), Data.end());
+}
+
+void ResultRow::GetBlob(const std::string& name, vector<unsigned char>& target) const
+{
+    GetBlob(ColumnIndex(name), target);
+}
+
 ResultSet::ResultSet(const Command& command, bool hasRow)
-: Inner(new Implementation(command.Inner->Handle, hasRow)), Data_(*this)
+: Inner(new Implementation(command.Inner->Handle, &command.Inner->Prepared->Columns, hasRow)), Data_(*this)
 { }
 
 ResultSet::ResultSet(ResultSet&& other)
@@ -677,14 +964,14 @@ void Connection::OpenAlways()
 Command Connection::Create(const string& command) const
 {
     auto Result = Command(command);
-    Result.Inner->Prepare(Inner->Handle, command);
+    Result.Inner->Prepare(Inner->Handle, command, Inner->Statements);
     return Result;
 }
 
 shared_ptr<Command> Connection::CreateFree(const string& command) const
 {
     auto Result = shared_ptr<Command>(new Command(command));
-    Result->Inner->Prepare(Inner->Handle, command);
+    Result->Inner->Prepare(Inner->Handle, command, Inner->Statements);
     return Result;
 }
 
@@ -693,6 +980,16 @@ bool Connection::IsOpen() const
     return Inner->Handle != nullptr;
 }
 
+bool Connection::InTransaction() const
+{
+    return Inner->Handle != nullptr && sqlite3_get_autocommit(Inner->Handle) == 0;
+}
+
+CacheStatistics Connection::StatementCacheUsage() const
+{
+    return Inner->Statements->Usage();
+}
+
 Transaction::Transaction(Transaction&& other)
 : Inner(nullptr)
 {
@@ -714,21 +1011,79 @@ Transaction::~Transaction()
 void Transaction::Commit()
 {
     if (Inner == nullptr || Inner->Handle == nullptr) return;
-    CHECK_AND_THROW(sqlite3_exec(Inner->Handle, "COMMIT", nullptr, nullptr, nullptr), Inner->Handle);
+    auto Statement = Inner->Savepoint.empty() ? string("COMMIT") : "RELEASE " + Inner->Savepoint;
+    CHECK_AND_THROW(sqlite3_exec(Inner->Handle, Statement.c_str(), nullptr, nullptr, nullptr), Inner->Handle);
     Inner->Handle = nullptr;
 }
 
 void Transaction::Rollback()
 {
     if (Inner == nullptr || Inner->Handle == nullptr) return;
-    CHECK_AND_THROW(sqlite3_exec(Inner->Handle, "ROLLBACK", nullptr, nullptr, nullptr), Inner->Handle);
+    auto Statement = Inner->Savepoint.empty() ? string("ROLLBACK") : "ROLLBACK TO " + Inner->Savepoint + "; RELEASE " + Inner->Savepoint;
+    CHECK_AND_THROW(sqlite3_exec(Inner->Handle, Statement.c_str(), nullptr, nullptr, nullptr), Inner->Handle);
     Inner->Handle = nullptr;
 }
 
+Blob::Blob()
+: Inner(new Blob::Implementation())
+{ }
+
+Blob::Blob(Blob&& other)
+: Inner(nullptr)
+{
+    Inner = other.Inner;
+    other.Inner = nullptr;
+}
+
+Blob::~Blob()
+{
+    delete Inner;
+    Inner = nullptr;
+}
+
+int Blob::Size() const
+{
+    return sqlite3_blob_bytes(Inner->Handle);
+}
+
+void Blob::Read(int offset, void* target, int length) const
+{
+    CHECK_AND_THROW(sqlite3_blob_read(Inner->Handle, target, length, offset), Inner->Connection);
+}
+
+vector<unsigned char> Blob::Read(int offset, int length) const
+{
+    if (offset < 0 || length < 0) throw runtime_error("invalid blob range");
+
+    auto Available = max(Size() - offset, 0);
+    vector<unsigned char> Result(static_cast<size_t>(min(length, Available)));
+    if (!Result.empty()) Read(offset, &Result[0], static_cast<int>(Result.size()));
+
+    return Result;
+}
+
+void Blob::Reopen(int64_t row)
+{
+    CHECK_AND_THROW(sqlite3_blob_reopen(Inner->Handle, row), Inner->Connection);
+}
+
+Blob Connection::OpenBlob(const string& table, const string& column, int64_t row) const
+{
+    Blob Result;
+    CHECK_AND_THROW(sqlite3_blob_open(Inner->Handle, "main", table.c_str(), column.c_str(), row, 0, &Result.Inner->Handle), Inner->Handle);
+    Result.Inner->Connection = Inner->Handle;
+
+    return Result;
+}
+
 Transaction Connection::Begin()
 {
     Transaction Result;
-    CHECK_AND_THROW(sqlite3_exec(Inner->Handle, "BEGIN", nullptr, nullptr, nullptr), Inner->Handle);
+
+    // within a transaction a savepoint is used, it is committed or rolled back on its own
+    if (sqlite3_get_autocommit(Inner->Handle) == 0) Result.Inner->Savepoint = "nested" + to_string(++Inner->Savepoints);
+    auto Statement = Result.Inner->Savepoint.empty() ? string("BEGIN") : "SAVEPOINT " + Result.Inner->Savepoint;
+    CHECK_AND_THROW(sqlite3_exec(Inner->Handle, Statement.c_str(), nullptr, nullptr, nullptr), Inner->Handle);
     Result.Inner->Handle = Inner->Handle;
 
     return Result;
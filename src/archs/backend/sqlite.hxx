@@ -1,13 +1,17 @@
 #ifndef SQLITE_HXX
 #define SQLITE_HXX
 
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
 #include <tuple>
 #include <vector>
-#include <boost/any.hpp>
+#include <boost/blank.hpp>
 #include <boost/iterator/iterator_facade.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/variant.hpp>
 
 namespace Archive
 {
@@ -18,25 +22,57 @@ namespace SQLite /*! Minimalistic class wrappers for SQLite databases. */
 
 class Command;
 class ResultSet;
+struct NameIndex;
 
 /*! \brief A parameter within an SQL statement.
  *
  * A parameter has a name and a value (which may be empty). Before
  * executing a query the values from the associated parameters are
  * extracted and assigned to the command.
+ *
+ * Text and blob values passed as lvalues are bound by reference,
+ * the referenced data must stay alive and unchanged until the
+ * command has been executed or its result set has been consumed.
+ * Values passed as rvalues are moved into the parameter.
  */
 class Parameter
 {
 friend class Command;
 
+public:
+    /*! \brief Unowned text data. */
+    struct TextReference
+    {
+        const char* Data;
+        int Size;
+    };
+
+    /*! \brief Unowned blob data. */
+    struct BlobReference
+    {
+        const void* Data;
+        int Size;
+    };
+
+    using ValueType = boost::variant<
+        boost::blank,
+        int,
+        std::int64_t,
+        double,
+        TextReference,
+        BlobReference,
+        std::string,
+        std::vector<unsigned char>
+    >;
+
 private:
     const Command& Owner_;
     std::string RealName_;
     std::string Name_;
-    boost::any Value_;
-    int RawSize_;
+    int Index_;
+    ValueType Value_;
     explicit Parameter(const Command& owner);
-    explicit Parameter(const Command& owner, const std::string& realName, const std::string& name);
+    explicit Parameter(const Command& owner, const std::string& realName, const std::string& name, int index);
 
 public:
     /*! \brief Name of this instance.
@@ -46,14 +82,29 @@ public:
      */
     const std::string& Name() const { return Name_; }
 
+    /*! \brief Position of this instance.
+     *
+     * The one based index within the statement, resolved
+     * while preparing the statement.
+     * \return Index of the parameter.
+     */
+    int Index() const { return Index_; }
+
     /*! \brief Set the value for this instance.
      *
      * Several overloads are available, an unhandled type
      * produces a compile error.
      * \param value Value to assign.
      */
-    template <typename T>
-    void SetValue(T&& value) { Value_ = value; }
+    void SetValue(int value) { Value_ = value; }
+    void SetValue(std::int64_t value) { Value_ = value; }
+    void SetValue(double value) { Value_ = value; }
+    void SetValue(float value) { Value_ = static_cast<double>(value); }
+    void SetValue(const char* value) { Value_ = TextReference { value, -1 }; }
+    void SetValue(const std::string& value) { Value_ = TextReference { value.c_str(), static_cast<int>(value.size()) }; }
+    void SetValue(std::string&& value) { Value_ = std::move(value); }
+    void SetValue(const std::vector<unsigned char>& value) { Value_ = BlobReference { value.empty() ? nullptr : &value[0], static_cast<int>(value.size()) }; }
+    void SetValue(std::vector<unsigned char>&& value) { Value_ = std::move(value); }
 
     /*! \brief Set a blob value for this instance.
      *
@@ -65,23 +116,23 @@ public:
 
     /*! \brief Read Value from instance.
      *
-     * Use the boost any routines to fetch the 'real' value.
+     * Use the boost variant routines to fetch the 'real' value.
      * \return Value of this.
      */
-    const boost::any& Value() const { return Value_; }
+    const ValueType& Value() const { return Value_; }
 
     /*! \brief Clear value of instance.
      *
      * Resets this instance to its default, which is empty.
      */
-    void Clear() { Value_ = boost::any(); }
+    void Clear() { Value_ = boost::blank(); }
 
     /*! \brief State of this.
      *
      * Empty is the default state.
      * \return true if empty, false otherwise
      */
-    bool IsEmpty() const { return Value_.empty(); }
+    bool IsEmpty() const { return Value_.which() == 0; }
 
     /*! \brief Size of blob data.
      *
@@ -89,7 +140,7 @@ public:
      * can bet fetched using this routine.
      * \return Size of blob data or 0 if this contains no blob data.
      */
-    int RawSize() const { return RawSize_; }
+    int RawSize() const;
 };
 
 /*! \brief The set of parameters of a command.
@@ -100,11 +151,12 @@ public:
 class ParameterSet
 {
 private:
-    const std::vector<Parameter>& Parameters_;
+    const std::vector<Parameter>* Parameters_;
+    const NameIndex* Index_;
 
 public:
-    ParameterSet(const std::vector<Parameter>& parameters)
-    : Parameters_(parameters)
+    ParameterSet(const std::vector<Parameter>& parameters, const NameIndex* index)
+    : Parameters_(&parameters), Index_(index)
     { }
 
     class iterator : public boost::iterator_facade<iterator, const Parameter&, boost::random_access_traversal_tag>
@@ -130,11 +182,33 @@ public:
             const Parameter& dereference() const { return *Position_; }
     };
 
-    iterator begin() const { return iterator(Parameters_.cbegin()); }
-    iterator end() const { return iterator(Parameters_.cend()); }
+    iterator begin() const { return iterator(Parameters_->cbegin()); }
+    iterator end() const { return iterator(Parameters_->cend()); }
+
+    /*! \brief Parameter by name.
+     *
+     * The name lookup is case insensitive and uses an index which
+     * is built once per prepared statement.
+     * \param key Name of the parameter without its prefix.
+     * \return The requested parameter.
+     */
     Parameter& operator[](const std::string& key) const;
 };
 
+/*! \brief Unowned blob data of a result column.
+ *
+ * Points into memory owned by SQLite, see ResultRow::GetBlobView.
+ */
+struct BlobView
+{
+    const unsigned char* Data;
+    std::size_t Size;
+
+    const unsigned char* begin() const { return Data; }
+    const unsigned char* end() const { return Data + Size; }
+    bool empty() const { return Size == 0; }
+};
+
 class ResultRow
 {
 private:
@@ -151,6 +225,43 @@ public:
     template <typename T> T Get(int index) const;
     std::vector<unsigned char> GetBlob(int index) const;
     std::vector<unsigned char> GetBlob(const std::string& name) const;
+
+    /*! \brief Copy blob data into an existing buffer.
+     *
+     * The buffer is resized to the column size, its capacity is
+     * reused, so the data is copied exactly once.
+     * \param index Zero based index of the column.
+     * \param target Buffer receiving the data.
+     */
+    void GetBlob(int index, std::vector<unsigned char>& target) const;
+    void GetBlob(const std::string& name, std::vector<unsigned char>& target) const;
+
+    /*! \brief Text of a column without copying.
+     *
+     * The view points into memory owned by SQLite and is valid
+     * until the result set advances or is destroyed.
+     * \param index Zero based index of the column.
+     * \return The text, empty for NULL.
+     */
+    boost::string_ref GetText(int index) const;
+    boost::string_ref GetText(const std::string& name) const;
+
+    /*! \brief Blob data of a column without copying.
+     *
+     * Same lifetime rules as GetText apply.
+     * \param index Zero based index of the column.
+     * \return The data, empty for NULL.
+     */
+    BlobView GetBlobView(int index) const;
+    BlobView GetBlobView(const std::string& name) const;
+
+    /*! \brief Position of a named column.
+     *
+     * Case insensitive lookup using an index which is
+     * built once per prepared statement.
+     * \param name Name of the column.
+     * \return Zero based index of the column.
+     */
     int ColumnIndex(const std::string& name) const;
 };
 
@@ -240,6 +351,59 @@ public:
     void Rollback();
 };
 
+/*! \brief Incremental access to a single blob value.
+ *
+ * Reads byte ranges of a blob without loading the whole value
+ * into memory. The handle becomes invalid if the row is changed
+ * or deleted, reading from it afterwards throws.
+ */
+class Blob
+{
+friend class Connection;
+
+private:
+    struct Implementation;
+    Implementation* Inner;
+
+    Blob();
+
+public:
+    Blob(const Blob& other) = delete;
+    void operator= (const Blob& other) = delete;
+    Blob(Blob&& other);
+    ~Blob();
+
+    /*! \brief Size of the blob.
+     *
+     * \return Length of the blob in bytes.
+     */
+    int Size() const;
+
+    /*! \brief Read a byte range.
+     *
+     * The range must lie within the blob.
+     * \param offset Position of the first byte to read.
+     * \param target Buffer receiving the data.
+     * \param length Amount of bytes to read.
+     */
+    void Read(int offset, void* target, int length) const;
+
+    /*! \brief Read a byte range.
+     *
+     * The range is clipped to the size of the blob.
+     * \param offset Position of the first byte to read.
+     * \param length Maximum amount of bytes to read.
+     * \return The data read, empty if offset is beyond the end.
+     */
+    std::vector<unsigned char> Read(int offset, int length) const;
+
+    /*! \brief Move to another row of the same table and column.
+     *
+     * \param row Rowid of the new row.
+     */
+    void Reopen(std::int64_t row);
+};
+
 struct Configuration
 {
     enum class JournalMode
@@ -267,6 +431,19 @@ struct Configuration
     int MaxPageCount { 0 };
     int PageSize { 4096 };
     bool ReadOnly { false };
+    bool SharedCache { true };
+    int StatementCacheSize { 64 };
+};
+
+/*! \brief Usage counters of a statement cache.
+ *
+ * Every command created from a connection either reuses an
+ * idle prepared statement (hit) or has to compile its SQL (miss).
+ */
+struct CacheStatistics
+{
+    std::uint64_t Hits { 0 };
+    std::uint64_t Misses { 0 };
 };
 
 class Connection
@@ -286,8 +463,35 @@ public:
     void OpenAlways();
     Command Create(const std::string& command) const;
     std::shared_ptr<Command> CreateFree(const std::string& command) const;
+    /*! \brief Start a transaction.
+     *
+     * Within a transaction a savepoint is started instead, committing
+     * or rolling it back leaves the enclosing transaction open.
+     */
     Transaction Begin();
     bool IsOpen() const;
+
+    /*! \brief Whether a transaction is open, SQLite ends it on its own after some errors. */
+    bool InTransaction() const;
+
+    /*! \brief Open a blob for incremental reading.
+     *
+     * \param table Name of the table.
+     * \param column Name of the blob column.
+     * \param row Rowid of the row.
+     * \return Read only handle to the blob.
+     */
+    Blob OpenBlob(const std::string& table, const std::string& column, std::int64_t row) const;
+
+    /*! \brief Statement cache counters.
+     *
+     * Commands hand their prepared statements back to the connection
+     * when destroyed, creating a command with the same SQL text again
+     * skips the compile step. Up to Configuration::StatementCacheSize
+     * idle statements are kept, the least recently used is dropped first.
+     * \return Hits and misses since the connection has been created.
+     */
+    CacheStatistics StatementCacheUsage() const;
 };
 
 class sqlite_exception : public std::runtime_error
@@ -0,0 +1,164 @@
+#include "suffix_array.hxx"
+#include <algorithm>
+
+using namespace std;
+using namespace Archive::Backend;
+
+namespace {
+
+/*
+ * Induced sorting as described by Nong, Zhang and Chan, using a virtual
+ * sentinel at the end of the text. The sorted array holds size + 1 entries,
+ * the sentinel (empty suffix) always comes first. Empty slots are marked
+ * with -1, so the index type has to be signed.
+ */
+template<typename Char, typename Index>
+class InducedSort
+{
+private:
+    const Char* Text_;
+    Index* Sorted_;
+    Index Size_;
+    vector<bool> Types_;
+    vector<Index> Buckets_;
+    const function<void()>& Check_;
+
+    // every 1M positions, often enough to stop a sort of huge data in time
+    void Poll(Index position) const
+    {
+        if (Check_ && (position & 0xfffff) == 0) Check_();
+    }
+
+    bool IsLms(Index position) const
+    {
+        return position == Size_ || (position > 0 && Types_[position] && Types_[position - 1] == false);
+    }
+
+    bool Differs(Index first, Index second) const
+    {
+        for (Index Offset = 0; ; ++Offset) {
+            if (first + Offset == Size_ || second + Offset == Size_) return true;
+            if (Text_[first + Offset] != Text_[second + Offset] || Types_[first + Offset] != Types_[second + Offset]) return true;
+            if (Offset > 0 && IsLms(first + Offset)) return false;
+        }
+    }
+
+    // counted again on every call, the reduced alphabets can be large
+    void Bucketing(bool ends)
+    {
+        fill(Buckets_.begin(), Buckets_.end(), Index(0));
+        for (Index Position = 0; Position < Size_; ++Position) ++Buckets_[Text_[Position]];
+
+        Index Sum = 1;
+        for (auto& Bucket : Buckets_) {
+            Sum += Bucket;
+            Bucket = ends ? Sum : Sum - Bucket;
+        }
+    }
+
+    void Induce()
+    {
+        Bucketing(false);
+        for (Index Position = 0; Position <= Size_; ++Position) {
+            Poll(Position);
+            auto Previous = Sorted_[Position] - 1;
+            if (Sorted_[Position] > 0 && Types_[Previous] == false) Sorted_[Buckets_[Text_[Previous]]++] = Previous;
+        }
+
+        Bucketing(true);
+        for (Index Position = Size_; Position > 0; --Position) {
+            Poll(Position);
+            auto Previous = Sorted_[Position] - 1;
+            if (Sorted_[Position] > 0 && Types_[Previous]) Sorted_[--Buckets_[Text_[Previous]]] = Previous;
+        }
+    }
+
+public:
+    InducedSort(const Char* text, Index* sorted, Index size, Index alphabet, const function<void()>& check)
+    : Text_(text), Sorted_(sorted), Size_(size), Types_(size + 1), Buckets_(alphabet), Check_(check)
+    { }
+
+    void Sort()
+    {
+        auto SA = Sorted_;
+        SA[0] = Size_;
+        if (Size_ == 0) return;
+
+        Types_[Size_] = true;
+        for (Index Position = Size_ - 1; Position > 0; --Position) {
+            Types_[Position - 1] = Text_[Position - 1] < Text_[Position] || (Text_[Position - 1] == Text_[Position] && Types_[Position]);
+        }
+
+        // sort the LMS substrings
+        fill(SA + 1, SA + Size_ + 1, Index(-1));
+        Bucketing(true);
+        for (Index Position = 1; Position < Size_; ++Position) {
+            if (IsLms(Position)) SA[--Buckets_[Text_[Position]]] = Position;
+        }
+        Induce();
+
+        Index Count = 0;
+        for (Index Position = 0; Position <= Size_; ++Position) {
+            if (IsLms(SA[Position])) SA[Count++] = SA[Position];
+        }
+
+        // name them, LMS positions are at least two apart
+        fill(SA + Count, SA + Size_ + 1, Index(-1));
+        Index Names = 0;
+        Index Last = -1;
+        for (Index Rank = 0; Rank < Count; ++Rank) {
+            auto Position = SA[Rank];
+            if (Last < 0 || Differs(Position, Last)) {
+                ++Names;
+                Last = Position;
+            }
+            SA[Count + Position / 2] = Names - 1;
+        }
+
+        // reduced text in front of the sentinel name at the end of the array
+        auto Reduced = SA + Size_ + 1 - Count;
+        for (Index Source = Size_, Target = Size_; Source >= Count; --Source) {
+            if (SA[Source] >= 0) SA[Target--] = SA[Source];
+        }
+
+        auto Length = Count - 1;
+        for (Index Position = 0; Position < Length; ++Position) --Reduced[Position];
+
+        if (Names < Count) {
+            InducedSort<Index, Index>(Reduced, SA, Length, Names - 1, Check_).Sort();
+        }
+        else {
+            for (Index Position = 0; Position < Length; ++Position) SA[Reduced[Position] + 1] = Position;
+            SA[0] = Length;
+        }
+
+        // sorted LMS suffixes seed the final pass
+        for (Index Position = 1, Target = 0; Position < Size_; ++Position) {
+            if (IsLms(Position)) Reduced[Target++] = Position;
+        }
+        for (Index Rank = 1; Rank < Count; ++Rank) SA[Rank] = Reduced[SA[Rank]];
+        SA[0] = Size_;
+        fill(SA + Count, SA + Size_ + 1, Index(-1));
+
+        Bucketing(true);
+        for (Index Rank = Count - 1; Rank > 0; --Rank) {
+            auto Position = SA[Rank];
+            SA[Rank] = -1;
+            SA[--Buckets_[Text_[Position]]] = Position;
+        }
+        Induce();
+    }
+};
+
+} // anonymous namespace
+
+template<typename Index>
+vector<Index> SuffixArray::Build(const vector<unsigned char>& data, const function<void()>& check)
+{
+    vector<Index> Result(data.size() + 1);
+    InducedSort<unsigned char, Index>(data.data(), Result.data(), static_cast<Index>(data.size()), 256, check).Sort();
+    return Result;
+}
+
+template vector<int32_t> SuffixArray::Build<int32_t>(const vector<unsigned char>& data, const function<void()>& check);
+template vector<int64_t> SuffixArray::Build<int64_t>(const vector<unsigned char>& data, const function<void()>& check);
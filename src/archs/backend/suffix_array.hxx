@@ -0,0 +1,40 @@
+#ifndef SUFFIX_ARRAY_HXX
+#define SUFFIX_ARRAY_HXX
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Archive
+{
+namespace Backend
+{
+
+/*! \brief Suffix array construction by induced sorting (SA-IS).
+ *
+ * Runs in linear time and needs one index per input byte plus a bit
+ * vector of suffix types, recursion levels work on at most half of
+ * the input. The result matches the sort order of the qsufsort
+ * routine of bsdiff, so patches created from it are identical.
+ */
+class SuffixArray
+{
+public:
+    /*! \brief Sort all suffixes of the data.
+     *
+     * Instantiated for std::int32_t and std::int64_t, the 32 bit variant
+     * requires the data to be smaller than 2 GB.
+     * \param data Data to sort.
+     * \param check Called regularly during the induce passes, may throw to
+     * abort the construction.
+     * \return Start positions of the suffixes in ascending order, the
+     * first entry is the empty suffix at position data.size().
+     */
+    template<typename Index>
+    static std::vector<Index> Build(const std::vector<unsigned char>& data, const std::function<void()>& check = nullptr);
+};
+
+} // namespace Backend
+} // namespace Archive
+
+#endif
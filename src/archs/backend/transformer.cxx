@@ -179,9 +179,14 @@ void TransformerQueue::Flush()
         Cache[Key]->Update(*Update);
     }
     
+    for (auto& Action : Actions_) {
+        Action(Connection_);
+    }
+    
     Deletes_.clear();
     Updates_.clear();
     Inserts_.clear();
+    Actions_.clear();
     
     Scope.Commit();
 }
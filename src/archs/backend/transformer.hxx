@@ -88,6 +88,7 @@ private:
     std::vector<const Common::Persistable*> Deletes_;
     std::vector<const Common::Persistable*> Updates_;
     std::vector<const Common::Persistable*> Inserts_;
+    std::vector<std::function<void(SQLite::Connection*)>> Actions_;
 
 public:
     TransformerQueue(SQLite::Connection* Connection_);
@@ -106,6 +107,11 @@ public:
     {
         Deletes_.push_back(&item);
     }
+
+    void Execute(std::function<void(SQLite::Connection*)> action)
+    {
+        Actions_.push_back(action);
+    }
     
     void Flush();
 };
@@ -114,6 +114,21 @@ void VirtualTree::AddUncounted(const string& path)
     ++Cursor->References_;
 }
 
+void VirtualTree::Add(const map<string, int>& documents, const map<string, int>& references)
+{
+    LockType Lock(SyncRoot_);
+    auto Walk = [this](const string& path) {
+        auto Cursor = &Root_;
+        for (auto& Part : Utils::Split(path)) {
+            auto Where = Cursor->Children_.find(Part);
+            Cursor = Where != Cursor->Children_.end() ? Where->second : new VirtualFolder(Part, Cursor);
+        }
+        return Cursor;
+    };
+
+    for (auto& Entry : documents) Walk(Entry.first)->Documents_ += Entry.second;
+    for (auto& Entry : references) Walk(Entry.first)->References_ += Entry.second;
+}
 
 vector<FolderInfo> VirtualTree::Content(const string& path) const
 {
@@ -81,6 +81,13 @@ public:
     void Load(const std::vector<Access::FolderInfo>& entries);
     void Add(const std::string& path);
     void AddUncounted(const std::string& path);
+
+    /*! \brief Adds the folders of many documents under one lock.
+     *
+     * \param documents Count of documents to add per folder path.
+     * \param references Count of directory entries to add per folder path.
+     */
+    void Add(const std::map<std::string, int>& documents, const std::map<std::string, int>& references);
     std::vector<FolderInfo> Content(const std::string& path) const;
     void Remove(const std::string& path);
     void RemoveUncounted(const std::string& path);
@@ -0,0 +1,123 @@
+/*
+ * Throughput of the byte kernels and of diffing and patching with each
+ * instruction set level the processor supports.
+ *
+ * usage: kernel_bench [old-file new-file]
+ *
+ * Without files two office like documents are generated, markup text
+ * and markup text with embedded compressed images, each with a revision
+ * edited in many places.
+ */
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include "archs/backend/binary_data.hxx"
+#include "archs/backend/byte_kernels.hxx"
+
+using namespace std;
+using namespace Archive::Backend;
+
+namespace {
+
+struct Document
+{
+    string Name;
+    vector<unsigned char> Old;
+    vector<unsigned char> New;
+};
+
+vector<unsigned char> ReadFile(const string& path)
+{
+    ifstream Input(path, ios::binary);
+    return vector<unsigned char>(istreambuf_iterator<char>(Input), istreambuf_iterator<char>());
+}
+
+Document Generate(const string& name, size_t size, bool images)
+{
+    const vector<string> Words { "the", "quarterly", "report", "shows", "revenue", "growth", "in", "all", "regions", "and", "a", "decline", "of", "costs", "for", "customers" };
+    mt19937 Random(11);
+
+    Document Result { name, {}, {} };
+    auto Append = [&Result](const string& text) { Result.Old.insert(Result.Old.end(), text.begin(), text.end()); };
+    while (Result.Old.size() < size) {
+        Append("<w:p><w:r><w:rPr><w:b/><w:sz w:val=\"24\"/></w:rPr><w:t>");
+        for (auto Count = 5 + Random() % 30; Count > 0; --Count) Append(Words[Random() % Words.size()] + " ");
+        Append("</w:t></w:r></w:p>\n");
+
+        if (images && Random() % 100 == 0) {
+            for (auto Count = 16384 + Random() % 65536; Count > 0; --Count) Result.Old.push_back(static_cast<unsigned char>(Random()));
+        }
+    }
+
+    // a word changed or a sentence inserted every few KB
+    Result.New = Result.Old;
+    for (size_t Position = 1000; Position < Result.New.size(); Position += 2000 + Random() % 30000) {
+        if (Random() % 2) {
+            string Sentence = "<w:t>inserted remark " + to_string(Position) + "</w:t>";
+            Result.New.insert(Result.New.begin() + Position, Sentence.begin(), Sentence.end());
+        }
+        else Result.New[Position] ^= 0x20;
+    }
+
+    return Result;
+}
+
+template<typename Action>
+double Throughput(size_t size, Action action)
+{
+    auto Started = chrono::steady_clock::now();
+    action();
+    auto Elapsed = chrono::duration<double>(chrono::steady_clock::now() - Started).count();
+    return size / Elapsed / (1 << 20);
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    vector<Document> Documents;
+    if (argc > 2) Documents.push_back(Document { argv[2], ReadFile(argv[1]), ReadFile(argv[2]) });
+    else {
+        Documents.push_back(Generate("markup", 16 << 20, false));
+        Documents.push_back(Generate("markup with images", 16 << 20, true));
+    }
+
+    cout << "supported: " << ByteKernels::Name(ByteKernels::Supported()) << "\n";
+
+    auto Consistent = true;
+    for (auto& Item : Documents) {
+        cout << "\n" << Item.Name << ", " << Item.Old.size() << " -> " << Item.New.size() << " bytes\n";
+        auto Size = min(Item.Old.size(), Item.New.size());
+        vector<unsigned char> Target(Size);
+        vector<unsigned char> Reference;
+
+        for (int Level = ByteKernels::Scalar; Level <= ByteKernels::Supported(); ++Level) {
+            ByteKernels::Use(static_cast<ByteKernels::Level>(Level));
+            const int Rounds = 20;
+
+            // equal buffers, so the match length runs to the end
+            auto Match = Throughput(Size * Rounds, [&Item, Size]() { for (int Round = 0; Round < Rounds; ++Round) ByteKernels::MatchLength(Item.Old.data(), Item.Old.data(), Size); });
+            auto Count = Throughput(Size * Rounds, [&Item, Size]() { for (int Round = 0; Round < Rounds; ++Round) ByteKernels::CountEqual(Item.Old.data(), Item.New.data(), Size); });
+            auto Subtract = Throughput(Size * Rounds, [&Item, &Target, Size]() { for (int Round = 0; Round < Rounds; ++Round) ByteKernels::Subtract(Target.data(), Item.New.data(), Item.Old.data(), Size); });
+            auto Add = Throughput(Size * Rounds, [&Item, &Target, Size]() { for (int Round = 0; Round < Rounds; ++Round) ByteKernels::Add(Target.data(), Item.Old.data(), Size); });
+
+            vector<unsigned char> Patch, Result;
+            auto Diff = Throughput(Item.New.size(), [&Item, &Patch]() { Patch = BinaryData::CreatePatch(Item.Old, Item.New, Codec(Codec::Lz4)); });
+            auto Apply = Throughput(Item.New.size(), [&Item, &Patch, &Result]() { BinaryData::ApplyPatch(Item.Old, Patch, Result); });
+
+            if (Reference.empty()) Reference = Patch;
+            Consistent = Consistent && Patch == Reference && Result == Item.New;
+
+            cout << ByteKernels::Name(ByteKernels::Active()) << ": match " << Match << " MB/s, count " << Count << " MB/s, subtract " << Subtract
+                 << " MB/s, add " << Add << " MB/s, diff " << Diff << " MB/s, patch " << Apply << " MB/s, " << Patch.size() << " bytes\n";
+        }
+    }
+
+    cout << (Consistent ? "\nidentical patches\n" : "\nPATCHES DIFFER\n");
+    return Consistent ? 0 : 1;
+}
@@ -0,0 +1,310 @@
+/*
+ * Performance of diffing, patching and reading revision chains on
+ * generated documents. Every corpus is derived from a fixed seed, so runs
+ * on different builds compare the same data.
+ *
+ * usage: delta_bench [megabytes]
+ *
+ * Documents from 1 KB up to the given size, at most 500 MB, default 16,
+ * are generated in three kinds: markup text with words edited, PDF like
+ * files growing by incremental updates appended at the end, and random
+ * data with blocks rewritten.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include "archs/backend/binary_data.hxx"
+#include "archs/backend/document_storage.hxx"
+#include "archs/backend/settings_provider.hxx"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+using namespace Archive::Backend;
+
+namespace {
+
+// the delta engine allocates from worker threads
+atomic<size_t> Allocated(0);
+atomic<size_t> Peak(0);
+
+} // anonymous namespace
+
+void* operator new(size_t size)
+{
+    auto Block = static_cast<size_t*>(malloc(size + sizeof(size_t)));
+    if (Block == nullptr) throw bad_alloc();
+    *Block = size;
+    auto Total = Allocated += size;
+    if (Total > Peak) Peak = Total;
+    return Block + 1;
+}
+
+void operator delete(void* data) noexcept
+{
+    if (data == nullptr) return;
+    auto Block = static_cast<size_t*>(data) - 1;
+    Allocated -= *Block;
+    free(Block);
+}
+
+namespace {
+
+using Data = vector<unsigned char>;
+
+enum Kind
+{
+    TextEdits,
+    PdfAppends,
+    RandomRewrites
+};
+
+const char* Name(Kind kind)
+{
+    switch (kind) {
+    case TextEdits: return "text edits";
+    case PdfAppends: return "pdf appends";
+    case RandomRewrites: return "random rewrites";
+    }
+    return "unknown";
+}
+
+class BenchProvider : public SettingsProvider
+{
+private:
+    string DataLocation_;
+
+public:
+    BenchProvider()
+    : DataLocation_(boost::filesystem::path("./bdata").string())
+    {
+        boost::filesystem::remove_all(DataLocation_);
+    }
+
+    ~BenchProvider()
+    {
+        boost::filesystem::remove_all(DataLocation_);
+    }
+
+    const string& DataLocation() const override
+    {
+        return DataLocation_;
+    }
+};
+
+void Append(Data& data, const string& text)
+{
+    data.insert(data.end(), text.begin(), text.end());
+}
+
+void AppendRandom(Data& data, size_t size, mt19937& random)
+{
+    for (; size > 0; --size) data.push_back(static_cast<unsigned char>(random()));
+}
+
+string Sentence(mt19937& random)
+{
+    static const vector<string> Words { "the", "quarterly", "report", "shows", "revenue", "growth", "in", "all", "regions", "and", "a", "decline", "of", "costs", "for", "customers" };
+    string Result;
+    for (auto Count = 5 + random() % 30; Count > 0; --Count) Result += Words[random() % Words.size()] + " ";
+    return Result;
+}
+
+string PdfObject(size_t number, mt19937& random)
+{
+    return to_string(number) + " 0 obj\n<< /Type /Annot /Subtype /Text /Contents (" + Sentence(random) + ") >>\nendobj\n";
+}
+
+Data Generate(Kind kind, size_t size, mt19937& random)
+{
+    Data Result;
+    Result.reserve(size + 4096);
+    switch (kind) {
+    case TextEdits:
+        while (Result.size() < size) Append(Result, "<w:p><w:r><w:t>" + Sentence(random) + "</w:t></w:r></w:p>\n");
+        break;
+    case PdfAppends:
+        // text objects and compressed image streams
+        Append(Result, "%PDF-1.4\n");
+        for (size_t Number = 1; Result.size() < size; ++Number) {
+            if (random() % 8 == 0) {
+                auto Length = min<size_t>(1024 + random() % 32768, size);
+                Append(Result, to_string(Number) + " 0 obj\n<< /Length " + to_string(Length) + " /Filter /FlateDecode >>\nstream\n");
+                AppendRandom(Result, Length, random);
+                Append(Result, "\nendstream\nendobj\n");
+            }
+            else Append(Result, PdfObject(Number, random));
+        }
+        break;
+    case RandomRewrites:
+        AppendRandom(Result, size, random);
+        break;
+    }
+    Result.resize(size);
+    return Result;
+}
+
+Data Revise(Kind kind, const Data& data, mt19937& random)
+{
+    Data Result;
+    switch (kind) {
+    case TextEdits: {
+        // a word changed or a sentence inserted every few KB
+        Result.reserve(data.size() + data.size() / 16);
+        size_t Copied = 0;
+        for (size_t Position = random() % 1024; Position < data.size(); Position += 1024 + random() % 8192) {
+            Result.insert(Result.end(), data.begin() + Copied, data.begin() + Position);
+            Copied = Position;
+            if (random() % 2) Append(Result, "<w:t>" + Sentence(random) + "</w:t>");
+            else {
+                Result.push_back(data[Position] ^ 0x20);
+                ++Copied;
+            }
+        }
+        Result.insert(Result.end(), data.begin() + Copied, data.end());
+        break;
+    }
+    case PdfAppends: {
+        Result = data;
+
+        // an incremental update of about one percent
+        auto Target = Result.size() + max<size_t>(Result.size() / 100, 200);
+        for (size_t Number = 100000 + random() % 100000; Result.size() < Target; ++Number) Append(Result, PdfObject(Number, random));
+        Append(Result, "xref\ntrailer\n<< /Prev " + to_string(data.size()) + " >>\n%%EOF\n");
+        break;
+    }
+    case RandomRewrites:
+        Result = data;
+
+        // a tenth rewritten in blocks of 4 KB
+        for (size_t Count = Result.size() / 40960 + 1; Count > 0; --Count) {
+            auto Position = random() % Result.size();
+            auto End = min(Result.size(), Position + 4096);
+            for (; Position < End; ++Position) Result[Position] = static_cast<unsigned char>(random());
+        }
+        break;
+    }
+    return Result;
+}
+
+double PeakResidentMegabytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS Counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &Counters, sizeof(Counters));
+    return Counters.PeakWorkingSetSize / double(1 << 20);
+#else
+    rusage Usage;
+    getrusage(RUSAGE_SELF, &Usage);
+#ifdef __APPLE__
+    return Usage.ru_maxrss / double(1 << 20);
+#else
+    return Usage.ru_maxrss / double(1 << 10);
+#endif
+#endif
+}
+
+template<typename Action>
+double Measure(Action action, double& peak)
+{
+    size_t Before = Allocated;
+    Peak = Before;
+    auto Started = chrono::steady_clock::now();
+    action();
+    auto Elapsed = chrono::duration<double>(chrono::steady_clock::now() - Started).count();
+    peak = max(peak, (Peak - Before) / double(1 << 20));
+    return Elapsed;
+}
+
+string Size(size_t bytes)
+{
+    return bytes < (1 << 20) ? to_string(bytes >> 10) + " KB" : to_string(bytes >> 20) + " MB";
+}
+
+bool Diff(Kind kind, size_t size, int chunkingThreshold)
+{
+    mt19937 Random(static_cast<unsigned>(kind * 1000 + size % 997));
+    auto Old = Generate(kind, size, Random);
+    auto New = Revise(kind, Old, Random);
+
+    // the engine DocumentStorage picks for this size
+    auto Chunks = New.size() >= static_cast<size_t>(chunkingThreshold);
+    double Heap = 0;
+    Data Patch, Result;
+    auto Diffing = Measure([&]() { Patch = Chunks ? BinaryData::CreateChunkPatch(Old, New) : BinaryData::CreatePatch(Old, New); }, Heap);
+    auto Applying = Measure([&]() { BinaryData::ApplyPatch(Old, Patch, Result); }, Heap);
+
+    cout << setw(16) << Name(kind) << setw(8) << Size(size) << setw(8) << (Chunks ? "chunks" : "suffix")
+         << setw(12) << New.size() / Diffing / (1 << 20) << setw(12) << New.size() / Applying / (1 << 20)
+         << setw(10) << 100.0 * Patch.size() / New.size() << setw(10) << Heap << setw(10) << PeakResidentMegabytes() << "\n";
+    return Result == New;
+}
+
+bool ReadChain(Kind kind, size_t size, int revisions)
+{
+    BenchProvider Settings;
+    DocumentStorage Storage(Settings);
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+
+    mt19937 Random(static_cast<unsigned>(kind));
+    vector<Data> Contents { Generate(kind, size, Random) };
+    for (int Revision = 1; Revision < revisions; ++Revision) Contents.push_back(Revise(kind, Contents.back(), Random));
+
+    double Heap = 0;
+    auto Saving = Measure([&]() { for (auto& Content : Contents) Storage.Save(Header, Content, "bench"); }, Heap);
+    cout << setw(16) << Name(kind) << setw(8) << Size(size) << ", " << revisions << " revisions saved in " << Saving * 1000 << " ms";
+
+    auto Correct = true;
+    for (auto Revision : { 1, revisions / 2, revisions }) {
+        Access::DocumentContentPtr Loaded;
+        auto Reading = Measure([&]() { Loaded = Storage.Read(Header->Id, "bench", Revision); }, Heap);
+        Correct = Correct && Loaded->Content == Contents[Revision - 1];
+        cout << ", read " << Revision << " " << Reading * 1000 << " ms";
+    }
+    cout << ", " << Heap << " MB peak\n";
+    return Correct;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    size_t Limit = static_cast<size_t>(min(argc > 1 ? atoi(argv[1]) : 16, 500)) << 20;
+    vector<size_t> Sizes;
+    for (size_t Size : { 1 << 10, 64 << 10, 1 << 20, 16 << 20, 128 << 20, 500 << 20 }) {
+        if (Size <= max<size_t>(Limit, 1 << 10)) Sizes.push_back(Size);
+    }
+
+    BenchProvider Settings;
+    auto Correct = true;
+
+    cout << fixed << setprecision(2)
+         << setw(16) << "corpus" << setw(8) << "size" << setw(8) << "engine" << setw(12) << "diff MB/s" << setw(12) << "apply MB/s"
+         << setw(10) << "patch %" << setw(10) << "heap MB" << setw(10) << "RSS MB" << "\n";
+    for (auto Kind : { TextEdits, PdfAppends, RandomRewrites }) {
+        for (auto Size : Sizes) Correct = Diff(Kind, Size, Settings.PatchChunkingThreshold()) && Correct;
+    }
+
+    cout << "\nrevision chains\n";
+    for (auto Kind : { TextEdits, PdfAppends, RandomRewrites }) {
+        Correct = ReadChain(Kind, min<size_t>(Sizes.back(), 4 << 20), 24) && Correct;
+    }
+
+    cout << (Correct ? "\nall revisions restored\n" : "\nRESTORED DATA DIFFERS\n");
+    return Correct ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+/*
+ * Decoding speed of result rows whose columns are read by name.
+ *
+ * usage: named_access_bench [rows]
+ *
+ * An in memory table shaped like the document headers is filled with the
+ * given number of rows, default 10000, and read back with every column
+ * looked up by its name.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "archs/backend/sqlite.hxx"
+
+using namespace std;
+using namespace Archive::Backend::SQLite;
+
+int main(int argc, char* argv[])
+{
+    auto Rows = argc > 1 ? atoi(argv[1]) : 10000;
+
+    Configuration Setup;
+    Setup.Path = ":memory:";
+    Connection Target(Setup);
+    Target.OpenNew();
+
+    {
+        auto Command = Target.Create("CREATE TABLE a(Id TEXT, Creator TEXT, Created INT, FileName TEXT, DisplayName TEXT, State INT, Locker TEXT, Keywords TEXT, Size INT)");
+        Command.Execute();
+    }
+    {
+        auto Transaction = Target.Begin();
+        auto Command = Target.Create("INSERT INTO a VALUES (:Id, :Creator, :Created, :FileName, :DisplayName, :State, :Locker, :Keywords, :Size)");
+        for (int Index = 0; Index < Rows; ++Index) {
+            Command.Parameters()["Id"].SetValue(to_string(Index));
+            Command.Parameters()["Creator"].SetValue("willi");
+            Command.Parameters()["Created"].SetValue(Index);
+            Command.Parameters()["FileName"].SetValue("test.xxx");
+            Command.Parameters()["DisplayName"].SetValue("Testing");
+            Command.Parameters()["State"].SetValue(0);
+            Command.Parameters()["Locker"].SetValue("");
+            Command.Parameters()["Keywords"].SetValue("one two three");
+            Command.Parameters()["Size"].SetValue(Index);
+            Command.Execute();
+        }
+        Transaction.Commit();
+    }
+
+    auto Started = chrono::steady_clock::now();
+    int Decoded = 0;
+    {
+        auto Command = Target.Create("SELECT * FROM a");
+        auto Result = Command.Open();
+        for (const ResultRow& Row : Result) {
+            Row.Get<string>("Id");
+            Row.Get<string>("Creator");
+            Row.Get<int>("Created");
+            Row.Get<string>("FileName");
+            Row.Get<string>("DisplayName");
+            Row.Get<int>("State");
+            Row.Get<string>("Locker");
+            Row.Get<string>("Keywords");
+            Row.Get<int>("Size");
+            ++Decoded;
+        }
+    }
+    auto Elapsed = chrono::duration<double>(chrono::steady_clock::now() - Started).count();
+
+    cout << "named access: " << static_cast<long>(Decoded / (Elapsed > 0 ? Elapsed : 1e-9)) << " rows/s\n";
+    return Decoded == Rows ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+/*
+ * Read throughput of one bucket under contention, for several sizes of
+ * the reader connection pool.
+ *
+ * usage: reader_bench [threads [seconds]]
+ *
+ * The client threads, by default one per processor, run Load, FindById
+ * and Read on documents of the same bucket for the given time, default 2
+ * seconds, per pool size.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include "archs/backend/document_storage.hxx"
+#include "archs/backend/settings_provider.hxx"
+
+using namespace std;
+using namespace Archive::Backend;
+
+namespace {
+
+class BenchProvider : public SettingsProvider
+{
+private:
+    string DataLocation_;
+    int Readers_;
+
+public:
+    explicit BenchProvider(int readers)
+    : DataLocation_(boost::filesystem::path("./rdata").string()), Readers_(readers)
+    {
+        boost::filesystem::remove_all(DataLocation_);
+    }
+
+    ~BenchProvider()
+    {
+        boost::filesystem::remove_all(DataLocation_);
+    }
+
+    const string& DataLocation() const override
+    {
+        return DataLocation_;
+    }
+
+    int ReaderConnections() const override { return Readers_; }
+};
+
+double Run(int readers, int threads, chrono::seconds duration)
+{
+    BenchProvider Settings(readers);
+    DocumentStorage Storage(Settings);
+
+    // documents of a few KB, the usual size of office files after compression
+    vector<string> Ids;
+    mt19937 Random(5);
+    for (int Document = 0; Document < 200; ++Document) {
+        Access::BinaryData Content(4096 + Random() % 65536);
+        for (auto& Value : Content) Value = static_cast<unsigned char>(Random());
+
+        Access::DocumentDataPtr Header = new Access::DocumentData();
+        Storage.Save(Header, Content, "bench");
+        Ids.push_back(Header->Id);
+    }
+
+    atomic<bool> Stop(false);
+    atomic<size_t> Operations(0);
+    vector<thread> Clients;
+    for (int Client = 0; Client < threads; ++Client) {
+        Clients.emplace_back([&, Client]() {
+            size_t Count = 0;
+            for (auto Index = static_cast<size_t>(Client); Stop == false; ++Index) {
+                auto& Id = Ids[Index * 7919 % Ids.size()];
+                switch (Index % 3) {
+                case 0: Storage.Load(Id, "bench"); break;
+                case 1: Storage.FindById(Id); break;
+                case 2: Storage.Read(Id, "bench"); break;
+                }
+                ++Count;
+            }
+            Operations += Count;
+        });
+    }
+
+    auto Started = chrono::steady_clock::now();
+    this_thread::sleep_for(duration);
+    Stop = true;
+    for (auto& Client : Clients) Client.join();
+    auto Elapsed = chrono::duration<double>(chrono::steady_clock::now() - Started).count();
+
+    return Operations / Elapsed;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    auto Threads = argc > 1 ? atoi(argv[1]) : static_cast<int>(max(thread::hardware_concurrency(), 1u));
+    auto Duration = chrono::seconds(argc > 2 ? atoi(argv[2]) : 2);
+    cout << Threads << " client threads on one bucket\n";
+
+    double Single = 0;
+    for (auto Readers : { 1, 2, 4, 8, 16 }) {
+        auto Throughput = Run(Readers, Threads, Duration);
+        if (Readers == 1) Single = Throughput;
+        cout << Readers << " readers: " << static_cast<size_t>(Throughput) << " operations/s, " << Throughput / Single << "x\n";
+    }
+
+    return 0;
+}
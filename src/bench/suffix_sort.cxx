@@ -0,0 +1,203 @@
+/*
+ * Compares the suffix sorting used by BinaryData::CreatePatch with the
+ * qsufsort routine of bsdiff it replaced. The legacy code below is a copy
+ * from bsdiff, Copyright 2003-2005 Colin Percival, see binary_data.cxx
+ * for the license.
+ *
+ * usage: suffix_bench [megabytes | file]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "archs/backend/suffix_array.hxx"
+
+using namespace std;
+using namespace Archive::Backend;
+
+namespace {
+
+size_t Allocated = 0;
+size_t Peak = 0;
+
+} // anonymous namespace
+
+void* operator new(size_t size)
+{
+    auto Block = static_cast<size_t*>(malloc(size + sizeof(size_t)));
+    if (Block == nullptr) throw bad_alloc();
+    *Block = size;
+    Allocated += size;
+    Peak = max(Peak, Allocated);
+    return Block + 1;
+}
+
+void operator delete(void* data) noexcept
+{
+    if (data == nullptr) return;
+    auto Block = static_cast<size_t*>(data) - 1;
+    Allocated -= *Block;
+    free(Block);
+}
+
+namespace {
+
+void split(off_t *I,off_t *V,off_t start,off_t len,off_t h)
+{
+	off_t i,j,k,x,tmp,jj,kk;
+
+	if(len<16) {
+		for(k=start;k<start+len;k+=j) {
+			j=1;x=V[I[k]+h];
+			for(i=1;k+i<start+len;i++) {
+				if(V[I[k+i]+h]<x) {
+					x=V[I[k+i]+h];
+					j=0;
+				};
+				if(V[I[k+i]+h]==x) {
+					tmp=I[k+j];I[k+j]=I[k+i];I[k+i]=tmp;
+					j++;
+				};
+			};
+			for(i=0;i<j;i++) V[I[k+i]]=k+j-1;
+			if(j==1) I[k]=-1;
+		};
+		return;
+	};
+
+	x=V[I[start+len/2]+h];
+	jj=0;kk=0;
+	for(i=start;i<start+len;i++) {
+		if(V[I[i]+h]<x) jj++;
+		if(V[I[i]+h]==x) kk++;
+	};
+	jj+=start;kk+=jj;
+
+	i=start;j=0;k=0;
+	while(i<jj) {
+		if(V[I[i]+h]<x) {
+			i++;
+		} else if(V[I[i]+h]==x) {
+			tmp=I[i];I[i]=I[jj+j];I[jj+j]=tmp;
+			j++;
+		} else {
+			tmp=I[i];I[i]=I[kk+k];I[kk+k]=tmp;
+			k++;
+		};
+	};
+
+	while(jj+j<kk) {
+		if(V[I[jj+j]+h]==x) {
+			j++;
+		} else {
+			tmp=I[jj+j];I[jj+j]=I[kk+k];I[kk+k]=tmp;
+			k++;
+		};
+	};
+
+	if(jj>start) split(I,V,start,jj-start,h);
+
+	for(i=0;i<kk-jj;i++) V[I[jj+i]]=kk-1;
+	if(jj==kk-1) I[jj]=-1;
+
+	if(start+len>kk) split(I,V,kk,start+len-kk,h);
+}
+
+void qsufsort(off_t *I,off_t *V,const unsigned char *old,off_t oldsize)
+{
+	off_t buckets[256];
+	off_t i,h,len;
+
+	for(i=0;i<256;i++) buckets[i]=0;
+	for(i=0;i<oldsize;i++) buckets[old[i]]++;
+	for(i=1;i<256;i++) buckets[i]+=buckets[i-1];
+	for(i=255;i>0;i--) buckets[i]=buckets[i-1];
+	buckets[0]=0;
+
+	for(i=0;i<oldsize;i++) I[++buckets[old[i]]]=i;
+	I[0]=oldsize;
+	for(i=0;i<oldsize;i++) V[i]=buckets[old[i]];
+	V[oldsize]=0;
+	for(i=1;i<256;i++) if(buckets[i]==buckets[i-1]+1) I[buckets[i]]=-1;
+	I[0]=-1;
+
+	for(h=1;I[0]!=-(oldsize+1);h+=h) {
+		len=0;
+		for(i=0;i<oldsize+1;) {
+			if(I[i]<0) {
+				len-=I[i];
+				i-=I[i];
+			} else {
+				if(len) I[i-len]=-len;
+				len=V[I[i]]+1-i;
+				split(I,V,i,len,h);
+				i+=len;
+				len=0;
+			};
+		};
+		if(len) I[i-len]=-len;
+	};
+
+	for(i=0;i<oldsize+1;i++) I[V[i]]=i;
+}
+
+vector<unsigned char> Corpus(int argc, char* argv[])
+{
+    string Argument = argc > 1 ? argv[1] : "64";
+    if (Argument.find_first_not_of("0123456789") != string::npos) {
+        ifstream Input(Argument, ios::binary);
+        return vector<unsigned char>(istreambuf_iterator<char>(Input), istreambuf_iterator<char>());
+    }
+
+    // random blocks with repeated sections, like a document edited over time
+    vector<unsigned char> Data(static_cast<size_t>(stoi(Argument)) << 20);
+    mt19937 Random(42);
+    for (size_t Index = 0; Index < Data.size(); ++Index) {
+        Data[Index] = Index % 4096 < 2048 ? static_cast<unsigned char>(Random()) : Data[Index - 2048];
+    }
+    return Data;
+}
+
+template<typename Action>
+void Measure(const string& name, size_t size, Action action)
+{
+    auto Before = Allocated;
+    Peak = Allocated;
+    auto Started = chrono::steady_clock::now();
+    action();
+    auto Elapsed = chrono::duration<double>(chrono::steady_clock::now() - Started).count();
+
+    cout << name << ": " << Elapsed << " s, " << (Peak - Before) / double(1 << 20) << " MB peak, "
+         << size / Elapsed / (1 << 20) << " MB/s\n";
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    auto Data = Corpus(argc, argv);
+    cout << "suffix sorting " << Data.size() << " bytes\n";
+
+    vector<off_t> Legacy;
+    Measure("qsufsort", Data.size(), [&Data, &Legacy]() {
+        vector<off_t> V(Data.size() + 1);
+        Legacy.resize(Data.size() + 1);
+        qsufsort(Legacy.data(), V.data(), Data.data(), Data.size());
+    });
+
+    vector<int32_t> Sorted;
+    Measure("SA-IS", Data.size(), [&Data, &Sorted]() { Sorted = SuffixArray::Build<int32_t>(Data); });
+
+    auto Same = equal(Sorted.begin(), Sorted.end(), Legacy.begin(), Legacy.end(), [](int32_t first, off_t second) { return first == second; });
+    cout << (Same ? "identical order\n" : "ORDER DIFFERS\n");
+    return Same ? 0 : 1;
+}
@@ -1,6 +1,9 @@
 #include "utils.hxx"
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <mutex>
+#include <thread>
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/asio.hpp>
@@ -113,3 +116,196 @@ void PeriodicTimer::Cancel()
 {
     Inner->Timer_.cancel();
 }
+
+struct WorkerPool::Implementation
+{
+    std::mutex Sync_;
+    std::condition_variable Signal_;
+    std::deque<std::function<void()>> Tasks_;
+    std::vector<std::thread> Workers_;
+    bool Stopping_ = false;
+    
+    void Work()
+    {
+        for (;;) {
+            std::function<void()> Task;
+            {
+                std::unique_lock<std::mutex> Lock(Sync_);
+                Signal_.wait(Lock, [this]() { return Stopping_ || Tasks_.empty() == false; });
+                if (Tasks_.empty()) return;
+                Task = std::move(Tasks_.front());
+                Tasks_.pop_front();
+            }
+            Task();
+        }
+    }
+};
+
+WorkerPool::WorkerPool(size_t workers)
+: Inner(new Implementation())
+{
+    for (size_t Index = 0; Index < max(workers, size_t(1)); ++Index) {
+        Inner->Workers_.emplace_back([this]() { Inner->Work(); });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        StrictGuard Lock(Inner->Sync_);
+        Inner->Stopping_ = true;
+    }
+    Inner->Signal_.notify_all();
+    for (auto& Worker : Inner->Workers_) Worker.join();
+    
+    delete Inner;
+    Inner = nullptr;
+}
+
+size_t WorkerPool::Size() const
+{
+    return Inner->Workers_.size();
+}
+
+void WorkerPool::Post(std::function<void()> task)
+{
+    {
+        StrictGuard Lock(Inner->Sync_);
+        Inner->Tasks_.push_back(std::move(task));
+    }
+    Inner->Signal_.notify_one();
+}
+
+struct WorkStealingPool::Implementation
+{
+    struct Worker
+    {
+        std::deque<std::function<void()>> Tasks_;
+        std::condition_variable Signal_;
+        bool Busy_ = false;
+    };
+    
+    // queues are short and tasks are queries, one lock for all queues is enough
+    mutable std::mutex Sync_;
+    std::vector<std::unique_ptr<Worker>> Workers_;
+    std::vector<std::thread> Threads_;
+    std::condition_variable Idle_;
+    std::size_t Pending_ = 0;
+    std::size_t Running_ = 0;
+    std::size_t PeakPending_ = 0;
+    std::uint64_t Started_ = 0;
+    std::uint64_t Stolen_ = 0;
+    bool Stopping_ = false;
+    
+    void WakeIdle()
+    {
+        for (auto& Worker : Workers_) {
+            if (Worker->Busy_ == false) {
+                Worker->Signal_.notify_one();
+                return;
+            }
+        }
+    }
+    
+    bool Take(std::size_t index, std::function<void()>& task)
+    {
+        auto& Own = Workers_[index]->Tasks_;
+        if (Own.empty() == false) {
+            task = std::move(Own.front());
+            Own.pop_front();
+            return true;
+        }
+        
+        Worker* Victim = nullptr;
+        for (auto& Other : Workers_) {
+            if (Other->Tasks_.empty() == false && (Victim == nullptr || Other->Tasks_.size() > Victim->Tasks_.size())) Victim = Other.get();
+        }
+        if (Victim == nullptr) return false;
+        
+        task = std::move(Victim->Tasks_.back());
+        Victim->Tasks_.pop_back();
+        ++Stolen_;
+        return true;
+    }
+    
+    void Work(std::size_t index)
+    {
+        auto& Self = *Workers_[index];
+        std::unique_lock<std::mutex> Lock(Sync_);
+        for (;;) {
+            std::function<void()> Task;
+            if (Take(index, Task) == false) {
+                if (Stopping_) return;
+                Self.Signal_.wait(Lock);
+                continue;
+            }
+            
+            --Pending_;
+            ++Running_;
+            ++Started_;
+            Self.Busy_ = true;
+            if (Pending_ > 0) WakeIdle();
+            Lock.unlock();
+            Task();
+            Task = nullptr;
+            Lock.lock();
+            Self.Busy_ = false;
+            if (--Running_ == 0 && Pending_ == 0) Idle_.notify_all();
+        }
+    }
+};
+
+WorkStealingPool::WorkStealingPool(size_t workers)
+: Inner(new Implementation())
+{
+    auto Count = max(workers, size_t(1));
+    for (size_t Index = 0; Index < Count; ++Index) Inner->Workers_.push_back(std::make_unique<Implementation::Worker>());
+    for (size_t Index = 0; Index < Count; ++Index) Inner->Threads_.emplace_back([this, Index]() { Inner->Work(Index); });
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        StrictGuard Lock(Inner->Sync_);
+        Inner->Stopping_ = true;
+        for (auto& Worker : Inner->Workers_) Worker->Signal_.notify_all();
+    }
+    for (auto& Thread : Inner->Threads_) Thread.join();
+    
+    delete Inner;
+    Inner = nullptr;
+}
+
+void WorkStealingPool::Wait() const
+{
+    unique_lock<mutex> Lock(Inner->Sync_);
+    Inner->Idle_.wait(Lock, [this]() { return Inner->Pending_ == 0 && Inner->Running_ == 0; });
+}
+
+size_t WorkStealingPool::Size() const
+{
+    return Inner->Workers_.size();
+}
+
+WorkStealingPool::Statistics WorkStealingPool::Usage() const
+{
+    StrictGuard Lock(Inner->Sync_);
+    Statistics Result;
+    for (auto& Worker : Inner->Workers_) Result.Depths.push_back(Worker->Tasks_.size());
+    Result.PeakDepth = Inner->PeakPending_;
+    Result.Started = Inner->Started_;
+    Result.Stolen = Inner->Stolen_;
+    return Result;
+}
+
+void WorkStealingPool::Post(size_t affinity, std::function<void()> task)
+{
+    StrictGuard Lock(Inner->Sync_);
+    auto& Owner = *Inner->Workers_[affinity % Inner->Workers_.size()];
+    Owner.Tasks_.push_back(std::move(task));
+    Inner->PeakPending_ = max(Inner->PeakPending_, ++Inner->Pending_);
+    
+    // the owner keeps its tasks while it is idle, otherwise an idle worker steals
+    if (Owner.Busy_ == false) Owner.Signal_.notify_one();
+    else Inner->WakeIdle();
+}
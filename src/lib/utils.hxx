@@ -1,6 +1,11 @@
 #ifndef UTILS_HXX
 #define UTILS_HXX
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
 #include <string>
 #include <vector>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
@@ -28,6 +33,116 @@ public:
     void Cancel();
 };
 
+/*! \brief Fixed number of threads working off a shared queue.
+ *
+ * Tasks are run in submission order, the queue is drained before
+ * the pool is destroyed.
+ */
+class WorkerPool
+{
+private:
+    struct Implementation;
+    Implementation* Inner;
+    
+public:
+    /*! \brief Starts the worker threads.
+     *
+     * \param workers Number of threads, at least one is started.
+     */
+    explicit WorkerPool(std::size_t workers);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    void operator= (const WorkerPool&) = delete;
+    
+    /*! \brief Number of worker threads. */
+    std::size_t Size() const;
+    
+    /*! \brief Queue a task without waiting for it. */
+    void Post(std::function<void()> task);
+    
+    /*! \brief Queue a task.
+     *
+     * \return Future receiving the result or the exception of the task.
+     */
+    template<typename Function>
+    auto Submit(Function function) -> std::future<decltype(function())>
+    {
+        auto Task = std::make_shared<std::packaged_task<decltype(function())()>>(std::move(function));
+        auto Result = Task->get_future();
+        Post([Task]() { (*Task)(); });
+        return Result;
+    }
+};
+
+/*! \brief Fixed number of threads with a queue each.
+ *
+ * Tasks are queued for the worker their affinity maps to, so tasks
+ * sharing an affinity run on the same thread while it keeps up. Idle
+ * workers steal from the back of the longest queue. Tasks must not
+ * wait for other tasks of the same pool.
+ */
+class WorkStealingPool
+{
+private:
+    struct Implementation;
+    Implementation* Inner;
+    
+public:
+    /*! \brief Counters of the pool. */
+    struct Statistics
+    {
+        /*! \brief Tasks waiting in each queue. */
+        std::vector<std::size_t> Depths;
+        /*! \brief Most tasks waiting in all queues at once. */
+        std::size_t PeakDepth;
+        /*! \brief Tasks taken by a worker. */
+        std::uint64_t Started;
+        /*! \brief Tasks run by a worker other than the one of their affinity. */
+        std::uint64_t Stolen;
+    };
+    
+    /*! \brief Starts the worker threads.
+     *
+     * \param workers Number of threads, at least one is started.
+     */
+    explicit WorkStealingPool(std::size_t workers);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    void operator= (const WorkStealingPool&) = delete;
+    
+    /*! \brief Number of worker threads. */
+    std::size_t Size() const;
+    
+    /*! \brief Snapshot of the counters. */
+    Statistics Usage() const;
+    
+    /*! \brief Block until all queued tasks have run.
+     *
+     * Must not be called from a task of the pool.
+     */
+    void Wait() const;
+    
+    /*! \brief Queue a task without waiting for it.
+     *
+     * \param affinity Any number, equal numbers prefer the same worker.
+     * \param task The task.
+     */
+    void Post(std::size_t affinity, std::function<void()> task);
+    
+    /*! \brief Queue a task.
+     *
+     * \return Future receiving the result or the exception of the task.
+     */
+    template<typename Function>
+    auto Submit(std::size_t affinity, Function function) -> std::future<decltype(function())>
+    {
+        auto Task = std::make_shared<std::packaged_task<decltype(function())()>>(std::move(function));
+        auto Result = Task->get_future();
+        Post(affinity, [Task]() { (*Task)(); });
+        return Result;
+    }
+};
+
 } // namespace Utils
 
 #endif
@@ -0,0 +1,81 @@
+#define BOOST_TEST_MODULE "ByteKernelsModule"
+
+#include <random>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "archs/backend/byte_kernels.hxx"
+
+using namespace std;
+using namespace Archive::Backend;
+
+namespace {
+
+struct Results
+{
+    vector<size_t> Lengths;
+    vector<size_t> Counts;
+    vector<unsigned char> Differences;
+    vector<unsigned char> Sums;
+
+    bool operator== (const Results& other) const
+    {
+        return Lengths == other.Lengths && Counts == other.Counts && Differences == other.Differences && Sums == other.Sums;
+    }
+};
+
+// unaligned starts and sizes around the vector widths
+Results RunAll(const vector<unsigned char>& first, const vector<unsigned char>& second)
+{
+    Results Result;
+    for (size_t Offset = 0; Offset < 40; Offset += 3) {
+        for (size_t Size : { 0, 1, 15, 16, 17, 31, 32, 33, 63, 100, 5000, 20000 }) {
+            Result.Lengths.push_back(ByteKernels::MatchLength(&first[Offset], &second[Offset], Size));
+            Result.Counts.push_back(ByteKernels::CountEqual(&first[Offset], &second[Offset], Size));
+
+            vector<unsigned char> Difference(Size), Sum(first.begin() + Offset, first.begin() + Offset + Size);
+            ByteKernels::Subtract(Difference.data(), &first[Offset], &second[Offset], Size);
+            ByteKernels::Add(Sum.data(), &second[Offset], Size);
+            Result.Differences.insert(Result.Differences.end(), Difference.begin(), Difference.end());
+            Result.Sums.insert(Result.Sums.end(), Sum.begin(), Sum.end());
+        }
+    }
+    return Result;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE(All_Levels_Match_Scalar)
+{
+    mt19937 Random(7);
+    vector<unsigned char> First(21000), Second;
+    for (auto& Value : First) Value = static_cast<unsigned char>(Random());
+
+    // long equal runs broken by single differences
+    Second = First;
+    for (size_t Index = 70; Index < Second.size(); Index += 37 + Random() % 3000) Second[Index] ^= 1;
+
+    ByteKernels::Use(ByteKernels::Scalar);
+    BOOST_CHECK(ByteKernels::Active() == ByteKernels::Scalar);
+    auto Expected = RunAll(First, Second);
+    auto Unrelated = RunAll(First, vector<unsigned char>(First.rbegin(), First.rend()));
+
+    for (auto Level : { ByteKernels::Sse2, ByteKernels::Avx2 }) {
+        ByteKernels::Use(Level);
+        BOOST_CHECK(ByteKernels::Active() <= ByteKernels::Supported());
+        BOOST_CHECK(RunAll(First, Second) == Expected);
+        BOOST_CHECK(RunAll(First, vector<unsigned char>(First.rbegin(), First.rend())) == Unrelated);
+    }
+
+    ByteKernels::Use(ByteKernels::Supported());
+}
+
+BOOST_AUTO_TEST_CASE(Match_And_Count)
+{
+    vector<unsigned char> First(1000, 'a'), Second(1000, 'a');
+    Second[700] = 'b';
+    Second[900] = 'b';
+
+    BOOST_CHECK(ByteKernels::MatchLength(First.data(), Second.data(), First.size()) == 700);
+    BOOST_CHECK(ByteKernels::MatchLength(First.data(), Second.data(), 500) == 500);
+    BOOST_CHECK(ByteKernels::CountEqual(First.data(), Second.data(), First.size()) == 998);
+}
@@ -0,0 +1,59 @@
+#define BOOST_TEST_MODULE "CodecModule"
+
+#include <stdexcept>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "archs/backend/codec.hxx"
+
+using namespace std;
+using namespace Archive::Backend;
+
+namespace {
+
+vector<unsigned char> RoundTrip(const Codec& codec, const vector<unsigned char>& data)
+{
+    auto Packed = codec.Compress(data.data(), data.size());
+    vector<unsigned char> Result(data.size());
+    Codec::Decompress(codec.Type(), Packed.data(), Packed.size(), Result.data(), Result.size());
+    return Result;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE(Round_Trip_All_Codecs)
+{
+    vector<unsigned char> Text;
+    for (int Index = 0; Index < 100000; ++Index) Text.push_back("lorem ipsum dolor sit amet "[Index % 27] + Index / 5000);
+
+    vector<unsigned char> Noise(5000);
+    for (size_t Index = 0; Index < Noise.size(); ++Index) Noise[Index] = static_cast<unsigned char>(Index * 2654435761u >> 11);
+
+    for (auto Method : { Codec::Store, Codec::Bzip2, Codec::Lz4 }) {
+        for (int Level : { 1, 9 }) {
+            Codec Subject(Method, Level);
+            BOOST_CHECK(RoundTrip(Subject, Text) == Text);
+            BOOST_CHECK(RoundTrip(Subject, Noise) == Noise);
+            BOOST_CHECK(RoundTrip(Subject, {}).empty());
+            BOOST_CHECK(RoundTrip(Subject, { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 }) == vector<unsigned char>(20, 1));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Lz4_Compresses_Repetitions)
+{
+    vector<unsigned char> Data(100000, 'a');
+    Codec Subject(Codec::Lz4);
+    
+    BOOST_CHECK(Subject.Compress(Data.data(), Data.size()).size() < 1000);
+}
+
+BOOST_AUTO_TEST_CASE(Reject_Invalid_Data)
+{
+    vector<unsigned char> Data(1000, 'a');
+    auto Packed = Codec(Codec::Lz4).Compress(Data.data(), Data.size());
+    vector<unsigned char> Target(Data.size());
+    
+    BOOST_CHECK_THROW(Codec::Decompress(Codec::Lz4, Packed.data(), Packed.size(), Target.data(), Target.size() - 1), runtime_error);
+    BOOST_CHECK_THROW(Codec::Decompress(Codec::Lz4, Packed.data(), Packed.size() - 1, Target.data(), Target.size()), runtime_error);
+    BOOST_CHECK_THROW(Codec::Decompress(Codec::Bzip2, Packed.data(), Packed.size(), Target.data(), Target.size()), runtime_error);
+}
@@ -0,0 +1,29 @@
+#define BOOST_TEST_MODULE "ContentHashModule"
+
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "archs/backend/content_hash.hxx"
+
+using namespace std;
+using namespace Archive::Backend;
+
+BOOST_AUTO_TEST_CASE(Known_Values)
+{
+    BOOST_CHECK(ContentHash::Compute({}) == "ef46db3751d8e999");
+    BOOST_CHECK(ContentHash::Compute({ 'a', 'b', 'c' }) == "44bc2cf5ad770999");
+}
+
+BOOST_AUTO_TEST_CASE(Streaming_Matches_Single_Call)
+{
+    vector<unsigned char> Data(1000);
+    for (size_t Index = 0; Index < Data.size(); ++Index) Data[Index] = static_cast<unsigned char>(Index * 7);
+
+    for (size_t Step : { 1, 3, 31, 32, 33, 500 }) {
+        ContentHash Hash;
+        for (size_t Position = 0; Position < Data.size(); Position += Step) {
+            Hash.Update(&Data[Position], min(Step, Data.size() - Position));
+        }
+        BOOST_CHECK(Hash.Checksum() == ContentHash::Compute(Data));
+    }
+}
@@ -1,8 +1,16 @@
 #define BOOST_TEST_DETECT_MEMORY_LEAK 0
 #define BOOST_TEST_MODULE "DocumentStorageModule"
 
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
 #include <boost/test/unit_test.hpp>
 #include <boost/filesystem.hpp>
+#include "archs/backend/binary_data.hxx"
+#include "archs/backend/content_hash.hxx"
+#include "archs/backend/content_store.hxx"
+#include "archs/backend/data_bucket.hxx"
 #include "archs/backend/document_schema.hxx"
 #include "archs/backend/settings_provider.hxx"
 #include "archs/backend/document_storage.hxx"
@@ -69,6 +77,118 @@ public:
     int Backends() const override { return 1; }
 };
 
+class ChunkedProvider : public OneBucketProvider
+{
+public:
+    int ContentChunkSize() const override { return 8; }
+};
+
+class CheckpointProvider : public OneBucketProvider
+{
+public:
+    int ContentCheckpointInterval() const override { return 2; }
+};
+
+class Lz4Provider : public OneBucketProvider
+{
+public:
+    Codec PatchCodec(int bucket) const override { return Codec(Codec::Lz4); }
+};
+
+class ChunkingProvider : public OneBucketProvider
+{
+public:
+    int PatchChunkingThreshold() const override { return 1024; }
+};
+
+class CompactionProvider : public OneBucketProvider
+{
+public:
+    int ContentCompactionSpan() const override { return 3; }
+};
+
+class BatchedProvider : public OneBucketProvider
+{
+public:
+    int BulkBatchSize() const override { return 16; }
+};
+
+class PooledProvider : public OneBucketProvider
+{
+private:
+    int Readers_;
+
+public:
+    explicit PooledProvider(int readers)
+    : Readers_(readers)
+    { }
+
+    int ReaderConnections() const override { return Readers_; }
+};
+
+class CompressedProvider : public OneBucketProvider
+{
+private:
+    int ChunkSize_;
+    
+public:
+    explicit CompressedProvider(int chunkSize)
+    : ChunkSize_(chunkSize)
+    { }
+    
+    int ContentChunkSize() const override { return ChunkSize_; }
+    Codec ContentCodec() const override { return Codec(Codec::Lz4); }
+};
+
+int CountStoredContents(const SettingsProvider& settings, const string& table = "ContentBlobs")
+{
+    SQLite::Configuration Setup;
+    Setup.Path = (path(settings.DataLocation()) / "001domla.archive").string();
+    Setup.ReadOnly = true;
+
+    SQLite::Connection Connection(Setup);
+    Connection.Open();
+    auto Command = Connection.Create("SELECT COUNT(*) FROM " + table);
+    return Command.ExecuteScalar<int>();
+}
+
+void CheckCollisionIsStoredInline(const SettingsProvider& settings, const Access::BinaryData& content)
+{
+    auto Colliding = content;
+    Colliding.back() ^= 1;
+
+    Access::DocumentDataPtr First = new Access::DocumentData();
+    First->FolderPath = "/first";
+    First->Name = "form.pdf";
+    DocumentStorage(settings).Save(First, content, "willi");
+
+    {
+        // move the stored content to the address of the colliding one
+        SQLite::Configuration Setup;
+        Setup.Path = (path(settings.DataLocation()) / "001domla.archive").string();
+        SQLite::Connection Connection(Setup);
+        Connection.Open();
+
+        auto Transaction = Connection.Begin();
+        for (auto Query : { "UPDATE ContentBlobs SET Address = :Address", "UPDATE ContentLinks SET Address = :Address", "UPDATE DocumentChunks SET Owner = :Address" }) {
+            auto Command = Connection.Create(Query);
+            Command.Parameters()["Address"].SetValue(ContentStore::Address(ContentHash::Compute(Colliding), Colliding.size()));
+            Command.Execute();
+        }
+        Transaction.Commit();
+    }
+
+    DocumentStorage Storage(settings);
+    Access::DocumentDataPtr Second = new Access::DocumentData();
+    Second->FolderPath = "/second";
+    Second->Name = "form.pdf";
+    Storage.Save(Second, Colliding, "willi");
+    BOOST_CHECK(CountStoredContents(settings) == 1);
+
+    BOOST_CHECK(Storage.Read(First->Id, "willi")->Content == content);
+    BOOST_CHECK(Storage.Read(Second->Id, "willi")->Content == Colliding);
+}
+
 BOOST_AUTO_TEST_CASE(Storage_Creates_Requested_Buckets_Test)
 {
     Provider Settings;
@@ -174,6 +294,43 @@ BOOST_AUTO_TEST_CASE(Find_Document)
     BOOST_CHECK(Check->Id.empty() == false);
 }
 
+BOOST_AUTO_TEST_CASE(Find_Document_In_Many_Buckets)
+{
+    Provider Settings;
+    DocumentStorage Storage(Settings);
+    
+    const Access::BinaryData Content { 3, 2, 1, 0, 1, 2, 3 };
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+    Header->FolderPath = "/one";
+    Header->Name = "test.xxx";
+    
+    Storage.Save(Header, Content, "willi");
+    
+    // the other buckets have no match
+    BOOST_CHECK(Storage.Find("/one", "test.xxx")->Id == Header->Id);
+    BOOST_CHECK(!Storage.Find("/one", "missing.xxx"));
+}
+
+BOOST_AUTO_TEST_CASE(Find_Document_With_Quoted_Name)
+{
+    OneBucketProvider Settings;
+    DocumentStorage Storage(Settings);
+    
+    const Access::BinaryData Content { 3, 2, 1, 0, 1, 2, 3 };
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+    Header->FolderPath = "/o'neil";
+    Header->Name = "it's.xxx";
+    Header->Display = "Won't";
+    
+    Storage.Save(Header, Content, "willi");
+    
+    auto Check = Storage.Find("/o'neil", "it's.xxx");
+    BOOST_CHECK(Check->Id == Header->Id);
+    
+    auto Titles = Storage.FindTitle("/o'neil", "Won't");
+    BOOST_CHECK(Titles.size() == 1);
+}
+
 BOOST_AUTO_TEST_CASE(Find_Document_By_Title)
 {
     OneBucketProvider Settings;
@@ -262,6 +419,58 @@ BOOST_AUTO_TEST_CASE(Copy_Document)
     BOOST_CHECK(Check[0]->Id != Id);
 }
 
+BOOST_AUTO_TEST_CASE(Copy_Document_While_Updating)
+{
+    OneBucketProvider Settings;
+    DocumentStorage Storage(Settings);
+
+    Access::BinaryData Content;
+    for (int Index = 0; Index < 100000; ++Index) Content.push_back(static_cast<unsigned char>(Index * 2654435761u >> 13));
+
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+    Header->FolderPath = "/one";
+    Header->Name = "test.xxx";
+    Storage.Save(Header, Content, "willi");
+
+    // the update is queued before the copy is written, the copy gets either revision
+    for (int Round = 0; Round < 5; ++Round) {
+        auto NewContent = Content;
+        NewContent[Round * 1000] ^= 1;
+        auto Updated = Storage.SaveAsync(Header, NewContent, "willi");
+        auto Target = "/copy" + to_string(Round);
+        BOOST_CHECK_NO_THROW(Storage.Copy(Header->Id, "/one", Target, "willi"));
+        Updated.get();
+
+        auto Loaded = Storage.Read(Storage.Find(Target, "test.xxx")->Id, "willi");
+        BOOST_CHECK(Loaded->Content == Content || Loaded->Content == NewContent);
+        BOOST_CHECK(Loaded->Checksum == ContentHash::Compute(Loaded->Content));
+        Content = NewContent;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Copy_Document_Async)
+{
+    OneBucketProvider Settings;
+    DocumentStorage Storage(Settings);
+
+    const Access::BinaryData Content { 3, 2, 1, 0, 1, 2, 3 };
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+    Header->FolderPath = "/one";
+    Header->Name = "test.xxx";
+    Storage.Save(Header, Content, "willi");
+
+    vector<future<void>> Copies;
+    for (int Index = 0; Index < 4; ++Index) Copies.push_back(Storage.CopyAsync(Header->Id, "/one", "/target" + to_string(Index), "willi"));
+    for (auto& Copy : Copies) BOOST_CHECK_NO_THROW(Copy.get());
+    BOOST_CHECK(Storage.FoldersForPath("/").size() == 6);
+
+    // each copy counts its folder once, the folder is gone with its last document
+    auto Copy = Storage.Find("/target0", "test.xxx");
+    BOOST_CHECK(Storage.Read(Copy->Id, "willi")->Content == Content);
+    Storage.Destroy(Copy->Id, "willi");
+    BOOST_CHECK(Storage.FoldersForPath("/").size() == 5);
+}
+
 BOOST_AUTO_TEST_CASE(Link_Document)
 {
     OneBucketProvider Settings;
@@ -504,6 +713,666 @@ BOOST_AUTO_TEST_CASE(Retrieve_First_Version_Content)
     BOOST_CHECK(equal(Content.cbegin(), Content.cend(), Loaded->Content.cbegin(), Loaded->Content.cend()));
 }
 
+BOOST_AUTO_TEST_CASE(Retrieve_Old_Revisions_Through_Checkpoints)
+{
+    CheckpointProvider Settings;
+    DocumentStorage Storage(Settings);
+    
+    vector<Access::BinaryData> Contents;
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+
+    for (unsigned char Revision = 1; Revision <= 5; ++Revision) {
+        Access::BinaryData Content {
+            '0','1','2','3','4','5','6','7','8','9',
+            '0','1','2','3','4','5','6','7','8','9',
+            '0','1','2','3','4','5','6','7','8','9',
+        };
+        Content[10 + Revision] = 'x';
+        Contents.push_back(Content);
+        Storage.Save(Header, Content, "willi");
+    }
+
+    // revisions 2 and 4 are checkpoints, next to the latest one
+    BOOST_CHECK(CountStoredContents(Settings) == 3);
+
+    for (int Revision = 1; Revision <= 5; ++Revision) {
+        auto Loaded = Storage.Read(Header->Id, "willi", Revision);
+        auto& Expected = Contents[Revision - 1];
+
+        BOOST_CHECK(Loaded->Revision == Revision);
+        BOOST_CHECK(equal(Expected.cbegin(), Expected.cend(), Loaded->Content.cbegin(), Loaded->Content.cend()));
+    }
+
+    BOOST_CHECK_THROW(Storage.Read(Header->Id, "willi", 6), Access::NotFoundError);
+}
+
+BOOST_AUTO_TEST_CASE(Stream_Old_Revisions)
+{
+    CheckpointProvider Settings;
+    DocumentStorage Storage(Settings);
+    
+    vector<Access::BinaryData> Contents;
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+
+    for (unsigned char Revision = 1; Revision <= 4; ++Revision) {
+        Access::BinaryData Content(100000);
+        for (size_t Index = 0; Index < Content.size(); ++Index) Content[Index] = static_cast<unsigned char>(Index % 241);
+        Content[1000 * Revision] = 'x';
+        Contents.push_back(Content);
+        Storage.Save(Header, Content, "willi");
+    }
+
+    for (int Revision = 1; Revision <= 4; ++Revision) {
+        Access::BinaryData Streamed;
+        auto Loaded = Storage.Stream(Header->Id, "willi", Revision, [&Streamed](const unsigned char* data, size_t size) {
+            Streamed.insert(Streamed.end(), data, data + size);
+        });
+
+        BOOST_CHECK(Loaded->Revision == Revision);
+        BOOST_CHECK(Loaded->Content.empty());
+        BOOST_CHECK(Streamed == Contents[Revision - 1]);
+    }
+
+    BOOST_CHECK_THROW(Storage.Stream(Header->Id, "willi", 5, [](const unsigned char*, size_t) { }), Access::NotFoundError);
+}
+
+BOOST_AUTO_TEST_CASE(Retrieve_Old_Revisions_After_Compaction)
+{
+    CompactionProvider Settings;
+    DocumentStorage Storage(Settings);
+    
+    vector<Access::BinaryData> Contents;
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+
+    auto Save = [&](int revision) {
+        Access::BinaryData Content(30000);
+        for (size_t Index = 0; Index < Content.size(); ++Index) Content[Index] = static_cast<unsigned char>(Index % 239);
+        for (int Edit = 1; Edit <= revision; ++Edit) Content[2000 * Edit] = 'x';
+        Content.insert(Content.begin() + 500 * revision, 100, 'y');
+        Contents.push_back(Content);
+        Storage.Save(Header, Content, "willi");
+    };
+
+    auto Verify = [&]() {
+        for (int Revision = 1; Revision <= static_cast<int>(Contents.size()); ++Revision) {
+            auto Loaded = Storage.Read(Header->Id, "willi", Revision);
+            BOOST_CHECK(Loaded->Revision == Revision);
+            BOOST_CHECK(Loaded->Content == Contents[Revision - 1]);
+
+            Access::BinaryData Streamed;
+            Storage.Stream(Header->Id, "willi", Revision, [&Streamed](const unsigned char* data, size_t size) {
+                Streamed.insert(Streamed.end(), data, data + size);
+            });
+            BOOST_CHECK(Streamed == Contents[Revision - 1]);
+        }
+    };
+
+    for (int Revision = 1; Revision <= 10; ++Revision) Save(Revision);
+    Storage.CompactRevisions();
+
+    // revision 3 is based on 6 and 6 on 9, 9 is next to the latest one
+    BOOST_CHECK(CountStoredContents(Settings, "ContentBases") == 2);
+    Verify();
+
+    Save(11);
+    Storage.CompactRevisions();
+    BOOST_CHECK(CountStoredContents(Settings, "ContentBases") == 3);
+    Verify();
+
+    // the checksums still match the rebuilt revisions
+    Storage.CalculateHashes();
+    for (int Revision = 1; Revision <= 11; ++Revision) {
+        BOOST_CHECK(Storage.Read(Header->Id, "willi", Revision)->Checksum == ContentHash::Compute(Contents[Revision - 1]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Retrieve_First_Version_From_Lz4_Patch)
+{
+    Lz4Provider Settings;
+    DocumentStorage Storage(Settings);
+    
+    const Access::BinaryData Content {
+        '0','1','2','3','4','5','6','7','8','9',
+        '0','1','2','3','4','5','6','7','8','9',
+        '0','1','2','3','4','5','6','7','8','9',
+    };
+    
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+    Storage.Save(Header, Content, "willi");
+
+    const Access::BinaryData NewContent {
+        '0','1','2','3','4','5','6','7','8','9',
+        '9','8','7','6','5','4','3','2','1','0',
+        '0','1','2','3','4','5','6','7','8','9',
+    };
+
+    Storage.Save(Header, NewContent, "willi");
+    auto Loaded = Storage.Read(Header->Id, "willi", 1);
+    
+    BOOST_CHECK(equal(Content.cbegin(), Content.cend(), Loaded->Content.cbegin(), Loaded->Content.cend()));
+}
+
+BOOST_AUTO_TEST_CASE(Retrieve_First_Version_From_Chunk_Patch)
+{
+    ChunkingProvider Settings;
+    DocumentStorage Storage(Settings);
+    
+    Access::BinaryData Content(40000);
+    for (size_t Index = 0; Index < Content.size(); ++Index) Content[Index] = static_cast<unsigned char>(Index * 2654435761u >> 11);
+    
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+    Storage.Save(Header, Content, "willi");
+
+    auto NewContent = Content;
+    NewContent.insert(NewContent.begin() + 20000, 50, 'x');
+    Storage.Save(Header, NewContent, "willi");
+
+    auto Loaded = Storage.Read(Header->Id, "willi", 1);
+    BOOST_CHECK(Loaded->Content == Content);
+
+    SQLite::Configuration Setup;
+    Setup.Path = (path(Settings.DataLocation()) / "001domla.archive").string();
+    Setup.ReadOnly = true;
+
+    SQLite::Connection Connection(Setup);
+    Connection.Open();
+    auto Command = Connection.Create("SELECT Data FROM DocumentContents WHERE SeqId = 1");
+    auto Patch = (*Command.Open().begin()).GetBlob(0);
+    BOOST_CHECK(BinaryData::PatchEngine(Patch) == BinaryData::ContentChunks);
+}
+
+BOOST_AUTO_TEST_CASE(Keep_Unrelated_Revision_Full)
+{
+    OneBucketProvider Settings;
+    DocumentStorage Storage(Settings);
+    
+    Access::BinaryData Content(50000), Unrelated(50000);
+    for (size_t Index = 0; Index < Content.size(); ++Index) {
+        Content[Index] = static_cast<unsigned char>(Index * 2654435761u >> 13);
+        Unrelated[Index] = static_cast<unsigned char>(Index * 2246822519u >> 11);
+    }
+    
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+    Storage.Save(Header, Content, "willi");
+    Storage.Save(Header, Unrelated, "willi");
+
+    auto Usage = Storage.PatchUsage();
+    BOOST_CHECK(Usage.Dissimilar == 1);
+    BOOST_CHECK(Usage.Patched == 0);
+    BOOST_CHECK(CountStoredContents(Settings) == 2);
+
+    auto Edited = Unrelated;
+    Edited[100] = 'x';
+    Storage.Save(Header, Edited, "willi");
+
+    Usage = Storage.PatchUsage();
+    BOOST_CHECK(Usage.Patched == 1);
+    BOOST_CHECK(Usage.PatchBytes < Usage.FullBytes / 10);
+    BOOST_CHECK(CountStoredContents(Settings) == 2);
+
+    BOOST_CHECK(Storage.Read(Header->Id, "willi", 1)->Content == Content);
+    BOOST_CHECK(Storage.Read(Header->Id, "willi", 2)->Content == Unrelated);
+    BOOST_CHECK(Storage.Read(Header->Id, "willi", 3)->Content == Edited);
+}
+
+BOOST_AUTO_TEST_CASE(Read_Concurrently_From_Reader_Pool)
+{
+    PooledProvider Settings(3);
+    DocumentStorage Storage(Settings);
+
+    vector<Access::DocumentDataPtr> Headers;
+    vector<Access::BinaryData> Contents;
+    for (unsigned char Document = 0; Document < 4; ++Document) {
+        Headers.push_back(new Access::DocumentData());
+        Contents.push_back(Access::BinaryData(5000, 'a' + Document));
+        Storage.Save(Headers.back(), Contents.back(), "willi");
+    }
+
+    vector<future<bool>> Clients;
+    for (size_t Client = 0; Client < 8; ++Client) {
+        Clients.push_back(async(launch::async, [&, Client]() {
+            auto Correct = true;
+            for (size_t Round = 0; Round < 50; ++Round) {
+                auto Index = (Client + Round) % Headers.size();
+                Correct = Correct && Storage.Read(Headers[Index]->Id, "willi")->Content == Contents[Index];
+                Correct = Correct && Storage.FindById(Headers[Index]->Id)->Id == Headers[Index]->Id;
+            }
+            return Correct;
+        }));
+    }
+
+    for (auto& Client : Clients) BOOST_CHECK(Client.get());
+}
+
+BOOST_AUTO_TEST_CASE(Share_Reader_Within_Thread)
+{
+    PooledProvider Settings(1);
+    DocumentStorage Storage(Settings);
+    DataBucket Bucket(1, Settings);
+
+    SQLite::Connection* Held;
+    future<SQLite::Connection*> Other;
+    {
+        auto First = Bucket.Borrow();
+        auto Nested = Bucket.Borrow();
+        BOOST_CHECK(First.Get() == Nested.Get());
+        Held = First.Get();
+
+        // the only connection is leased, another thread has to wait
+        Other = async(launch::async, [&Bucket]() { return Bucket.Borrow().Get(); });
+        BOOST_CHECK(Other.wait_for(chrono::milliseconds(100)) == future_status::timeout);
+    }
+
+    BOOST_CHECK(Other.get() == Held);
+}
+
+BOOST_AUTO_TEST_CASE(Batch_Mutations_Into_One_Commit)
+{
+    OneBucketProvider Settings;
+    DocumentStorage Storage(Settings);
+    DataBucket Bucket(1, Settings);
+
+    auto Insert = [&Bucket](const string& tag) {
+        auto Command = Bucket.Writing()->Create("INSERT INTO DocumentTags(Tag)VALUES(:Tag)");
+        Command.Parameters()["Tag"].SetValue(tag);
+        Command.Execute();
+    };
+
+    // the writer is held up by the first mutation, the others queue up behind it
+    promise<void> Started;
+    promise<void> Release;
+    auto Blocker = Bucket.Submit([&Started, &Release]() {
+        Started.set_value();
+        Release.get_future().wait();
+    });
+    Started.get_future().wait();
+
+    auto First = Bucket.Submit([&Insert]() { Insert("first"); });
+    auto Failing = Bucket.Submit([&Insert]() { Insert("failing"); throw runtime_error("rejected"); });
+    auto Last = Bucket.Submit([&Insert]() { Insert("last"); });
+    Release.set_value();
+
+    Blocker.get();
+    First.get();
+    BOOST_CHECK_THROW(Failing.get(), runtime_error);
+    Last.get();
+
+    auto Usage = Bucket.CommitUsage();
+    BOOST_CHECK(Usage.Mutations == 4);
+    BOOST_CHECK(Usage.Commits == 2);
+    BOOST_CHECK(Usage.LargestBatch == 3);
+
+    auto Reader = Bucket.Borrow();
+    auto Command = Reader->Create("SELECT COUNT(*) FROM DocumentTags WHERE Tag IN ('first', 'failing', 'last')");
+    BOOST_CHECK(Command.ExecuteScalar<int>() == 2);
+}
+
+BOOST_AUTO_TEST_CASE(Failed_Commit_Skips_Committed_Actions)
+{
+    OneBucketProvider Settings;
+    DocumentStorage Storage(Settings);
+    DataBucket Bucket(1, Settings);
+
+    promise<void> Started;
+    promise<void> Release;
+    auto Blocker = Bucket.Submit([&Started, &Release]() {
+        Started.set_value();
+        Release.get_future().wait();
+    });
+    Started.get_future().wait();
+
+    // the foreign key is checked when the batch commits, not by the savepoint of the mutation
+    bool Committed = false;
+    auto Dangling = Bucket.Submit([&Bucket]() {
+        auto Command = Bucket.Writing()->Create("INSERT INTO ContentLinks (Owner, Address) VALUES ('missing', 'missing')");
+        Command.Execute();
+    }, [&Committed]() { Committed = true; });
+    auto Failing = Bucket.Submit([]() { throw logic_error("rejected"); });
+    Release.set_value();
+
+    // the blocker was taken alone by the writer, the two others are committed together
+    BOOST_CHECK_NO_THROW(Blocker.get());
+    BOOST_CHECK_THROW(Dangling.get(), runtime_error);
+    BOOST_CHECK_THROW(Failing.get(), logic_error);
+    BOOST_CHECK(Committed == false);
+}
+
+BOOST_AUTO_TEST_CASE(Concurrent_Mutations_Are_All_Stored)
+{
+    OneBucketProvider Settings;
+    DocumentStorage Storage(Settings);
+
+    vector<Access::DocumentDataPtr> Headers;
+    for (int Document = 0; Document < 8; ++Document) {
+        Headers.push_back(new Access::DocumentData());
+        Storage.Save(Headers.back(), Access::BinaryData(100, 'a'), "willi");
+    }
+
+    vector<future<void>> Clients;
+    for (auto& Header : Headers) {
+        Clients.push_back(async(launch::async, [&Storage, &Header]() {
+            for (int Round = 0; Round < 5; ++Round) Storage.AssignKeywords(Header->Id, "round " + to_string(Round), "willi");
+        }));
+    }
+    for (auto& Client : Clients) Client.get();
+
+    for (auto& Header : Headers) BOOST_CHECK(Storage.Load(Header->Id, "willi")->Keywords == "round 4");
+    BOOST_CHECK(Storage.CommitUsage().Mutations == 48);
+}
+
+BOOST_AUTO_TEST_CASE(Serve_Requests_Asynchronously)
+{
+    OneBucketProvider Settings;
+    DocumentStorage Storage(Settings);
+
+    // many requests in flight, none waited for until all are queued
+    vector<Access::DocumentDataPtr> Headers;
+    vector<future<void>> Saved;
+    for (int Document = 0; Document < 50; ++Document) {
+        Headers.push_back(new Access::DocumentData());
+        Headers.back()->Name = "async" + to_string(Document) + ".txt";
+        Saved.push_back(Storage.SaveAsync(Headers.back(), Access::BinaryData(1000, static_cast<unsigned char>(Document)), "willi"));
+    }
+    for (auto& Item : Saved) Item.get();
+
+    vector<future<void>> Renamed;
+    vector<future<Access::DocumentContentPtr>> Contents;
+    for (auto& Header : Headers) {
+        Renamed.push_back(Storage.RenameAsync(Header->Id, "willi", "renamed " + Header->Name));
+        Contents.push_back(Storage.ReadAsync(Header->Id, "willi"));
+    }
+    for (size_t Index = 0; Index < Headers.size(); ++Index) {
+        Renamed[Index].get();
+        BOOST_CHECK(Contents[Index].get()->Content == Access::BinaryData(1000, static_cast<unsigned char>(Index)));
+        BOOST_CHECK(Storage.LoadAsync(Headers[Index]->Id, "willi").get()->Display == "renamed " + Headers[Index]->Name);
+    }
+    BOOST_CHECK(Storage.CommitUsage().Commits < Storage.CommitUsage().Mutations);
+
+    // errors arrive through the future
+    Storage.LockAsync(Headers[0]->Id, "willi").get();
+    auto Denied = Storage.RenameAsync(Headers[0]->Id, "hugo", "denied");
+    BOOST_CHECK_THROW(Denied.get(), Access::LockError);
+    BOOST_CHECK_THROW(Storage.LoadAsync("00unknown", "willi").get(), Access::NotFoundError);
+}
+
+BOOST_AUTO_TEST_CASE(Save_Many_Documents)
+{
+    Provider Settings;
+    DocumentStorage Storage(Settings);
+
+    Access::DocumentDataPtr Existing = new Access::DocumentData();
+    Existing->FolderPath = "/scans";
+    Storage.Save(Existing, Access::BinaryData(100, 'a'), "willi");
+
+    vector<BulkDocument> Documents;
+    for (int Document = 0; Document < 200; ++Document) {
+        Access::DocumentDataPtr Header = new Access::DocumentData();
+        Header->FolderPath = Document % 2 ? "/scans/odd" : "/scans/even";
+        Header->Name = "scan" + to_string(Document) + ".pdf";
+        Documents.emplace_back(Header, Access::BinaryData(500 + Document, static_cast<unsigned char>(Document)));
+    }
+    Documents.emplace_back(Existing, Access::BinaryData(100, 'b'));
+
+    auto Before = Storage.CommitUsage();
+    Storage.SaveMany(Documents, "willi", "nightly import");
+    auto After = Storage.CommitUsage();
+
+    // one mutation per bucket and one for the update
+    BOOST_CHECK(After.Mutations - Before.Mutations == 11);
+
+    for (auto& Item : Documents) {
+        auto Content = Storage.Read(Item.first->Id, "willi");
+        BOOST_CHECK(Content->Content == Item.second);
+        BOOST_CHECK(Content->Checksum == ContentHash::Compute(Item.second));
+    }
+    BOOST_CHECK(Storage.Find("/scans/odd", "scan7.pdf")->Id == Documents[7].first->Id);
+    BOOST_CHECK(Storage.Revisions(Existing->Id).size() == 2);
+
+    auto Infos = Storage.FoldersForPath("/scans");
+    BOOST_CHECK(Infos.size() == 3);
+    for (auto& Info : Infos) BOOST_CHECK(Info.Count == (Info.Name == "/scans" ? 1 : 100));
+}
+
+BOOST_AUTO_TEST_CASE(Save_Many_Documents_In_Batches)
+{
+    BatchedProvider Settings;
+    DocumentStorage Storage(Settings);
+
+    vector<BulkDocument> Documents;
+    for (int Document = 0; Document < 50; ++Document) {
+        Access::DocumentDataPtr Header = new Access::DocumentData();
+        Header->FolderPath = "/scans";
+        Header->Name = "scan" + to_string(Document) + ".pdf";
+        Documents.emplace_back(Header, Access::BinaryData(100 + Document, static_cast<unsigned char>(Document)));
+    }
+
+    auto Before = Storage.CommitUsage();
+    Storage.SaveMany(Documents, "willi");
+    auto After = Storage.CommitUsage();
+
+    // three full batches and the rest, the writer may commit them together
+    BOOST_CHECK(After.Mutations - Before.Mutations == 4);
+    BOOST_CHECK(After.Commits - Before.Commits <= 4);
+
+    for (auto& Item : Documents) BOOST_CHECK(Storage.Read(Item.first->Id, "willi")->Content == Item.second);
+    auto Infos = Storage.FoldersForPath("/scans");
+    BOOST_CHECK(Infos.size() == 1);
+    BOOST_CHECK(Infos[0].Count == 50);
+}
+
+BOOST_AUTO_TEST_CASE(Query_All_Buckets_Through_Workers)
+{
+    Provider Settings;
+    DocumentStorage Storage(Settings);
+
+    auto Before = Storage.QueryUsage();
+    Storage.ListMetaTags();
+    auto After = Storage.QueryUsage();
+
+    BOOST_CHECK(After.Started - Before.Started == 10);
+    BOOST_CHECK(count(After.Depths.begin(), After.Depths.end(), 0) == static_cast<int>(After.Depths.size()));
+}
+
+BOOST_AUTO_TEST_CASE(Retrieve_Compressed_Content)
+{
+    Access::BinaryData Content;
+    for (int Index = 0; Index < 20000; ++Index) Content.push_back("archive of documents "[Index % 21]);
+    
+    for (int ChunkSize : { 0, 4096 }) {
+        CompressedProvider Settings(ChunkSize);
+        DocumentStorage Storage(Settings);
+        
+        Access::DocumentDataPtr Header = new Access::DocumentData();
+        Storage.Save(Header, Content, "willi");
+        
+        SQLite::Configuration Setup;
+        Setup.Path = (path(Settings.DataLocation()) / "001domla.archive").string();
+        Setup.ReadOnly = true;
+        SQLite::Connection Connection(Setup);
+        Connection.Open();
+        auto Command = Connection.Create("SELECT (SELECT SUM(length(Data)) FROM ContentBlobs) + (SELECT IFNULL(SUM(length(Data)), 0) FROM DocumentChunks)");
+        BOOST_CHECK(Command.ExecuteScalar<int>() < static_cast<int>(Content.size()) / 2);
+        
+        auto Loaded = Storage.Read(Header->Id, "willi");
+        BOOST_CHECK(Loaded->Content == Content);
+        
+        auto Range = Storage.Read(Header->Id, "willi", 4000, 5000);
+        BOOST_CHECK(equal(Range->Content.begin(), Range->Content.end(), Content.begin() + 4000, Content.begin() + 9000));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Chunk_Large_Compressed_Content)
+{
+    Access::BinaryData Content;
+    for (int Index = 0; Index < (7 << 19); ++Index) Content.push_back("archive of documents "[Index % 21]);
+    
+    CompressedProvider Settings(0);
+    DocumentStorage Storage(Settings);
+    
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+    Storage.Save(Header, Content, "willi");
+    BOOST_CHECK(CountStoredContents(Settings, "DocumentChunks") == 4);
+    
+    auto Loaded = Storage.Read(Header->Id, "willi");
+    BOOST_CHECK(Loaded->Content == Content);
+    
+    auto Range = Storage.Read(Header->Id, "willi", (1 << 20) - 100, 200);
+    BOOST_CHECK(equal(Range->Content.begin(), Range->Content.end(), Content.begin() + (1 << 20) - 100, Content.begin() + (1 << 20) + 100));
+    BOOST_CHECK(Range->Content.size() == 200);
+}
+
+BOOST_AUTO_TEST_CASE(Retrieve_Content_Range)
+{
+    OneBucketProvider Settings;
+    DocumentStorage Storage(Settings);
+    
+    const Access::BinaryData Content {
+        '0','1','2','3','4','5','6','7','8','9',
+        '0','1','2','3','4','5','6','7','8','9',
+        '0','1','2','3','4','5','6','7','8','9',
+    };
+    
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+    Storage.Save(Header, Content, "willi");
+
+    const Access::BinaryData NewContent {
+        '0','1','2','3','4','5','6','7','8','9',
+        '9','8','7','6','5','4','3','2','1','0',
+        '0','1','2','3','4','5','6','7','8','9',
+    };
+
+    Storage.Save(Header, NewContent, "willi");
+    auto Loaded = Storage.Read(Header->Id, "willi", 10, 10);
+    BOOST_CHECK(equal(NewContent.cbegin() + 10, NewContent.cbegin() + 20, Loaded->Content.cbegin(), Loaded->Content.cend()));
+
+    Loaded = Storage.Read(Header->Id, "willi", 25, 10);
+    BOOST_CHECK(equal(NewContent.cbegin() + 25, NewContent.cend(), Loaded->Content.cbegin(), Loaded->Content.cend()));
+
+    Loaded = Storage.Read(Header->Id, "willi", 40, 10);
+    BOOST_CHECK(Loaded->Content.empty());
+}
+
+BOOST_AUTO_TEST_CASE(Retrieve_Chunked_Content)
+{
+    ChunkedProvider Settings;
+    DocumentStorage Storage(Settings);
+    
+    const Access::BinaryData Content {
+        '0','1','2','3','4','5','6','7','8','9',
+        '0','1','2','3','4','5','6','7','8','9',
+        '0','1','2','3','4','5','6','7','8','9',
+    };
+    
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+    Storage.Save(Header, Content, "willi");
+
+    const Access::BinaryData NewContent {
+        '0','1','2','3','4','5','6','7','8','9',
+        '9','8','7','6','5','4','3','2','1','0',
+        '0','1','2','3','4','5','6','7','8','9',
+    };
+
+    Storage.Save(Header, NewContent, "willi");
+
+    auto Loaded = Storage.Read(Header->Id, "willi");
+    BOOST_CHECK(equal(NewContent.cbegin(), NewContent.cend(), Loaded->Content.cbegin(), Loaded->Content.cend()));
+
+    Loaded = Storage.Read(Header->Id, "willi", 1);
+    BOOST_CHECK(equal(Content.cbegin(), Content.cend(), Loaded->Content.cbegin(), Loaded->Content.cend()));
+
+    Loaded = Storage.Read(Header->Id, "willi", 5, 14);
+    BOOST_CHECK(equal(NewContent.cbegin() + 5, NewContent.cbegin() + 19, Loaded->Content.cbegin(), Loaded->Content.cend()));
+
+    Loaded = Storage.Read(Header->Id, "willi", 28, 10);
+    BOOST_CHECK(equal(NewContent.cbegin() + 28, NewContent.cend(), Loaded->Content.cbegin(), Loaded->Content.cend()));
+}
+
+BOOST_AUTO_TEST_CASE(Identical_Contents_Are_Stored_Once)
+{
+    ChunkedProvider Settings;
+    DocumentStorage Storage(Settings);
+    
+    const Access::BinaryData Content {
+        '0','1','2','3','4','5','6','7','8','9',
+        '0','1','2','3','4','5','6','7','8','9',
+    };
+    
+    Access::DocumentDataPtr First = new Access::DocumentData();
+    First->FolderPath = "/first";
+    First->Name = "form.pdf";
+    Storage.Save(First, Content, "willi");
+
+    Access::DocumentDataPtr Second = new Access::DocumentData();
+    Second->FolderPath = "/second";
+    Second->Name = "form.pdf";
+    Storage.Save(Second, Content, "willi");
+    Storage.Copy(First->Id, "/first", "/third", "willi");
+    BOOST_CHECK(CountStoredContents(Settings) == 1);
+
+    auto Copy = Storage.Find("/third", "form.pdf");
+    auto Loaded = Storage.Read(Copy->Id, "willi");
+    BOOST_CHECK(Loaded->Content == Content);
+
+    Storage.Destroy(First->Id, "willi");
+    Storage.Destroy(Second->Id, "willi");
+    BOOST_CHECK(CountStoredContents(Settings) == 1);
+
+    Storage.Destroy(Copy->Id, "willi");
+    BOOST_CHECK(CountStoredContents(Settings) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(Store_Colliding_Content_Inline)
+{
+    Access::BinaryData Small;
+    Access::BinaryData Large;
+    for (int Index = 0; Index < 100; ++Index) Small.push_back("archive of documents "[Index % 21]);
+    for (int Index = 0; Index < (3 << 19); ++Index) Large.push_back("archive of documents "[Index % 21]);
+
+    CheckCollisionIsStoredInline(OneBucketProvider(), Small);
+    CheckCollisionIsStoredInline(CompressedProvider(0), Small);
+    CheckCollisionIsStoredInline(CompressedProvider(0), Large);
+}
+
+BOOST_AUTO_TEST_CASE(Unchanged_Content_Adds_No_Revision)
+{
+    OneBucketProvider Settings;
+    DocumentStorage Storage(Settings);
+    
+    const Access::BinaryData Content {
+        '0','1','2','3','4','5','6','7','8','9',
+    };
+    
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+    Storage.Save(Header, Content, "willi");
+    Storage.Save(Header, Content, "willi");
+
+    auto Loaded = Storage.Read(Header->Id, "willi");
+    BOOST_CHECK(Loaded->Revision == 1);
+    BOOST_CHECK(Loaded->Checksum == ContentHash::Compute(Content));
+}
+
+BOOST_AUTO_TEST_CASE(Calculate_Hashes_Keeps_Valid_Checksums)
+{
+    Provider Settings;
+    DocumentStorage Storage(Settings);
+    
+    const Access::BinaryData Content {
+        '0','1','2','3','4','5','6','7','8','9',
+    };
+    const Access::BinaryData NewContent {
+        '0','1','2','3','4','5','6','7','8','9',
+        '9','8','7','6','5','4','3','2','1','0',
+    };
+    
+    Access::DocumentDataPtr Header = new Access::DocumentData();
+    Storage.Save(Header, Content, "willi");
+    Storage.Save(Header, NewContent, "willi");
+    Storage.CalculateHashes();
+
+    BOOST_CHECK(Storage.Read(Header->Id, "willi", 1)->Checksum == ContentHash::Compute(Content));
+    BOOST_CHECK(Storage.Read(Header->Id, "willi")->Checksum == ContentHash::Compute(NewContent));
+}
+
 BOOST_AUTO_TEST_CASE(Fetch_Document_History)
 {
     OneBucketProvider Settings;
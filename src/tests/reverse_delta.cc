@@ -2,12 +2,15 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <iostream>
 #include <iterator>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <boost/test/unit_test.hpp>
 #include "archs/backend/binary_data.hxx"
+#include "archs/backend/suffix_array.hxx"
 
 using namespace std;
 using namespace Archive::Backend;
@@ -92,3 +95,230 @@ BOOST_AUTO_TEST_CASE(Apply_Patch_Tail)
 	BOOST_CHECK(NewData.size() == Check.size());
 	BOOST_CHECK(memcmp(&Check[0], &NewData[0], Check.size()) == 0);
 }
+
+BOOST_AUTO_TEST_CASE(Apply_Patch_Unrelated)
+{
+    vector<unsigned char> OldData {
+        '0','1','2','3','4','5','6','7','8','9',
+    };
+
+    vector<unsigned char> NewData {
+        'a','b','c','d','e','f','g','h','i','j',
+    };
+    
+    auto Patch = BinaryData::CreatePatch(OldData, NewData);
+    auto Check = BinaryData::ApplyPatch(OldData, Patch);
+    
+	BOOST_CHECK(NewData.size() == Check.size());
+	BOOST_CHECK(memcmp(&Check[0], &NewData[0], Check.size()) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(Apply_Patch_Large)
+{
+    // big enough to be diffed in several regions
+    vector<unsigned char> OldData(9 << 20);
+    for (size_t Index = 0; Index < OldData.size(); ++Index) OldData[Index] = static_cast<unsigned char>(Index * 2654435761u >> 13);
+
+    auto NewData = OldData;
+    for (size_t Index = 0; Index < NewData.size(); Index += 100000) NewData[Index] ^= 0x5a;
+    NewData.insert(NewData.begin() + (5 << 20), OldData.begin(), OldData.begin() + 5000);
+    
+    auto Patch = BinaryData::CreatePatch(OldData, NewData);
+    auto Check = BinaryData::ApplyPatch(OldData, Patch);
+    
+    BOOST_CHECK(Patch.size() < NewData.size() / 100);
+    BOOST_CHECK(Check == NewData);
+}
+
+BOOST_AUTO_TEST_CASE(Apply_Patch_With_Codecs)
+{
+    vector<unsigned char> OldData;
+    for (int Index = 0; Index < 5000; ++Index) OldData.push_back(static_cast<unsigned char>(Index % 251));
+
+    auto NewData = OldData;
+    NewData.insert(NewData.begin() + 1000, 300, 'x');
+    NewData.erase(NewData.begin() + 4000, NewData.begin() + 4100);
+    
+    for (auto Method : { Codec::Store, Codec::Lz4, Codec::Bzip2 }) {
+        auto Patch = BinaryData::CreatePatch(OldData, NewData, Codec(Method, 1));
+        auto Check = BinaryData::ApplyPatch(OldData, Patch);
+        
+        BOOST_CHECK(memcmp(&Patch[0], Method == Codec::Bzip2 ? "BSDIFF40" : "BSDIFF41", 8) == 0);
+        BOOST_CHECK(Check == NewData);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Apply_Patch_Streaming)
+{
+    vector<unsigned char> OldData;
+    for (int Index = 0; Index < 200000; ++Index) OldData.push_back(static_cast<unsigned char>(Index * 7 % 253));
+
+    auto NewData = OldData;
+    NewData.insert(NewData.begin() + 70000, 90000, 'x');
+    NewData.erase(NewData.begin() + 10000, NewData.begin() + 10100);
+
+    for (auto Method : { Codec::Lz4, Codec::Bzip2 }) {
+        auto Patch = BinaryData::CreatePatch(OldData, NewData, Codec(Method, 1));
+
+        vector<unsigned char> Target(10, 'y');
+        BinaryData::ApplyPatch(OldData, Patch, Target);
+        BOOST_CHECK(Target == NewData);
+
+        vector<unsigned char> Streamed;
+        size_t Largest = 0;
+        BinaryData::ApplyPatch(OldData, Patch, [&](const unsigned char* data, size_t size) {
+            Streamed.insert(Streamed.end(), data, data + size);
+            Largest = max(Largest, size);
+        });
+        BOOST_CHECK(Streamed == NewData);
+        BOOST_CHECK(Largest <= 64 << 10);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Compose_Patches)
+{
+    vector<vector<unsigned char>> Versions(1);
+    for (int Index = 0; Index < 50000; ++Index) Versions[0].push_back(static_cast<unsigned char>(Index * 13 % 251));
+
+    for (int Version = 1; Version <= 5; ++Version) {
+        auto Data = Versions.back();
+        Data.insert(Data.begin() + Version * 7000, 500, static_cast<unsigned char>('a' + Version));
+        Data.erase(Data.begin() + Version * 3000, Data.begin() + Version * 3000 + 200);
+        for (size_t Index = Version; Index < Data.size(); Index += 997) Data[Index] ^= 0x20;
+        Versions.push_back(Data);
+    }
+
+    vector<vector<unsigned char>> Patches;
+    for (size_t Version = 1; Version < Versions.size(); ++Version) {
+        Patches.push_back(BinaryData::CreatePatch(Versions[Version - 1], Versions[Version], Codec(Codec::Lz4)));
+    }
+
+    for (auto Method : { Codec::Lz4, Codec::Bzip2 }) {
+        auto Patch = BinaryData::ComposePatches(Patches, Codec(Method));
+        BOOST_CHECK(Patch.size() < Versions.back().size() / 10);
+        BOOST_CHECK(BinaryData::ApplyPatch(Versions.front(), Patch) == Versions.back());
+    }
+
+    vector<unsigned char> Streamed;
+    BinaryData::ApplyPatches(Versions.front(), Patches, [&Streamed](const unsigned char* data, size_t size) {
+        Streamed.insert(Streamed.end(), data, data + size);
+    });
+    BOOST_CHECK(Streamed == Versions.back());
+
+    // bzip2 patches compose with others
+    Patches.back() = BinaryData::CreatePatch(Versions[Versions.size() - 2], Versions.back());
+    BOOST_CHECK(BinaryData::ApplyPatch(Versions.front(), BinaryData::ComposePatches(Patches)) == Versions.back());
+    BOOST_CHECK_THROW(BinaryData::ComposePatches(vector<vector<unsigned char>>()), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(Apply_Chunk_Patch)
+{
+    vector<unsigned char> OldData(1 << 20);
+    for (size_t Index = 0; Index < OldData.size(); ++Index) OldData[Index] = static_cast<unsigned char>(Index * 2654435761u >> 13);
+
+    auto NewData = OldData;
+    NewData.insert(NewData.begin() + 100000, 3000, 'x');
+    NewData.erase(NewData.begin() + 500000, NewData.begin() + 520000);
+    NewData[800000] ^= 0x5a;
+    NewData.insert(NewData.end(), OldData.begin() + 10000, OldData.begin() + 60000);
+
+    for (auto Method : { Codec::Lz4, Codec::Bzip2 }) {
+        auto Patch = BinaryData::CreateChunkPatch(OldData, NewData, Codec(Method));
+        BOOST_CHECK(memcmp(&Patch[0], "CDCDIFF1", 8) == 0);
+        BOOST_CHECK(BinaryData::PatchEngine(Patch) == BinaryData::ContentChunks);
+        BOOST_CHECK(Patch.size() < 10000);
+        BOOST_CHECK(BinaryData::ApplyPatch(OldData, Patch) == NewData);
+
+        vector<unsigned char> Streamed;
+        BinaryData::ApplyPatch(OldData, Patch, [&Streamed](const unsigned char* data, size_t size) {
+            Streamed.insert(Streamed.end(), data, data + size);
+        });
+        BOOST_CHECK(Streamed == NewData);
+    }
+
+    // chunk patches compose with suffix sorted ones
+    auto Latest = NewData;
+    Latest.insert(Latest.begin() + 5, 10, 'y');
+    vector<vector<unsigned char>> Patches { BinaryData::CreateChunkPatch(OldData, NewData), BinaryData::CreatePatch(NewData, Latest) };
+    BOOST_CHECK(BinaryData::PatchEngine(Patches[1]) == BinaryData::SuffixSort);
+    BOOST_CHECK(BinaryData::ApplyPatch(OldData, BinaryData::ComposePatches(Patches)) == Latest);
+
+    BOOST_CHECK(BinaryData::ApplyPatch(vector<unsigned char>(), BinaryData::CreateChunkPatch(vector<unsigned char>(), NewData)) == NewData);
+    BOOST_CHECK(BinaryData::ApplyPatch(OldData, BinaryData::CreateChunkPatch(OldData, vector<unsigned char>())).empty());
+}
+
+BOOST_AUTO_TEST_CASE(Estimate_Similarity)
+{
+    vector<unsigned char> OldData(200000), Unrelated(200000);
+    for (size_t Index = 0; Index < OldData.size(); ++Index) {
+        OldData[Index] = static_cast<unsigned char>(Index * 2654435761u >> 13);
+        Unrelated[Index] = static_cast<unsigned char>(Index * 2246822519u >> 11);
+    }
+
+    auto NewData = OldData;
+    NewData.insert(NewData.begin() + 1000, 5000, 'x');
+
+    BOOST_CHECK(BinaryData::Similarity(OldData, OldData) == 1.0);
+    BOOST_CHECK(BinaryData::Similarity(OldData, NewData) > 0.9);
+    BOOST_CHECK(BinaryData::Similarity(OldData, Unrelated) < 0.05);
+    BOOST_CHECK(BinaryData::Similarity(Unrelated, vector<unsigned char>(100, 'x')) == 1.0);
+}
+
+BOOST_AUTO_TEST_CASE(Create_Patch_Within_Budget)
+{
+    vector<unsigned char> OldData(2 << 20);
+    for (size_t Index = 0; Index < OldData.size(); ++Index) OldData[Index] = static_cast<unsigned char>(Index * 2654435761u >> 13);
+    auto NewData = OldData;
+    NewData.insert(NewData.begin() + 1000, 5000, 'x');
+
+    vector<unsigned char> Patch;
+    BOOST_CHECK(BinaryData::TryCreatePatch(OldData, NewData, Codec(), chrono::milliseconds(0), Patch) == false);
+    BOOST_CHECK(Patch.empty());
+
+    BOOST_CHECK(BinaryData::TryCreatePatch(OldData, NewData, Codec(), chrono::minutes(10), Patch));
+    BOOST_CHECK(BinaryData::ApplyPatch(OldData, Patch) == NewData);
+}
+
+BOOST_AUTO_TEST_CASE(Reject_Patch_With_Invalid_Size)
+{
+    vector<unsigned char> OldData(1000, 'a');
+    auto NewData = OldData;
+    NewData[500] = 'b';
+    auto Patch = BinaryData::CreatePatch(OldData, NewData);
+
+    // the size of the result is stored in sign and magnitude at byte 24, -1 and 1 TB
+    for (auto Size : { array<unsigned char, 8> { 1, 0, 0, 0, 0, 0, 0, 0x80 }, array<unsigned char, 8> { 0, 0, 0, 0, 0, 1, 0, 0 } }) {
+        auto Corrupt = Patch;
+        copy(Size.begin(), Size.end(), Corrupt.begin() + 24);
+        vector<unsigned char> Target;
+        BOOST_CHECK_THROW(BinaryData::ApplyPatch(OldData, Corrupt, Target), runtime_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Suffix_Array_Order)
+{
+    vector<unsigned char> Data;
+    for (int Index = 0; Index < 2000; ++Index) Data.push_back(static_cast<unsigned char>(Index * Index % 7 % 3));
+    
+    auto Sorted = SuffixArray::Build<int32_t>(Data);
+    
+    BOOST_CHECK(Sorted.size() == Data.size() + 1);
+    BOOST_CHECK(Sorted[0] == static_cast<int32_t>(Data.size()));
+    for (size_t Index = 1; Index < Sorted.size(); ++Index) {
+        BOOST_CHECK(lexicographical_compare(Data.begin() + Sorted[Index - 1], Data.end(), Data.begin() + Sorted[Index], Data.end()));
+    }
+    BOOST_CHECK(SuffixArray::Build<int64_t>(Data) == vector<int64_t>(Sorted.begin(), Sorted.end()));
+}
+
+BOOST_AUTO_TEST_CASE(Suffix_Array_Checks_While_Sorting)
+{
+    vector<unsigned char> Data(3 << 20);
+    for (size_t Index = 0; Index < Data.size(); ++Index) Data[Index] = static_cast<unsigned char>(Index * 2654435761u >> 13);
+
+    int Checks = 0;
+    auto Sorted = SuffixArray::Build<int32_t>(Data, [&Checks]() { ++Checks; });
+    BOOST_CHECK(Sorted == SuffixArray::Build<int32_t>(Data));
+    BOOST_CHECK(Checks >= 8);
+
+    BOOST_CHECK_THROW(SuffixArray::Build<int32_t>(Data, []() { throw runtime_error("expired"); }), runtime_error);
+}
@@ -130,6 +130,26 @@ BOOST_AUTO_TEST_CASE(Parameters_Name_Access_Case_Insensitive)
   }
 }
 
+BOOST_AUTO_TEST_CASE(Parameters_Know_Their_Index)
+{
+  Configuration Setup;
+  Setup.Path = ":memory:";
+  
+  Connection Con(Setup);
+  Con.OpenNew();
+  
+  {
+  auto Target = Con.Create("CREATE TABLE a(one INT, two INT)");
+  Target.Execute();
+  }
+  
+  {
+  auto Target = Con.Create("INSERT INTO a (one, two) VALUES (:one, :two)");
+  BOOST_CHECK(Target.Parameters()["one"].Index() == 1);
+  BOOST_CHECK(Target.Parameters()["two"].Index() == 2);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(Inserting_Values_Into_Memory)
 {
   Configuration Setup;
@@ -395,6 +415,42 @@ BOOST_AUTO_TEST_CASE(Write_And_Read_Binary_Data_From_Pointer)
   BOOST_CHECK(Check[6] == 1);
 }
 
+BOOST_AUTO_TEST_CASE(Read_Binary_Data_Incrementally)
+{
+  Configuration Setup;
+  Setup.Path = ":memory:";
+  
+  Connection Con(Setup);
+  Con.OpenNew();
+  
+  std::vector<unsigned char> Buffer { 1, 2, 3, 0, 3, 2, 1 };
+  
+  { 
+  auto Target = Con.Create("CREATE TABLE a(one BLOB NOT NULL)");
+  Target.Execute();
+  }
+  
+  {
+  auto Target = Con.Create("INSERT INTO a (one) VALUES (:one)");
+  Target.Parameters()["one"].SetValue(Buffer);
+  Target.Execute();
+  }
+  
+  auto Target = Con.OpenBlob("a", "one", 1);
+  BOOST_CHECK(Target.Size() == 7);
+
+  auto Check = Target.Read(2, 3);
+  BOOST_CHECK(std::equal(Buffer.begin() + 2, Buffer.begin() + 5, Check.begin(), Check.end()));
+
+  Check = Target.Read(5, 10);
+  BOOST_CHECK(std::equal(Buffer.begin() + 5, Buffer.end(), Check.begin(), Check.end()));
+  BOOST_CHECK(Target.Read(7, 10).empty());
+
+  unsigned char Single = 0;
+  BOOST_CHECK_THROW(Target.Read(7, &Single, 1), sqlite_exception);
+  BOOST_CHECK_THROW(Con.OpenBlob("a", "one", 2), sqlite_exception);
+}
+
 BOOST_AUTO_TEST_CASE(Rollback_Reverts_Changes)
 {
   Configuration Setup;
@@ -499,6 +555,48 @@ BOOST_AUTO_TEST_CASE(Scoped_Rollback_Reverts_Changes)
   }
 }
 
+BOOST_AUTO_TEST_CASE(Nested_Rollback_Reverts_Only_Inner_Changes)
+{
+  Configuration Setup;
+  Setup.Path = ":memory:";
+  
+  Connection Con(Setup);
+  Con.OpenNew();
+  
+  {
+  auto Target = Con.Create("CREATE TABLE a(one INT NOT NULL, two INT NOT NULL)");
+  Target.Execute();
+  }
+
+  {
+  auto Outer = Con.Begin();
+  {
+  auto Target = Con.Create("INSERT INTO a (one, two) VALUES (1, 1)");
+  Target.Execute();
+  }
+  {
+  auto Inner = Con.Begin();
+  auto Target = Con.Create("INSERT INTO a (one, two) VALUES (2, 2)");
+  Target.Execute();
+  Inner.Rollback();
+  }
+  {
+  auto Inner = Con.Begin();
+  auto Target = Con.Create("INSERT INTO a (one, two) VALUES (3, 3)");
+  Target.Execute();
+  Inner.Commit();
+  }
+  Outer.Commit();
+  }
+  
+  {
+  auto Target = Con.Create("SELECT SUM(one) FROM a");
+  auto Result = Target.ExecuteScalar<int>();
+
+  BOOST_CHECK(Result == 4);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(Reusing_Prepared_Statement)
 {
   Configuration Setup;
@@ -534,6 +632,102 @@ BOOST_AUTO_TEST_CASE(Reusing_Prepared_Statement)
   BOOST_CHECK(Rows == 2);
 }
 
+BOOST_AUTO_TEST_CASE(Statement_Cache_Reuses_Statements)
+{
+  Configuration Setup;
+  Setup.Path = ":memory:";
+  
+  Connection Con(Setup);
+  Con.OpenNew();
+  
+  {
+  auto Target = Con.Create("CREATE TABLE a(one INT NOT NULL, two INT NOT NULL)");
+  Target.Execute();
+  }
+  
+  auto Before = Con.StatementCacheUsage();
+  for (int Index = 0; Index < 3; ++Index) {
+    auto Target = Con.Create("INSERT INTO a (one, two) VALUES (:one, :two)");
+    Target.Parameters()["one"].SetValue(Index);
+    Target.Parameters()["two"].SetValue(Index);
+    Target.Execute();
+  }
+  auto After = Con.StatementCacheUsage();
+  
+  BOOST_CHECK(After.Misses - Before.Misses == 1);
+  BOOST_CHECK(After.Hits - Before.Hits == 2);
+  
+  {
+  auto Target = Con.Create("SELECT COUNT(*) FROM a");
+  BOOST_CHECK(Target.ExecuteScalar<int>() == 3);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(Statement_Cache_Resets_Reused_Statements)
+{
+  Configuration Setup;
+  Setup.Path = ":memory:";
+  
+  Connection Con(Setup);
+  Con.OpenNew();
+  
+  {
+  auto Target = Con.Create("CREATE TABLE a(one INT NOT NULL)");
+  Target.Execute();
+  }
+  
+  {
+  auto Target = Con.Create("INSERT INTO a (one) VALUES (:one)");
+  Target.Parameters()["one"].SetValue(1);
+  Target.Execute();
+  Target.Parameters()["one"].SetValue(2);
+  Target.Execute();
+  }
+  
+  {
+  auto Target = Con.Create("SELECT one FROM a ORDER BY one");
+  auto Result = Target.Open();
+  BOOST_CHECK(Result.begin()->Get<int>(0) == 1);
+  }
+  
+  auto Rows = 0;
+  {
+  auto Target = Con.Create("SELECT one FROM a ORDER BY one");
+  auto Result = Target.Open();
+  
+  for (const ResultRow& Row : Result) ++Rows;
+  }
+  
+  BOOST_CHECK(Rows == 2);
+}
+
+BOOST_AUTO_TEST_CASE(Statement_Cache_Is_Bounded)
+{
+  Configuration Setup;
+  Setup.Path = ":memory:";
+  Setup.StatementCacheSize = 1;
+  
+  Connection Con(Setup);
+  Con.OpenNew();
+  
+  {
+  auto Target = Con.Create("SELECT 1");
+  Target.Execute();
+  }
+  {
+  auto Target = Con.Create("SELECT 2");
+  Target.Execute();
+  }
+  {
+  auto Target = Con.Create("SELECT 1");
+  Target.Execute();
+  }
+  
+  auto Usage = Con.StatementCacheUsage();
+  BOOST_CHECK(Usage.Hits == 0);
+  BOOST_CHECK(Usage.Misses == 3);
+}
+
 BOOST_AUTO_TEST_CASE(Create_Free_Command)
 {
   Configuration Setup;
@@ -602,3 +796,46 @@ BOOST_AUTO_TEST_CASE(PartsCount_Tolerates_No_Parts)
 
   BOOST_CHECK(Result == 0);
 }
+
+BOOST_AUTO_TEST_CASE(Read_Values_Without_Copy)
+{
+  Configuration Setup;
+  Setup.Path = ":memory:";
+  
+  Connection Con(Setup);
+  Con.OpenNew();
+  
+  std::vector<unsigned char> Buffer { 1, 2, 3, 0, 3, 2, 1 };
+  std::string Text("one\0two", 7);
+  
+  { 
+  auto Target = Con.Create("CREATE TABLE a(one BLOB, two TEXT)");
+  Target.Execute();
+  }
+  
+  {
+  auto Target = Con.Create("INSERT INTO a (one, two) VALUES (:one, :two), (NULL, NULL)");
+  Target.Parameters()["one"].SetValue(Buffer);
+  Target.Parameters()["two"].SetValue(Text);
+  Target.Execute();
+  }
+  
+  auto Target = Con.Create("SELECT one, two FROM a ORDER BY rowid");
+  auto Result = Target.Open();
+  auto Row = Result.begin();
+  
+  auto Blob = Row->GetBlobView("one");
+  BOOST_CHECK(std::equal(Buffer.begin(), Buffer.end(), Blob.begin(), Blob.end()));
+  BOOST_CHECK(Row->GetText("two") == Text);
+  BOOST_CHECK(Row->Get<std::string>("two") == Text);
+
+  std::vector<unsigned char> Check(100, 9);
+  Row->GetBlob(0, Check);
+  BOOST_CHECK(Check == Buffer);
+
+  ++Row;
+  BOOST_CHECK(Row->GetBlobView(0).empty());
+  BOOST_CHECK(Row->GetText(1).empty());
+  Row->GetBlob(0, Check);
+  BOOST_CHECK(Check.empty());
+}
@@ -2,9 +2,13 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <iostream>
 #include <iterator>
 #include <string>
+#include <thread>
 #include <vector>
 #include <boost/test/unit_test.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -31,3 +35,57 @@ BOOST_AUTO_TEST_CASE(Guid_Formatted_As_Expected)
     BOOST_CHECK(Id[0] != '{');
     BOOST_CHECK(Id[8] == '-');
 }
+
+BOOST_AUTO_TEST_CASE(Work_Stealing_Pool_Runs_All_Tasks)
+{
+    Utils::WorkStealingPool Pool(3);
+
+    vector<future<size_t>> Results;
+    for (size_t Index = 0; Index < 500; ++Index) Results.push_back(Pool.Submit(Index % 7, [Index]() { return Index * 2; }));
+
+    size_t Sum = 0;
+    for (auto& Result : Results) Sum += Result.get();
+    BOOST_CHECK(Sum == 499 * 500);
+
+    auto Usage = Pool.Usage();
+    BOOST_CHECK(Usage.Depths.size() == 3);
+    BOOST_CHECK(count(Usage.Depths.begin(), Usage.Depths.end(), 0) == 3);
+    BOOST_CHECK(Usage.PeakDepth >= 1);
+}
+
+BOOST_AUTO_TEST_CASE(Wait_For_Queued_Tasks)
+{
+    Utils::WorkStealingPool Pool(2);
+
+    atomic<int> Done(0);
+    for (int Index = 0; Index < 50; ++Index) {
+        Pool.Post(Index, [&Done]() {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            ++Done;
+        });
+    }
+
+    Pool.Wait();
+    BOOST_CHECK(Done == 50);
+    BOOST_CHECK(Pool.Usage().Started == 50);
+}
+
+BOOST_AUTO_TEST_CASE(Idle_Worker_Steals_From_Busy_One)
+{
+    Utils::WorkStealingPool Pool(2);
+
+    // one worker blocks, the tasks queued behind the blocker have to be run by the other
+    promise<void> Release;
+    auto Blocker = Pool.Submit(0, [&Release]() { Release.get_future().wait(); });
+    vector<future<int>> Queued;
+    for (int Index = 0; Index < 4; ++Index) Queued.push_back(Pool.Submit(0, [Index]() { return Index; }));
+
+    for (int Index = 0; Index < 4; ++Index) {
+        BOOST_REQUIRE(Queued[Index].wait_for(chrono::seconds(5)) == future_status::ready);
+        BOOST_CHECK(Queued[Index].get() == Index);
+    }
+    BOOST_CHECK(Pool.Usage().Stolen >= 1);
+
+    Release.set_value();
+    Blocker.get();
+}